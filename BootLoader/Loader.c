@@ -35,6 +35,8 @@ typedef struct {
 
     UINTN LoadedFileCount;
     LOADED_FILE LoadedFiles[MAX_LOADED_FILES];
+
+    uint64_t AcpiRsdp;
 } BOOT_INFO;
 
 typedef struct {
@@ -284,6 +286,26 @@ static EFI_STATUS LoadDriverModuleFile(
     return EFI_SUCCESS;
 }
 
+/* The kernel finds the other CPUs through the MADT; prefer the ACPI 2.0 RSDP. */
+static uint64_t FindAcpiRsdp(EFI_SYSTEM_TABLE *ST)
+{
+    EFI_GUID Acpi20Guid = ACPI_20_TABLE_GUID;
+    EFI_GUID Acpi10Guid = ACPI_TABLE_GUID;
+    uint64_t Rsdp = 0;
+
+    for (UINTN i = 0; i < ST->NumberOfTableEntries; ++i) {
+        EFI_CONFIGURATION_TABLE *Table = &ST->ConfigurationTable[i];
+        if (CompareGuid(&Table->VendorGuid, &Acpi20Guid) == 0) {
+            return (uint64_t)(UINTN)Table->VendorTable;
+        }
+        if (Rsdp == 0 && CompareGuid(&Table->VendorGuid, &Acpi10Guid) == 0) {
+            Rsdp = (uint64_t)(UINTN)Table->VendorTable;
+        }
+    }
+
+    return Rsdp;
+}
+
 static EFI_STATUS PreloadDriverModules(
     EFI_SYSTEM_TABLE *ST,
     EFI_FILE_PROTOCOL *Root,
@@ -483,6 +505,8 @@ EFI_STATUS EFIAPI efi_main(
     Status = PreloadDriverModules(ST, Root, &BootInfo);
     CHECK(Status, L"Preload Drivers");
 
+    BootInfo.AcpiRsdp = FindAcpiRsdp(ST);
+
     Print(L"[LOADER] Jumping to kernel\n");
 
     Status = ExitBootServicesComplete(
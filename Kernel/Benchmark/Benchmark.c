@@ -0,0 +1,344 @@
+#include "Benchmark.h"
+
+#include "../DefaultLibrary/DefaultLibrary.h"
+#include "../Memory/Memory_Main.h"
+#include "../Paging/Paging_Main.h"
+#include "../ProcessManager/ProcessManager.h"
+#include "../Serial.h"
+#include "../Timer/Timer.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BENCH_HEAP_MAX_LIVE 2048u
+#define BENCH_HEAP_ROUNDS   4u
+#define BENCH_PAGE_LIVE     1024u
+#define BENCH_PAGE_ROUNDS   4u
+#define BENCH_MEM_BUF_PAGES 1024u
+#define BENCH_MEM_BYTES     (32ull << 20)
+#define BENCH_MEM_CAL_TICKS 6u
+#define BENCH_MEM_CAL_LIMIT (20ull * 1000ull * 1000ull * 1000ull)
+#define BENCH_CTXSW_PAGES   256u
+#define BENCH_CTXSW_ROUNDS  256u
+
+static void *g_bench_ptrs[BENCH_HEAP_MAX_LIVE];
+
+static inline uint64_t bench_rdtsc(void)
+{
+    uint32_t lo;
+    uint32_t hi;
+    __asm__ volatile ("lfence; rdtsc" : "=a"(lo), "=d"(hi) :: "memory");
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static uint32_t bench_next_random(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static void bench_report(const char *name, uint64_t population, uint64_t cycles, uint64_t ops)
+{
+    serial_write_string("[OS] [BENCH] ");
+    serial_write_string(name);
+    serial_write_string(" live=");
+    serial_write_uint64(population);
+    serial_write_string(" cycles/op=");
+    serial_write_uint64((ops != 0) ? (cycles / ops) : 0);
+    serial_write_string("\n");
+}
+
+/*
+ * Allocate `population` live blocks of mixed small/large sizes, then time a
+ * free+alloc churn over them. With a list-scanning heap the per-op cost grows
+ * with the population; with the slab/boundary-tag heap it should stay flat.
+ */
+static void bench_heap_population(uint32_t population, int large)
+{
+    uint32_t seed = 0x9E3779B9u ^ population;
+    uint64_t alloc_cycles = 0;
+    uint64_t free_cycles = 0;
+    uint64_t ops = 0;
+
+    for (uint32_t i = 0; i < population; ++i) {
+        uint32_t size = large ? (2049u + (bench_next_random(&seed) % 6144u))
+                              : (16u + (bench_next_random(&seed) % 2032u));
+        g_bench_ptrs[i] = kmalloc(size);
+    }
+
+    for (uint32_t round = 0; round < BENCH_HEAP_ROUNDS; ++round) {
+        for (uint32_t i = 0; i < population; ++i) {
+            uint32_t idx = bench_next_random(&seed) % population;
+            uint32_t size = large ? (2049u + (bench_next_random(&seed) % 6144u))
+                                  : (16u + (bench_next_random(&seed) % 2032u));
+
+            uint64_t t0 = bench_rdtsc();
+            kfree(g_bench_ptrs[idx]);
+            uint64_t t1 = bench_rdtsc();
+            g_bench_ptrs[idx] = kmalloc(size);
+            uint64_t t2 = bench_rdtsc();
+
+            free_cycles += t1 - t0;
+            alloc_cycles += t2 - t1;
+            ++ops;
+        }
+    }
+
+    bench_report(large ? "heap.large.kmalloc" : "heap.small.kmalloc", population, alloc_cycles, ops);
+    bench_report(large ? "heap.large.kfree" : "heap.small.kfree", population, free_cycles, ops);
+
+    for (uint32_t i = 0; i < population; ++i) {
+        kfree(g_bench_ptrs[i]);
+        g_bench_ptrs[i] = NULL;
+    }
+}
+
+void benchmark_heap_stress(void)
+{
+    static const uint32_t populations[] = { 64u, 512u, BENCH_HEAP_MAX_LIVE };
+
+    serial_write_string("[OS] [BENCH] heap stress start\n");
+    for (uint32_t i = 0; i < sizeof(populations) / sizeof(populations[0]); ++i) {
+        bench_heap_population(populations[i], 0);
+        bench_heap_population(populations[i], 1);
+    }
+    memory_print_lock_stats();
+    serial_write_string("[OS] [BENCH] heap stress done\n");
+}
+
+/*
+ * Page allocator churn: single pages, 16-page aligned runs (DMA/page-table
+ * shaped) and one multi-MiB run that has to span several max-order blocks.
+ */
+void benchmark_page_alloc(void)
+{
+    uint32_t seed = 0x2545F491u;
+    uint64_t cycles = 0;
+    uint64_t ops = 0;
+
+    serial_write_string("[OS] [BENCH] page allocator start\n");
+    for (uint32_t i = 0; i < BENCH_PAGE_LIVE; ++i) {
+        g_bench_ptrs[i] = alloc_page();
+    }
+    for (uint32_t round = 0; round < BENCH_PAGE_ROUNDS; ++round) {
+        for (uint32_t i = 0; i < BENCH_PAGE_LIVE; ++i) {
+            uint32_t idx = bench_next_random(&seed) % BENCH_PAGE_LIVE;
+            uint64_t t0 = bench_rdtsc();
+            free_page(g_bench_ptrs[idx]);
+            g_bench_ptrs[idx] = alloc_page();
+            cycles += bench_rdtsc() - t0;
+            ++ops;
+        }
+    }
+    bench_report("page.single", BENCH_PAGE_LIVE, cycles, ops);
+    for (uint32_t i = 0; i < BENCH_PAGE_LIVE; ++i) {
+        free_page(g_bench_ptrs[i]);
+        g_bench_ptrs[i] = NULL;
+    }
+
+    cycles = 0;
+    ops = 0;
+    for (uint32_t i = 0; i < BENCH_PAGE_LIVE / 16u; ++i) {
+        uint64_t t0 = bench_rdtsc();
+        g_bench_ptrs[i] = alloc_contiguous_pages(16u, 16u);
+        cycles += bench_rdtsc() - t0;
+        ++ops;
+    }
+    bench_report("page.contig16", BENCH_PAGE_LIVE / 16u, cycles, ops);
+    for (uint32_t i = 0; i < BENCH_PAGE_LIVE / 16u; ++i) {
+        free_contiguous_pages(g_bench_ptrs[i], 16u);
+        g_bench_ptrs[i] = NULL;
+    }
+
+    uint64_t t0 = bench_rdtsc();
+    void *big = alloc_contiguous_pages(4096u, 1u);
+    bench_report("page.contig16m", 1, bench_rdtsc() - t0, 1);
+    free_contiguous_pages(big, 4096u);
+    serial_write_string("[OS] [BENCH] page allocator done\n");
+}
+
+/* TSC frequency measured against the PIT; 0 if the timer is not ticking. */
+static uint64_t bench_tsc_hz(void)
+{
+    uint32_t hz = timer_hz();
+    if (hz == 0) {
+        return 0;
+    }
+
+    uint64_t start = bench_rdtsc();
+    uint64_t tick = timer_ticks();
+    while (timer_ticks() == tick) {
+        if (bench_rdtsc() - start > BENCH_MEM_CAL_LIMIT) {
+            return 0;
+        }
+        __asm__ volatile ("pause");
+    }
+
+    tick = timer_ticks();
+    uint64_t t0 = bench_rdtsc();
+    while (timer_ticks() - tick < BENCH_MEM_CAL_TICKS) {
+        __asm__ volatile ("pause");
+    }
+    return (bench_rdtsc() - t0) * hz / BENCH_MEM_CAL_TICKS;
+}
+
+static void bench_report_bandwidth(const char *name, uint64_t size, uint64_t ops,
+                                   uint64_t cycles, uint64_t tsc_hz)
+{
+    serial_write_string("[OS] [BENCH] ");
+    serial_write_string(name);
+    serial_write_string(" size=");
+    serial_write_uint64(size);
+    serial_write_string(" cycles/op=");
+    serial_write_uint64((ops != 0) ? (cycles / ops) : 0);
+    serial_write_string(" GB/s=");
+    if (tsc_hz == 0 || cycles == 0) {
+        serial_write_string("n/a\n");
+        return;
+    }
+
+    uint64_t bytes_per_sec = (size * ops) * tsc_hz / cycles;
+    uint64_t centi = bytes_per_sec / 10000000ull;
+    serial_write_uint64(centi / 100u);
+    serial_write_string(".");
+    serial_write_char((char)('0' + (centi / 10u) % 10u));
+    serial_write_char((char)('0' + centi % 10u));
+    serial_write_string("\n");
+}
+
+void benchmark_memory_kernels(void)
+{
+    static const uint32_t sizes[] = { 16u, 64u, 256u, 1024u, 4096u, 65536u, 1u << 20, 4u << 20 };
+    uint8_t *src = (uint8_t *)alloc_contiguous_pages(BENCH_MEM_BUF_PAGES, 1u);
+    uint8_t *dst = (uint8_t *)alloc_contiguous_pages(BENCH_MEM_BUF_PAGES, 1u);
+    if (src == NULL || dst == NULL) {
+        serial_write_string("[OS] [BENCH] memory kernels skipped: no buffers\n");
+        free_contiguous_pages(src, BENCH_MEM_BUF_PAGES);
+        free_contiguous_pages(dst, BENCH_MEM_BUF_PAGES);
+        return;
+    }
+
+    serial_write_string("[OS] [BENCH] memory kernels start\n");
+    uint64_t tsc_hz = bench_tsc_hz();
+    memset(src, 0x5A, (size_t)BENCH_MEM_BUF_PAGES * 4096u);
+    memset(dst, 0x5A, (size_t)BENCH_MEM_BUF_PAGES * 4096u);
+
+    for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        uint64_t size = sizes[i];
+        uint64_t ops = BENCH_MEM_BYTES / size;
+
+        uint64_t t0 = bench_rdtsc();
+        for (uint64_t op = 0; op < ops; ++op) {
+            memcpy(dst, src, (size_t)size);
+        }
+        bench_report_bandwidth("memcpy", size, ops, bench_rdtsc() - t0, tsc_hz);
+
+        t0 = bench_rdtsc();
+        for (uint64_t op = 0; op < ops; ++op) {
+            memset(dst, (int)(op & 0xFFu), (size_t)size);
+        }
+        bench_report_bandwidth("memset", size, ops, bench_rdtsc() - t0, tsc_hz);
+
+        memcpy(dst, src, (size_t)size);
+        int mismatch = 0;
+        t0 = bench_rdtsc();
+        for (uint64_t op = 0; op < ops; ++op) {
+            mismatch |= memcmp(dst, src, (size_t)size);
+        }
+        bench_report_bandwidth("memcmp", size, ops, bench_rdtsc() - t0, tsc_hz);
+        if (mismatch != 0) {
+            serial_write_string("[OS] [BENCH] memcmp reported a mismatch on equal buffers\n");
+        }
+    }
+
+    free_contiguous_pages(src, BENCH_MEM_BUF_PAGES);
+    free_contiguous_pages(dst, BENCH_MEM_BUF_PAGES);
+    serial_write_string("[OS] [BENCH] memory kernels done\n");
+}
+
+static int bench_ctxsw_populate(uint64_t cr3)
+{
+    uint64_t size = (uint64_t)BENCH_CTXSW_PAGES * 4096u;
+    if (paging_reserve_user_range(cr3, USER_HEAP_BASE, size, PAGE_RW) < 0) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < BENCH_CTXSW_PAGES; ++i) {
+        void *page = alloc_zeroed_page();
+        if (page == NULL) {
+            return -1;
+        }
+        if (paging_map_user_page(cr3, USER_HEAP_BASE + (uint64_t)i * 4096u,
+                                 (uint64_t)(uintptr_t)page, PAGE_RW) < 0) {
+            free_page(page);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void bench_ctxsw_touch(void)
+{
+    for (uint32_t i = 0; i < BENCH_CTXSW_PAGES; ++i) {
+        (void)*(volatile uint64_t *)(uintptr_t)(USER_HEAP_BASE + (uint64_t)i * 4096u);
+    }
+}
+
+static uint64_t bench_ctxsw_run(uint64_t cr3_a, uint64_t cr3_b, int flush)
+{
+    uint64_t t0 = bench_rdtsc();
+    for (uint32_t round = 0; round < BENCH_CTXSW_ROUNDS; ++round) {
+        uint64_t next = (round & 1u) ? cr3_b : cr3_a;
+        if (flush) {
+            paging_flush_space_tlb(next);
+        }
+        paging_switch_cr3(next);
+        bench_ctxsw_touch();
+    }
+    return bench_rdtsc() - t0;
+}
+
+/*
+ * Ping-pong between two address spaces, touching the same spread of pages
+ * after every switch. The flushing run forces each switch to start cold, as
+ * every CR3 load did before PCID; the other keeps tagged entries alive, so
+ * the gap between the two is the TLB refill cost a switch no longer pays.
+ */
+void benchmark_context_switch(void)
+{
+    uint64_t prev_cr3 = paging_get_active_cr3();
+    uint64_t cr3_a = paging_create_process_space();
+    uint64_t cr3_b = paging_create_process_space();
+    if (cr3_a == 0 || cr3_b == 0 ||
+        bench_ctxsw_populate(cr3_a) < 0 || bench_ctxsw_populate(cr3_b) < 0) {
+        serial_write_string("[OS] [BENCH] context switch skipped: no address spaces\n");
+        paging_destroy_process_space(cr3_a);
+        paging_destroy_process_space(cr3_b);
+        return;
+    }
+
+    serial_write_string("[OS] [BENCH] context switch start");
+    serial_write_string(paging_pcid_enabled() ? " (pcid)\n" : " (no pcid)\n");
+    /* Warm both spaces' PCIDs once so neither run pays first-touch costs. */
+    bench_ctxsw_run(cr3_a, cr3_b, 0);
+    bench_report("ctxsw.flush", BENCH_CTXSW_PAGES, bench_ctxsw_run(cr3_a, cr3_b, 1), BENCH_CTXSW_ROUNDS);
+    bench_ctxsw_run(cr3_a, cr3_b, 0);
+    bench_report("ctxsw.keep", BENCH_CTXSW_PAGES, bench_ctxsw_run(cr3_a, cr3_b, 0), BENCH_CTXSW_ROUNDS);
+
+    paging_switch_cr3(prev_cr3);
+    paging_destroy_process_space(cr3_a);
+    paging_destroy_process_space(cr3_b);
+    serial_write_string("[OS] [BENCH] context switch done\n");
+}
+
+void benchmark_run_boot_suite(void)
+{
+    serial_write_string("[OS] [BENCH] Boot benchmark suite\n");
+    benchmark_heap_stress();
+    benchmark_page_alloc();
+    benchmark_memory_kernels();
+    benchmark_context_switch();
+}
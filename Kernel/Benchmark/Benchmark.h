@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdint.h>
+
+void benchmark_run_boot_suite(void);
+void benchmark_heap_stress(void);
+void benchmark_page_alloc(void);
+void benchmark_memory_kernels(void);
+void benchmark_context_switch(void);
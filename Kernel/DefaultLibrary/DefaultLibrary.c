@@ -11,30 +11,300 @@ void free(void* ptr) {
     kfree(ptr);
 }
 
+/*
+ * Memory kernels. Small sizes use 8-byte words, medium sizes an SSE2 loop
+ * with aligned stores, and large sizes `rep movsb`/`rep stosb` when the CPU
+ * advertises ERMS (non-temporal SSE2 stores otherwise). Copies always run
+ * forward, so overlapping copies with dst < src keep working.
+ *
+ * Context switches do not save the SSE state, so every SSE2 kernel spills
+ * the xmm registers it uses and restores them before returning.
+ */
+#define MEM_SSE_MIN_BYTES   256u
+#define MEM_ERMS_MIN_BYTES  2048u
+#define MEM_NT_MIN_BYTES    (1024u * 1024u)
+#define MEM_SSE_BLOCK_BYTES 64u
+
+#define MEM_FEATURE_PROBED 0x1u
+#define MEM_FEATURE_ERMS   0x2u
+
+typedef uint64_t __attribute__((may_alias, aligned(1))) mem_word_t;
+
+static uint32_t g_mem_features = 0;
+
+static uint32_t mem_features(void) {
+    uint32_t features = g_mem_features;
+    if (features & MEM_FEATURE_PROBED) {
+        return features;
+    }
+
+    uint32_t eax = 0, ebx = 0, ecx = 0, edx = 0;
+    __asm__ volatile ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0u), "c"(0u));
+    features = MEM_FEATURE_PROBED;
+    if (eax >= 7u) {
+        __asm__ volatile ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(7u), "c"(0u));
+        if (ebx & (1u << 9)) {
+            features |= MEM_FEATURE_ERMS;
+        }
+    }
+    g_mem_features = features;
+    return features;
+}
+
+static void mem_copy_words(uint8_t *d, const uint8_t *s, size_t n) {
+    while (n >= 8u) {
+        *(mem_word_t *)d = *(const mem_word_t *)s;
+        d += 8;
+        s += 8;
+        n -= 8u;
+    }
+    while (n--) {
+        *d++ = *s++;
+    }
+}
+
+static void mem_fill_words(uint8_t *d, uint64_t pattern, size_t n) {
+    while (n >= 8u) {
+        *(mem_word_t *)d = pattern;
+        d += 8;
+        n -= 8u;
+    }
+    while (n--) {
+        *d++ = (uint8_t)pattern;
+    }
+}
+
+/* Copies blocks * 64 bytes; d must be 16-byte aligned. */
+static void mem_copy_sse2(uint8_t *d, const uint8_t *s, size_t blocks, int streaming) {
+    uint8_t save[64] __attribute__((aligned(16)));
+
+    if (streaming) {
+        __asm__ volatile (
+            "movdqa %%xmm0, 0(%[sv])\n\t"
+            "movdqa %%xmm1, 16(%[sv])\n\t"
+            "movdqa %%xmm2, 32(%[sv])\n\t"
+            "movdqa %%xmm3, 48(%[sv])\n\t"
+            "1:\n\t"
+            "movdqu 0(%[s]), %%xmm0\n\t"
+            "movdqu 16(%[s]), %%xmm1\n\t"
+            "movdqu 32(%[s]), %%xmm2\n\t"
+            "movdqu 48(%[s]), %%xmm3\n\t"
+            "movntdq %%xmm0, 0(%[d])\n\t"
+            "movntdq %%xmm1, 16(%[d])\n\t"
+            "movntdq %%xmm2, 32(%[d])\n\t"
+            "movntdq %%xmm3, 48(%[d])\n\t"
+            "add $64, %[s]\n\t"
+            "add $64, %[d]\n\t"
+            "dec %[n]\n\t"
+            "jnz 1b\n\t"
+            "sfence\n\t"
+            "movdqa 0(%[sv]), %%xmm0\n\t"
+            "movdqa 16(%[sv]), %%xmm1\n\t"
+            "movdqa 32(%[sv]), %%xmm2\n\t"
+            "movdqa 48(%[sv]), %%xmm3"
+            : [d] "+r"(d), [s] "+r"(s), [n] "+r"(blocks)
+            : [sv] "r"(save)
+            : "memory", "cc");
+        return;
+    }
+
+    __asm__ volatile (
+        "movdqa %%xmm0, 0(%[sv])\n\t"
+        "movdqa %%xmm1, 16(%[sv])\n\t"
+        "movdqa %%xmm2, 32(%[sv])\n\t"
+        "movdqa %%xmm3, 48(%[sv])\n\t"
+        "1:\n\t"
+        "movdqu 0(%[s]), %%xmm0\n\t"
+        "movdqu 16(%[s]), %%xmm1\n\t"
+        "movdqu 32(%[s]), %%xmm2\n\t"
+        "movdqu 48(%[s]), %%xmm3\n\t"
+        "movdqa %%xmm0, 0(%[d])\n\t"
+        "movdqa %%xmm1, 16(%[d])\n\t"
+        "movdqa %%xmm2, 32(%[d])\n\t"
+        "movdqa %%xmm3, 48(%[d])\n\t"
+        "add $64, %[s]\n\t"
+        "add $64, %[d]\n\t"
+        "dec %[n]\n\t"
+        "jnz 1b\n\t"
+        "movdqa 0(%[sv]), %%xmm0\n\t"
+        "movdqa 16(%[sv]), %%xmm1\n\t"
+        "movdqa 32(%[sv]), %%xmm2\n\t"
+        "movdqa 48(%[sv]), %%xmm3"
+        : [d] "+r"(d), [s] "+r"(s), [n] "+r"(blocks)
+        : [sv] "r"(save)
+        : "memory", "cc");
+}
+
+/* Fills blocks * 64 bytes; d must be 16-byte aligned. */
+static void mem_fill_sse2(uint8_t *d, uint64_t pattern, size_t blocks, int streaming) {
+    uint8_t save[16] __attribute__((aligned(16)));
+
+    if (streaming) {
+        __asm__ volatile (
+            "movdqa %%xmm0, (%[sv])\n\t"
+            "movq %[p], %%xmm0\n\t"
+            "punpcklqdq %%xmm0, %%xmm0\n\t"
+            "1:\n\t"
+            "movntdq %%xmm0, 0(%[d])\n\t"
+            "movntdq %%xmm0, 16(%[d])\n\t"
+            "movntdq %%xmm0, 32(%[d])\n\t"
+            "movntdq %%xmm0, 48(%[d])\n\t"
+            "add $64, %[d]\n\t"
+            "dec %[n]\n\t"
+            "jnz 1b\n\t"
+            "sfence\n\t"
+            "movdqa (%[sv]), %%xmm0"
+            : [d] "+r"(d), [n] "+r"(blocks)
+            : [p] "r"(pattern), [sv] "r"(save)
+            : "memory", "cc");
+        return;
+    }
+
+    __asm__ volatile (
+        "movdqa %%xmm0, (%[sv])\n\t"
+        "movq %[p], %%xmm0\n\t"
+        "punpcklqdq %%xmm0, %%xmm0\n\t"
+        "1:\n\t"
+        "movdqa %%xmm0, 0(%[d])\n\t"
+        "movdqa %%xmm0, 16(%[d])\n\t"
+        "movdqa %%xmm0, 32(%[d])\n\t"
+        "movdqa %%xmm0, 48(%[d])\n\t"
+        "add $64, %[d]\n\t"
+        "dec %[n]\n\t"
+        "jnz 1b\n\t"
+        "movdqa (%[sv]), %%xmm0"
+        : [d] "+r"(d), [n] "+r"(blocks)
+        : [p] "r"(pattern), [sv] "r"(save)
+        : "memory", "cc");
+}
+
+/*
+ * Compares 16-byte blocks until the first one that differs. Returns the
+ * number of equal bytes skipped; *mask_out gets the pcmpeqb mask of the
+ * block that stopped the scan (0xFFFF if every block matched).
+ */
+static size_t mem_compare_sse2(const uint8_t *a, const uint8_t *b, size_t blocks, uint32_t *mask_out) {
+    uint8_t save[32] __attribute__((aligned(16)));
+    const uint8_t *start = a;
+    uint32_t mask = 0xFFFFu;
+
+    __asm__ volatile (
+        "movdqa %%xmm0, 0(%[sv])\n\t"
+        "movdqa %%xmm1, 16(%[sv])\n\t"
+        "1:\n\t"
+        "movdqu (%[a]), %%xmm0\n\t"
+        "movdqu (%[b]), %%xmm1\n\t"
+        "pcmpeqb %%xmm1, %%xmm0\n\t"
+        "pmovmskb %%xmm0, %k[m]\n\t"
+        "cmp $0xFFFF, %k[m]\n\t"
+        "jne 2f\n\t"
+        "add $16, %[a]\n\t"
+        "add $16, %[b]\n\t"
+        "dec %[n]\n\t"
+        "jnz 1b\n\t"
+        "2:\n\t"
+        "movdqa 0(%[sv]), %%xmm0\n\t"
+        "movdqa 16(%[sv]), %%xmm1"
+        : [a] "+r"(a), [b] "+r"(b), [n] "+r"(blocks), [m] "+r"(mask)
+        : [sv] "r"(save)
+        : "memory", "cc");
+
+    *mask_out = mask;
+    return (size_t)(a - start);
+}
+
 void* memset(void *ptr, int value, size_t num) {
-    unsigned char *p = (unsigned char*)ptr;
-    for (size_t i = 0; i < num; i++)
-        p[i] = (unsigned char)value;
+    uint8_t *d = (uint8_t *)ptr;
+    uint64_t pattern = 0x0101010101010101ull * (uint8_t)value;
+
+    if (num < MEM_SSE_MIN_BYTES) {
+        mem_fill_words(d, pattern, num);
+        return ptr;
+    }
+
+    if (num >= MEM_ERMS_MIN_BYTES && (mem_features() & MEM_FEATURE_ERMS)) {
+        __asm__ volatile ("rep stosb"
+                          : "+D"(d), "+c"(num)
+                          : "a"((uint8_t)value)
+                          : "memory");
+        return ptr;
+    }
+
+    size_t head = (16u - ((uintptr_t)d & 15u)) & 15u;
+    mem_fill_words(d, pattern, head);
+    d += head;
+    num -= head;
+
+    size_t blocks = num / MEM_SSE_BLOCK_BYTES;
+    mem_fill_sse2(d, pattern, blocks, num >= MEM_NT_MIN_BYTES);
+    d += blocks * MEM_SSE_BLOCK_BYTES;
+    mem_fill_words(d, pattern, num % MEM_SSE_BLOCK_BYTES);
     return ptr;
 }
 
 void* memcpy(void* dst, const void* src, size_t n) {
-    uint8_t* d = dst;
-    const uint8_t* s = src;
-    for (size_t i = 0; i < n; i++) d[i] = s[i];
+    uint8_t *d = (uint8_t *)dst;
+    const uint8_t *s = (const uint8_t *)src;
+
+    if (n < MEM_SSE_MIN_BYTES) {
+        mem_copy_words(d, s, n);
+        return dst;
+    }
+
+    if (n >= MEM_ERMS_MIN_BYTES && (mem_features() & MEM_FEATURE_ERMS)) {
+        __asm__ volatile ("rep movsb"
+                          : "+D"(d), "+S"(s), "+c"(n)
+                          :
+                          : "memory");
+        return dst;
+    }
+
+    size_t head = (16u - ((uintptr_t)d & 15u)) & 15u;
+    mem_copy_words(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+
+    size_t blocks = n / MEM_SSE_BLOCK_BYTES;
+    mem_copy_sse2(d, s, blocks, n >= MEM_NT_MIN_BYTES);
+    d += blocks * MEM_SSE_BLOCK_BYTES;
+    s += blocks * MEM_SSE_BLOCK_BYTES;
+    mem_copy_words(d, s, n % MEM_SSE_BLOCK_BYTES);
     return dst;
 }
 
 int memcmp(const void *s1, const void *s2, size_t n) {
-    const unsigned char *p1 = (const unsigned char *)s1;
-    const unsigned char *p2 = (const unsigned char *)s2;
+    const uint8_t *p1 = (const uint8_t *)s1;
+    const uint8_t *p2 = (const uint8_t *)s2;
+
+    if (n >= MEM_SSE_MIN_BYTES) {
+        uint32_t mask = 0xFFFFu;
+        size_t equal = mem_compare_sse2(p1, p2, n / 16u, &mask);
+        p1 += equal;
+        p2 += equal;
+        n -= equal;
+        if (mask != 0xFFFFu) {
+            uint32_t idx = (uint32_t)__builtin_ctz(~mask & 0xFFFFu);
+            return (int)p1[idx] - (int)p2[idx];
+        }
+    }
 
+    while (n >= 8u) {
+        uint64_t a = *(const mem_word_t *)p1;
+        uint64_t b = *(const mem_word_t *)p2;
+        if (a != b) {
+            uint32_t idx = (uint32_t)__builtin_ctzll(a ^ b) / 8u;
+            return (int)p1[idx] - (int)p2[idx];
+        }
+        p1 += 8;
+        p2 += 8;
+        n -= 8u;
+    }
     for (size_t i = 0; i < n; i++) {
         if (p1[i] != p2[i]) {
             return (int)p1[i] - (int)p2[i];
         }
     }
-
     return 0;
 }
 
@@ -2,9 +2,13 @@
 #include "../SMP/SMP_Main.h"
 #include "../Serial.h"
 
-#define GDT_MAX_CPUS 4
+#define GDT_MAX_CPUS OS_CONFIG_SMP_MAX_CPUS
 
-static struct {
+/*
+ * Each CPU gets its own table: ltr marks the TSS descriptor busy, so a
+ * second CPU loading the same descriptor would fault.
+ */
+typedef struct {
     struct GDTEntry  null;
     struct GDTEntry  kernel_code;
     struct GDTEntry  kernel_data;
@@ -12,9 +16,10 @@ static struct {
     struct GDTEntry  user_data;
     struct GDTEntry  user_code;
     struct GDTEntry64 tss;
-} __attribute__((packed)) gdt;
+} __attribute__((packed)) gdt_table_t;
 
-static struct GDTR gdtr;
+static gdt_table_t g_gdt[GDT_MAX_CPUS];
+static struct GDTR g_gdtr[GDT_MAX_CPUS];
 static struct TSS g_tss[GDT_MAX_CPUS];
 
 static uint8_t kernel_stack[GDT_MAX_CPUS][4096 * 4];
@@ -48,27 +53,29 @@ void init_gdt(void) {
         cpu_id = GDT_MAX_CPUS - 1;
     }
     struct TSS *tss = &g_tss[cpu_id];
+    gdt_table_t *gdt = &g_gdt[cpu_id];
+    struct GDTR *gdtr = &g_gdtr[cpu_id];
 
-    gdt.null = make_gdt_entry(0, 0, 0);
+    gdt->null = make_gdt_entry(0, 0, 0);
 
-    gdt.kernel_code = make_gdt_entry(0xFFFFF, 0x9A, 0xA0);
-    gdt.kernel_data = make_gdt_entry(0xFFFFF, 0x92, 0x80);
+    gdt->kernel_code = make_gdt_entry(0xFFFFF, 0x9A, 0xA0);
+    gdt->kernel_data = make_gdt_entry(0xFFFFF, 0x92, 0x80);
 
-    gdt.user_compat_code = make_gdt_entry(0xFFFFF, 0xFA, 0xC0);
-    gdt.user_data = make_gdt_entry(0xFFFFF, 0xF2, 0x80);
-    gdt.user_code = make_gdt_entry(0xFFFFF, 0xFA, 0xA0);
+    gdt->user_compat_code = make_gdt_entry(0xFFFFF, 0xFA, 0xC0);
+    gdt->user_data = make_gdt_entry(0xFFFFF, 0xF2, 0x80);
+    gdt->user_code = make_gdt_entry(0xFFFFF, 0xFA, 0xA0);
 
     uint64_t tss_base = (uint64_t)tss;
     uint32_t tss_limit = sizeof(struct TSS) - 1;
 
-    gdt.tss.limit_low  = tss_limit & 0xFFFF;
-    gdt.tss.base_low   = tss_base & 0xFFFF;
-    gdt.tss.base_mid   = (tss_base >> 16) & 0xFF;
-    gdt.tss.access     = 0x89;
-    gdt.tss.gran       = (tss_limit >> 16) & 0x0F;
-    gdt.tss.base_high  = (tss_base >> 24) & 0xFF;
-    gdt.tss.base_upper = (tss_base >> 32);
-    gdt.tss.reserved   = 0;
+    gdt->tss.limit_low  = tss_limit & 0xFFFF;
+    gdt->tss.base_low   = tss_base & 0xFFFF;
+    gdt->tss.base_mid   = (tss_base >> 16) & 0xFF;
+    gdt->tss.access     = 0x89;
+    gdt->tss.gran       = (tss_limit >> 16) & 0x0F;
+    gdt->tss.base_high  = (tss_base >> 24) & 0xFF;
+    gdt->tss.base_upper = (tss_base >> 32);
+    gdt->tss.reserved   = 0;
 
     tss->reserved0 = 0;
     tss->rsp0 = 0;
@@ -85,10 +92,10 @@ void init_gdt(void) {
     gdt_set_ist(2, (uint64_t)(uintptr_t)(nmi_ist_stack[cpu_id] + sizeof(nmi_ist_stack[cpu_id])));
     tss->io_map_base = sizeof(struct TSS);
 
-    gdtr.limit = sizeof(gdt) - 1;
-    gdtr.base  = (uint64_t)&gdt;
+    gdtr->limit = sizeof(*gdt) - 1;
+    gdtr->base  = (uint64_t)gdt;
 
-    gdt_flush((uint64_t)&gdtr);
+    gdt_flush((uint64_t)gdtr);
     tss_flush(GDT_TSS);
     serial_write_string("[OS] [GDT] Successfully Initialize GDT.\n");
 }
@@ -3,12 +3,15 @@ BITS 64
 global load_idt
 global isr_default
 global isr_irq0
+global isr_tlb_shootdown
+global isr_reschedule
 global isr_page_fault
 global isr_double_fault
 global isr_nmi
 global isr_general_protection
 global isr_machine_check
 global page_fault_resume_user
+global process_resume_frame
 
 extern double_fault_handler
 extern nmi_handler
@@ -16,6 +19,10 @@ extern general_protection_fault_handler
 extern machine_check_handler
 extern page_fault_handler
 extern irq_handler
+extern tlb_shootdown_handle_ipi
+extern smp_reschedule_ipi
+extern process_schedule_on_tick
+extern process_finish_switch
 
 SECTION .text
 
@@ -57,55 +64,161 @@ isr_default:
 
     iretq
 
-; IRQ0 (PIT timer) -> calls C irq_handler(32)
+; IRQ0 (PIT timer) -> calls C irq_handler(32), then lets the scheduler pick
+; the context to resume. Registers are saved in SYSCALL_FRAME order so that,
+; together with the hardware frame, a user-mode interrupt leaves exactly the
+; frame syscall_entry builds; process_schedule_on_tick returns the frame to
+; resume, which may belong to another process.
 isr_irq0:
+    push r11
+    push rcx
+    push rbp
+    push rbx
+    push r15
+    push r14
+    push r13
+    push r12
+    push r10
+    push r9
+    push r8
+    push rdi
+    push rsi
+    push rdx
     push rax
+
+    ; 20 qwords on top of the 16-byte aligned interrupt stack keep rsp
+    ; aligned for FXSAVE and the calls. The FXSAVE image protects the
+    ; interrupted x87/SSE state from the C handlers and carries it across a
+    ; process switch.
+    sub rsp, 512
+    fxsave64 [rsp]
+
+    mov rdi, 32            ; IRQ vector number after PIC remap
+    call irq_handler
+
+    lea rdi, [rsp + 512]   ; interrupted context
+    mov rsi, rsp           ; FXSAVE image
+    call process_schedule_on_tick
+
+    fxrstor64 [rsp]
+    mov rsp, rax
+    call process_finish_switch
+
+    pop rax
+    pop rdx
+    pop rsi
+    pop rdi
+    pop r8
+    pop r9
+    pop r10
+    pop r12
+    pop r13
+    pop r14
+    pop r15
+    pop rbx
+    pop rbp
+    pop rcx
+    pop r11
+
+    iretq
+
+; Local APIC reschedule IPI. Same frame as isr_irq0 so a CPU woken from
+; idle or told its slice expired can switch process on the way out; the
+; C handler sends the APIC EOI.
+isr_reschedule:
+    push r11
+    push rcx
+    push rbp
     push rbx
+    push r15
+    push r14
+    push r13
+    push r12
+    push r10
+    push r9
+    push r8
+    push rdi
+    push rsi
+    push rdx
+    push rax
+
+    sub rsp, 512
+    fxsave64 [rsp]
+
+    call smp_reschedule_ipi
+
+    lea rdi, [rsp + 512]   ; interrupted context
+    mov rsi, rsp           ; FXSAVE image
+    call process_schedule_on_tick
+
+    fxrstor64 [rsp]
+    mov rsp, rax
+    call process_finish_switch
+
+    pop rax
+    pop rdx
+    pop rsi
+    pop rdi
+    pop r8
+    pop r9
+    pop r10
+    pop r12
+    pop r13
+    pop r14
+    pop r15
+    pop rbx
+    pop rbp
+    pop rcx
+    pop r11
+
+    iretq
+
+; Local APIC TLB shootdown IPI; the C handler sends the APIC EOI.
+isr_tlb_shootdown:
+    push rax
     push rcx
     push rdx
     push rsi
     push rdi
-    push rbp
     push r8
     push r9
     push r10
     push r11
-    push r12
-    push r13
-    push r14
-    push r15
+    sub rsp, 8           ; keep the call 16-byte aligned
 
-    ; Align stack to 16 bytes before call (rsp currently misaligned by pushes)
-    sub rsp, 8
-
-    mov rdi, 32            ; IRQ vector number after PIC remap
-    call irq_handler
+    call tlb_shootdown_handle_ipi
 
     add rsp, 8
-
-    pop r15
-    pop r14
-    pop r13
-    pop r12
     pop r11
     pop r10
     pop r9
     pop r8
-    pop rbp
     pop rdi
     pop rsi
     pop rdx
     pop rcx
-    pop rbx
     pop rax
 
     iretq
 
 isr_page_fault:
     cli
-    mov rdi, [rsp]       ; error_code
-    mov rsi, [rsp + 8]   ; rip
-    mov rdx, rsp         ; fault stack pointer
+    ; Demand-zero and swap-in faults resume the faulting code, which may be
+    ; kernel code mid-copy, so every caller-saved register is preserved.
+    push rax
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push r8
+    push r9
+    push r10
+    push r11
+    sub rsp, 8           ; keep the call 16-byte aligned
+
+    mov rdi, [rsp + 80]  ; error_code
+    mov rsi, [rsp + 88]  ; rip
+    lea rdx, [rsp + 80]  ; fault stack pointer
     mov rcx, cr2
     mov r8, rbp
     call page_fault_handler
@@ -116,6 +229,16 @@ isr_page_fault:
     hlt
     jmp .pf_hang
 .pf_resume:
+    add rsp, 8
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rax
     sti
     add rsp, 8
     iretq
@@ -166,28 +289,31 @@ isr_machine_check:
     hlt
     jmp .mce_hang
 
+; Resume a saved SYSCALL_FRAME with iretq. The frame carries its own
+; rip/rflags/rsp, so this works for contexts saved by a syscall or by the
+; timer IRQ alike.
+process_resume_frame:
 page_fault_resume_user:
-    mov r10, rsi
-    mov r8, rdi
-
-    mov rax, [r8 + 0]
-    mov rdx, [r8 + 8]
-    mov rsi, [r8 + 16]
-    mov rdi, [r8 + 24]
-    mov r9,  [r8 + 40]
-    mov r12, [r8 + 56]
-    mov r13, [r8 + 64]
-    mov r14, [r8 + 72]
-    mov r15, [r8 + 80]
-    mov rbx, [r8 + 88]
-    mov rbp, [r8 + 96]
-    mov rcx, [r8 + 104]
-    mov r11, [r8 + 112]
-
-    mov rsp, r10
-    mov r10, [r8 + 48]
-    mov r8,  [r8 + 32]
-    o64 sysret
+    mov rsp, rdi
+    call process_finish_switch
+
+    pop rax
+    pop rdx
+    pop rsi
+    pop rdi
+    pop r8
+    pop r9
+    pop r10
+    pop r12
+    pop r13
+    pop r14
+    pop r15
+    pop rbx
+    pop rbp
+    pop rcx
+    pop r11
+
+    iretq
 
 load_idt:
     cli
@@ -4,6 +4,7 @@
 #include "../Memory/Memory_Main.h"
 #include "../Paging/Paging_Main.h"
 #include "../ProcessManager/ProcessManager.h"
+#include "../SMP/SMP_Main.h"
 #include "../Serial.h"
 
 #include <stdint.h>
@@ -17,6 +18,8 @@ static isr_t irq_routines[MAX_IRQS] = {0};
 
 extern void isr_default(void);
 extern void isr_irq0(void);
+extern void isr_tlb_shootdown(void);
+extern void isr_reschedule(void);
 extern void isr_page_fault(void);
 extern void isr_double_fault(void);
 extern void isr_nmi(void);
@@ -232,6 +235,8 @@ void init_idt(void)
     set_interrupt_handler(13, isr_general_protection);
     set_interrupt_handler(14, isr_page_fault);
     set_interrupt_handler(18, isr_machine_check);
+    set_interrupt_handler(SMP_TLB_SHOOTDOWN_VECTOR, isr_tlb_shootdown);
+    set_interrupt_handler(SMP_RESCHEDULE_VECTOR, isr_reschedule);
 
     idt_ptr.limit = sizeof(idt) - 1;
     idt_ptr.base = (uint64_t)&idt;
@@ -241,6 +246,12 @@ void init_idt(void)
     serial_write_string("[OS] [IDT] Successfully Initialize IDT.\n");
 }
 
+/* The table is shared; an AP only needs to load it, with interrupts left off. */
+void idt_load_current_cpu(void)
+{
+    __asm__ volatile ("lidt %0" :: "m"(idt_ptr) : "memory");
+}
+
 int32_t page_fault_handler(uint64_t error_code,
                            uint64_t rip,
                            uint64_t rsp,
@@ -251,6 +262,27 @@ int32_t page_fault_handler(uint64_t error_code,
     const uint64_t PF_USER = (1ULL << 2);
     const uint64_t PF_RSVD = (1ULL << 3);
     const uint64_t PF_INSTR = (1ULL << 4);
+    const uint64_t PF_PRESENT = (1ULL << 0);
+
+    /*
+     * First touch of a reserved heap/stack page. Kernel code copying into
+     * user buffers can land here too, so this runs for both modes and
+     * before any logging. The kernel lock nests for that case.
+     */
+    smp_kernel_lock();
+    if ((error_code & (PF_PRESENT | PF_RSVD)) == 0) {
+        if (paging_handle_demand_fault(paging_get_active_cr3(), cr2) > 0) {
+            smp_kernel_unlock();
+            return 0;
+        }
+    }
+    /* Write to a page shared copy-on-write after fork. */
+    if ((error_code & (PF_PRESENT | PF_WRITE | PF_RSVD)) == (PF_PRESENT | PF_WRITE)) {
+        if (paging_handle_cow_fault(paging_get_active_cr3(), cr2) > 0) {
+            smp_kernel_unlock();
+            return 0;
+        }
+    }
 
     serial_write_string("[OS] [PF] Page fault\n");
     serial_write_string("[OS] [PF] CR2: ");
@@ -282,6 +314,7 @@ int32_t page_fault_handler(uint64_t error_code,
         int swap_rc = paging_handle_swap_fault(cr3, cr2);
         if (swap_rc > 0) {
             serial_write_string("[OS] [PF] Recovered via swap-in\n");
+            smp_kernel_unlock();
             return 0;
         }
 
@@ -296,6 +329,7 @@ int32_t page_fault_handler(uint64_t error_code,
         }
 
         process_exit_current();
+        smp_kernel_unlock();
 
         uint64_t next_user_rsp = 0;
         uint64_t next_saved_rsp = process_schedule_after_exit(&next_user_rsp);
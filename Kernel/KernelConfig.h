@@ -96,6 +96,71 @@
 #define OS_CONFIG_SMP_ENABLED 1
 #endif
 
+/* Per-CPU stale masks in the TLB shootdown code are 32 bits wide. */
+#if (OS_CONFIG_SMP_MAX_CPUS < 1) || (OS_CONFIG_SMP_MAX_CPUS > 32)
+#error "OS_CONFIG_SMP_MAX_CPUS must be between 1 and 32"
+#endif
+
+#ifndef OS_CONFIG_BOOT_BENCHMARKS
+#define OS_CONFIG_BOOT_BENCHMARKS 0
+#endif
+
+#ifndef OS_CONFIG_ZERO_POOL_PAGES
+#define OS_CONFIG_ZERO_POOL_PAGES 256
+#endif
+
+#ifndef OS_CONFIG_ZERO_POOL_REFILL_PER_TICK
+#define OS_CONFIG_ZERO_POOL_REFILL_PER_TICK 8
+#endif
+
+#if (OS_CONFIG_ZERO_POOL_PAGES < 1) || (OS_CONFIG_ZERO_POOL_REFILL_PER_TICK < 1)
+#error "Zero page pool size and refill budget must be at least 1"
+#endif
+
+#ifndef OS_CONFIG_SWAP_FILE_PATH
+#define OS_CONFIG_SWAP_FILE_PATH "SWAP.SYS"
+#endif
+
+#ifndef OS_CONFIG_SWAP_FILE_PAGES
+#define OS_CONFIG_SWAP_FILE_PAGES 4096
+#endif
+
+#ifndef OS_CONFIG_SWAP_BATCH_PAGES
+#define OS_CONFIG_SWAP_BATCH_PAGES 16
+#endif
+
+#if (OS_CONFIG_SWAP_BATCH_PAGES < 1) || (OS_CONFIG_SWAP_BATCH_PAGES > 64)
+#error "OS_CONFIG_SWAP_BATCH_PAGES must be between 1 and 64"
+#endif
+
+#ifndef OS_CONFIG_ZSWAP_ENABLED
+#define OS_CONFIG_ZSWAP_ENABLED 1
+#endif
+
+#ifndef OS_CONFIG_ZSWAP_MAX_ENTRIES
+#define OS_CONFIG_ZSWAP_MAX_ENTRIES 4096
+#endif
+
+#ifndef OS_CONFIG_ZSWAP_MAX_POOL_BYTES
+#define OS_CONFIG_ZSWAP_MAX_POOL_BYTES (4u * 1024u * 1024u)
+#endif
+
+#if (OS_CONFIG_ZSWAP_MAX_ENTRIES < 1) || (OS_CONFIG_ZSWAP_MAX_ENTRIES > 65536)
+#error "OS_CONFIG_ZSWAP_MAX_ENTRIES must be between 1 and 65536"
+#endif
+
+#ifndef OS_CONFIG_USER_HUGE_PAGES
+#define OS_CONFIG_USER_HUGE_PAGES 1
+#endif
+
+#ifndef OS_CONFIG_SCHED_TIMESLICE_MS
+#define OS_CONFIG_SCHED_TIMESLICE_MS 50
+#endif
+
+#if (OS_CONFIG_SCHED_TIMESLICE_MS < 1) || (OS_CONFIG_SCHED_TIMESLICE_MS > 1000)
+#error "OS_CONFIG_SCHED_TIMESLICE_MS must be between 1 and 1000"
+#endif
+
 #ifndef OS_CONFIG_SIGNAL_HANDLER_MAX_PER_PROCESS
 #define OS_CONFIG_SIGNAL_HANDLER_MAX_PER_PROCESS 32
 #endif
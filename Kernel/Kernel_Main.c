@@ -1,6 +1,7 @@
 #include "Kernel_Main.h"
 #include "Memory/Memory_Main.h"
 #include "Paging/Paging_Main.h"
+#include "Paging/Swap_Device.h"
 #include "SMP/SMP_Main.h"
 #include "IDT/IDT_Main.h"
 #include "GDT/GDT_Main.h"
@@ -20,6 +21,8 @@
 #include "Sync/Spinlock.h"
 #include "Timer/Timer.h"
 #include "Boot/LoadBar.h"
+#include "Benchmark/Benchmark.h"
+#include "KernelConfig.h"
 
 #include <stdbool.h>
 
@@ -218,7 +221,7 @@ void kernel_main(BOOT_INFO *boot_info) {
     init_paging();
 
     serial_write_string("[OS] Initializing SMP...\n");
-    smp_init();
+    smp_init(boot_info);
 
     serial_write_string("[OS] Initializing memory manager...\n");
     memory_init();
@@ -249,6 +252,10 @@ void kernel_main(BOOT_INFO *boot_info) {
     all_fs_initialize();
     log_init();
 
+    if (swap_file_init(OS_CONFIG_SWAP_FILE_PATH, OS_CONFIG_SWAP_FILE_PAGES) != 0) {
+        serial_write_string("[OS] [SWAP] running without swap\n");
+    }
+
     bool display_ready = false;
     bool ps2_ready = false;
     bool window_manager_ready = false;
@@ -309,6 +316,9 @@ void kernel_main(BOOT_INFO *boot_info) {
 
     serial_write_string("[OS] Initializing process manager...\n");
     process_manager_init();
+
+    serial_write_string("[OS] Starting application processors...\n");
+    smp_start_aps();
     if (load_bar_active) {
         load_bar_set_target(80);
     }
@@ -333,6 +343,10 @@ void kernel_main(BOOT_INFO *boot_info) {
         load_bar_active = false;
     }
 
+#if OS_CONFIG_BOOT_BENCHMARKS
+    benchmark_run_boot_suite();
+#endif
+
     serial_write_string("[OS] ===== Kernel Init Complete =====\n");
     serial_write_string("[OS] Transferring control to userland...\n\n");
 
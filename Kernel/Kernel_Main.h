@@ -43,6 +43,8 @@ typedef struct {
 
     UINTN LoadedFileCount;
     LOADED_FILE LoadedFiles[MAX_LOADED_FILES];
+
+    uint64_t AcpiRsdp;
 } BOOT_INFO;
 
 __attribute__((noreturn))
@@ -11,148 +11,386 @@
 #include "../Paging/Paging_Main.h"
 #include "../Serial.h"
 
-#ifndef DMA_POOL_SIZE
-#define DMA_POOL_SIZE   (4u * 1024u * 1024u)
-#endif
-#define DMA_MIN_ALIGN   64u
-#define DMA_MAX_BLOCKS  512u
 #ifndef VIRT_TO_PHYS_OFFSET
 #define VIRT_TO_PHYS_OFFSET  0ULL
 #endif
 
+/*
+ * DMA memory comes from the DMA32 zone of the page allocator and grows on
+ * demand. Requests up to DMA_SMALL_MAX_SIZE are served from per size-class
+ * free lists carved out of small page chunks (64 B aligned at minimum, and
+ * naturally aligned to their class). Larger requests get their own run of
+ * pages, page aligned, or 64 KiB aligned from DMA_BIG_ALIGN upwards.
+ *
+ * Every chunk/run is recorded in a region table sorted by base address, so
+ * dma_free finds the owner with a binary search. The table lives on the
+ * kernel heap and grows as needed; there is no fixed block limit. Small
+ * chunks keep a bitmap of handed-out objects so dma_free can reject a
+ * pointer that is already free.
+ */
+#define DMA_MIN_ALIGN        64u
+#define DMA_MIN_SHIFT        6u
+#define DMA_CLASS_COUNT      6u
+#define DMA_SMALL_MAX_SIZE   (DMA_MIN_ALIGN << (DMA_CLASS_COUNT - 1u))
+#define DMA_SMALL_CHUNK_PAGES 4u
+#define DMA_BIG_ALIGN        (64u * 1024u)
+#define DMA_REGION_INITIAL   64u
+#define DMA_SMALL_MAP_WORDS  ((DMA_SMALL_CHUNK_PAGES * PAGE_SIZE / DMA_MIN_ALIGN + 63u) / 64u)
+
+typedef enum {
+    DMA_REGION_SMALL = 0,
+    DMA_REGION_LARGE
+} dma_region_kind_t;
+
+typedef struct {
+    uintptr_t base;
+    uint32_t  pages;
+    uint8_t   kind;
+    uint8_t   size_class;
+    uint16_t  used_objects;
+    size_t    requested;
+    uint64_t  used_map[DMA_SMALL_MAP_WORDS];
+} dma_region_t;
+
+typedef struct dma_free_object {
+    struct dma_free_object *next;
+} dma_free_object_t;
+
 typedef struct {
-    uintptr_t virt;
-    size_t    size;
-    bool      used;
-} dma_block_t;
+    dma_free_object_t *free_list;
+    uint32_t chunks;
+    uint32_t free_objects;
+    uint32_t used_objects;
+    size_t   requested_bytes;
+} dma_class_t;
 
 typedef struct {
-    uint8_t     *base_virt;
-    uint64_t     base_phys;
-    size_t       total;
-    size_t       offset;
-    dma_block_t  blocks[DMA_MAX_BLOCKS];
-    uint32_t     block_cnt;
-    bool         initialized;
-} dma_pool_t;
-
-static dma_pool_t g_pool;
+    dma_region_t *regions;
+    uint32_t      region_count;
+    uint32_t      region_capacity;
+    dma_class_t   classes[DMA_CLASS_COUNT];
+    uint32_t      large_allocs;
+    size_t        large_bytes;
+    size_t        large_requested;
+    uint64_t      failed_allocs;
+    bool          initialized;
+} dma_state_t;
+
+static dma_state_t g_dma;
 static spinlock_t g_lock;
 
 bool dma_init(void)
 {
-    if (g_pool.initialized) return true;
+    if (g_dma.initialized) return true;
 
-    size_t num_pages = (DMA_POOL_SIZE + PAGE_SIZE - 1) / PAGE_SIZE;
-
-    void *virt = pmm_alloc_pages(num_pages);
-    if (!virt) {
-        serial_write_string("[DMA] pool alloc failed\n");
+    spinlock_init(&g_lock);
+    memset(&g_dma, 0, sizeof(g_dma));
+    g_dma.regions = (dma_region_t *)kmalloc(DMA_REGION_INITIAL * sizeof(dma_region_t));
+    if (!g_dma.regions) {
+        serial_write_string("[DMA] region table alloc failed\n");
         return false;
     }
+    g_dma.region_capacity = DMA_REGION_INITIAL;
+    g_dma.initialized = true;
 
-    memset(virt, 0, num_pages * PAGE_SIZE);
-
-    g_pool.base_virt   = (uint8_t*)virt;
-    g_pool.base_phys = virt_to_phys(virt);
-    g_pool.total       = num_pages * PAGE_SIZE;
-    g_pool.offset      = 0;
-    g_pool.block_cnt   = 0;
-    g_pool.initialized = true;
-
-    serial_write_string("[DMA] pool ready\n");
+    serial_write_string("[DMA] allocator ready\n");
     return true;
 }
 
-void* dma_alloc(size_t bytes, uint64_t *phys_out)
+static int32_t dma_class_for_size(size_t bytes)
 {
-    if (!bytes) return NULL;
-
-    if (!g_pool.initialized) {
-        if (!dma_init()) return NULL;
+    if (bytes > DMA_SMALL_MAX_SIZE) {
+        return -1;
+    }
+    uint32_t cls = 0;
+    while (((size_t)DMA_MIN_ALIGN << cls) < bytes) {
+        ++cls;
     }
+    return (int32_t)cls;
+}
 
-    spinlock_lock(&g_lock);
+/* Index of the first region whose base is above addr. Caller holds g_lock. */
+static uint32_t dma_region_upper_bound(uintptr_t addr)
+{
+    uint32_t lo = 0;
+    uint32_t hi = g_dma.region_count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2u;
+        if (g_dma.regions[mid].base <= addr) {
+            lo = mid + 1u;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
 
-    if (g_pool.block_cnt >= DMA_MAX_BLOCKS) {
-        spinlock_unlock(&g_lock);
-        serial_write_string("[DMA] block table full\n");
+static dma_region_t *dma_find_region(uintptr_t addr)
+{
+    uint32_t idx = dma_region_upper_bound(addr);
+    if (idx == 0) {
+        return NULL;
+    }
+    dma_region_t *r = &g_dma.regions[idx - 1u];
+    if (addr >= r->base + (uintptr_t)r->pages * PAGE_SIZE) {
         return NULL;
     }
+    return r;
+}
 
-    size_t aligned_bytes = (bytes + DMA_MIN_ALIGN - 1) & ~(DMA_MIN_ALIGN - 1);
+/* Caller holds g_lock and has ensured capacity. */
+static dma_region_t *dma_insert_region(uintptr_t base, uint32_t pages, uint8_t kind)
+{
+    uint32_t idx = dma_region_upper_bound(base);
+    for (uint32_t i = g_dma.region_count; i > idx; --i) {
+        g_dma.regions[i] = g_dma.regions[i - 1u];
+    }
+    g_dma.region_count++;
+
+    dma_region_t *r = &g_dma.regions[idx];
+    r->base = base;
+    r->pages = pages;
+    r->kind = kind;
+    r->size_class = 0;
+    r->used_objects = 0;
+    r->requested = 0;
+    memset(r->used_map, 0, sizeof(r->used_map));
+    return r;
+}
 
-    size_t aligned_offset =
-        (g_pool.offset + DMA_MIN_ALIGN - 1) & ~(DMA_MIN_ALIGN - 1);
+static void dma_remove_region(dma_region_t *r)
+{
+    uint32_t idx = (uint32_t)(r - g_dma.regions);
+    for (uint32_t i = idx; i + 1u < g_dma.region_count; ++i) {
+        g_dma.regions[i] = g_dma.regions[i + 1u];
+    }
+    g_dma.region_count--;
+}
 
-    if (aligned_offset + aligned_bytes > g_pool.total) {
-        uint32_t best_idx  = DMA_MAX_BLOCKS;
-        size_t   best_diff = SIZE_MAX;
+/*
+ * Make room for one more region. The table is grown without g_lock held
+ * (kmalloc may reclaim pages), then swapped in under the lock.
+ */
+static bool dma_reserve_region_slot(void)
+{
+    for (;;) {
+        spinlock_lock(&g_lock);
+        if (g_dma.region_count < g_dma.region_capacity) {
+            return true;
+        }
+        uint32_t old_capacity = g_dma.region_capacity;
+        spinlock_unlock(&g_lock);
 
-        for (uint32_t i = 0; i < g_pool.block_cnt; i++) {
-            dma_block_t *b = &g_pool.blocks[i];
-            if (!b->used && b->size >= aligned_bytes) {
-                size_t diff = b->size - aligned_bytes;
-                if (diff < best_diff) {
-                    best_diff = diff;
-                    best_idx  = i;
-                }
-            }
+        uint32_t new_capacity = old_capacity * 2u;
+        dma_region_t *grown = (dma_region_t *)kmalloc((uint64_t)new_capacity * sizeof(dma_region_t));
+        if (!grown) {
+            return false;
         }
 
-        if (best_idx == DMA_MAX_BLOCKS) {
-            spinlock_unlock(&g_lock);
-            serial_write_string("[DMA] out of memory\n");
-            return NULL;
+        spinlock_lock(&g_lock);
+        dma_region_t *old = NULL;
+        if (g_dma.region_capacity == old_capacity) {
+            memcpy(grown, g_dma.regions, g_dma.region_count * sizeof(dma_region_t));
+            old = g_dma.regions;
+            g_dma.regions = grown;
+            g_dma.region_capacity = new_capacity;
+        } else {
+            old = grown;
         }
+        spinlock_unlock(&g_lock);
+        kfree(old);
+    }
+}
 
-        dma_block_t *b = &g_pool.blocks[best_idx];
-        b->used = true;
-        memset((void*)b->virt, 0, b->size);
+/* Returns with g_lock held on success. */
+static bool dma_grow_class(uint32_t cls)
+{
+    void *chunk = alloc_contiguous_pages_zone(DMA_SMALL_CHUNK_PAGES, DMA_SMALL_CHUNK_PAGES, MEMORY_ZONE_DMA32);
+    if (!chunk) {
+        return false;
+    }
+    if (!dma_reserve_region_slot()) {
+        free_contiguous_pages(chunk, DMA_SMALL_CHUNK_PAGES);
+        return false;
+    }
 
-        uint64_t phys = g_pool.base_phys + (b->virt - (uintptr_t)g_pool.base_virt);
-        if (phys_out) *phys_out = phys;
+    dma_region_t *r = dma_insert_region((uintptr_t)chunk, DMA_SMALL_CHUNK_PAGES, DMA_REGION_SMALL);
+    r->size_class = (uint8_t)cls;
+
+    dma_class_t *c = &g_dma.classes[cls];
+    size_t object_size = (size_t)DMA_MIN_ALIGN << cls;
+    uint32_t count = (uint32_t)((DMA_SMALL_CHUNK_PAGES * PAGE_SIZE) / object_size);
+    uint8_t *base = (uint8_t *)chunk;
+    for (uint32_t i = count; i > 0; --i) {
+        dma_free_object_t *obj = (dma_free_object_t *)(base + (size_t)(i - 1u) * object_size);
+        obj->next = c->free_list;
+        c->free_list = obj;
+    }
+    c->free_objects += count;
+    c->chunks++;
+    return true;
+}
 
+static void *dma_alloc_small(uint32_t cls, size_t bytes)
+{
+    spinlock_lock(&g_lock);
+    dma_class_t *c = &g_dma.classes[cls];
+    if (!c->free_list) {
         spinlock_unlock(&g_lock);
-        return (void*)b->virt;
+        if (!dma_grow_class(cls)) {
+            return NULL;
+        }
+        c = &g_dma.classes[cls];
+        if (!c->free_list) {
+            spinlock_unlock(&g_lock);
+            return NULL;
+        }
     }
 
-    uint8_t    *virt = g_pool.base_virt + aligned_offset;
-    uint64_t    phys = g_pool.base_phys + aligned_offset;
+    dma_free_object_t *obj = c->free_list;
+    c->free_list = obj->next;
+    c->free_objects--;
+    c->used_objects++;
+    c->requested_bytes += bytes;
+
+    dma_region_t *r = dma_find_region((uintptr_t)obj);
+    if (r) {
+        uint32_t slot = (uint32_t)(((uintptr_t)obj - r->base) >> (DMA_MIN_SHIFT + cls));
+        r->used_map[slot / 64u] |= 1ULL << (slot % 64u);
+        r->used_objects++;
+        r->requested += bytes;
+    }
+    spinlock_unlock(&g_lock);
 
-    dma_block_t *b = &g_pool.blocks[g_pool.block_cnt++];
-    b->virt = (uintptr_t)virt;
-    b->size = aligned_bytes;
-    b->used = true;
+    memset(obj, 0, (size_t)DMA_MIN_ALIGN << cls);
+    return obj;
+}
 
-    g_pool.offset = aligned_offset + aligned_bytes;
+static void *dma_alloc_large(size_t bytes, size_t align)
+{
+    uint32_t pages = (uint32_t)((bytes + PAGE_SIZE - 1) / PAGE_SIZE);
+    uint32_t align_pages = (uint32_t)((align + PAGE_SIZE - 1) / PAGE_SIZE);
+    if (bytes >= DMA_BIG_ALIGN && align_pages < DMA_BIG_ALIGN / PAGE_SIZE) {
+        align_pages = DMA_BIG_ALIGN / PAGE_SIZE;
+    }
 
-    if (phys_out) *phys_out = phys;
+    void *virt = alloc_contiguous_pages_zone(pages, align_pages, MEMORY_ZONE_DMA32);
+    if (!virt) {
+        return NULL;
+    }
+    if (!dma_reserve_region_slot()) {
+        free_contiguous_pages(virt, pages);
+        return NULL;
+    }
 
+    dma_region_t *r = dma_insert_region((uintptr_t)virt, pages, DMA_REGION_LARGE);
+    r->used_objects = 1;
+    r->requested = bytes;
+    g_dma.large_allocs++;
+    g_dma.large_bytes += (size_t)pages * PAGE_SIZE;
+    g_dma.large_requested += bytes;
     spinlock_unlock(&g_lock);
+
+    memset(virt, 0, (size_t)pages * PAGE_SIZE);
+    return virt;
+}
+
+void* dma_alloc_aligned(size_t bytes, size_t align, uint64_t *phys_out)
+{
+    if (!bytes) return NULL;
+    if (align & (align - 1u)) return NULL;
+
+    if (!g_dma.initialized) {
+        if (!dma_init()) return NULL;
+    }
+
+    if (align < DMA_MIN_ALIGN) {
+        align = DMA_MIN_ALIGN;
+    }
+
+    /* Small classes are naturally aligned to their size within a chunk. */
+    size_t class_bytes = (bytes > align) ? bytes : align;
+    int32_t cls = dma_class_for_size(class_bytes);
+    void *virt = (cls >= 0) ? dma_alloc_small((uint32_t)cls, bytes)
+                            : dma_alloc_large(bytes, align);
+    if (!virt) {
+        spinlock_lock(&g_lock);
+        g_dma.failed_allocs++;
+        spinlock_unlock(&g_lock);
+        serial_write_string("[DMA] out of memory\n");
+        return NULL;
+    }
+
+    if (phys_out) *phys_out = virt_to_phys(virt);
     return virt;
 }
 
+void* dma_alloc(size_t bytes, uint64_t *phys_out)
+{
+    return dma_alloc_aligned(bytes, DMA_MIN_ALIGN, phys_out);
+}
+
 void dma_free(void *virt, size_t bytes)
 {
-    if (!virt || !g_pool.initialized) return;
+    if (!virt || !g_dma.initialized) return;
 
     spinlock_lock(&g_lock);
 
     uintptr_t addr = (uintptr_t)virt;
-    for (uint32_t i = 0; i < g_pool.block_cnt; i++) {
-        dma_block_t *b = &g_pool.blocks[i];
-        if (b->virt == addr && b->used) {
-            memset(virt, 0, b->size);
-            b->used = false;
+    dma_region_t *r = dma_find_region(addr);
+    if (!r) {
+        spinlock_unlock(&g_lock);
+        serial_write_string("[DMA] dma_free: unknown pointer\n");
+        return;
+    }
+
+    if (r->kind == DMA_REGION_LARGE) {
+        if (addr != r->base) {
             spinlock_unlock(&g_lock);
+            serial_write_string("[DMA] dma_free: unknown pointer\n");
             return;
         }
+        uint32_t pages = r->pages;
+        g_dma.large_allocs--;
+        g_dma.large_bytes -= (size_t)pages * PAGE_SIZE;
+        g_dma.large_requested -= r->requested;
+        dma_remove_region(r);
+        spinlock_unlock(&g_lock);
+        free_contiguous_pages(virt, pages);
+        return;
+    }
+
+    dma_class_t *c = &g_dma.classes[r->size_class];
+    size_t object_size = (size_t)DMA_MIN_ALIGN << r->size_class;
+    if (((addr - r->base) % object_size) != 0 || r->used_objects == 0) {
+        spinlock_unlock(&g_lock);
+        serial_write_string("[DMA] dma_free: unknown pointer\n");
+        return;
     }
 
+    uint32_t slot = (uint32_t)((addr - r->base) / object_size);
+    uint64_t bit = 1ULL << (slot % 64u);
+    if ((r->used_map[slot / 64u] & bit) == 0) {
+        spinlock_unlock(&g_lock);
+        serial_write_string("[DMA] dma_free: double free\n");
+        return;
+    }
+    r->used_map[slot / 64u] &= ~bit;
+
+    size_t requested = (bytes != 0 && bytes <= object_size) ? bytes : object_size;
+    if (requested > r->requested) requested = r->requested;
+    if (requested > c->requested_bytes) requested = c->requested_bytes;
+    r->used_objects--;
+    r->requested -= requested;
+    c->used_objects--;
+    c->requested_bytes -= requested;
+
+    dma_free_object_t *obj = (dma_free_object_t *)virt;
+    obj->next = c->free_list;
+    c->free_list = obj;
+    c->free_objects++;
+
     spinlock_unlock(&g_lock);
-    serial_write_string("[DMA] dma_free: unknown pointer\n");
-    (void)bytes;
 }
 
 uint64_t virt_to_phys(void *virt)
@@ -160,52 +398,57 @@ uint64_t virt_to_phys(void *virt)
     if (virt == NULL) {
         return 0;
     }
-    
-    uintptr_t virt_addr = (uintptr_t)virt;
-    
-    if (g_pool.initialized && 
-        virt_addr >= (uintptr_t)g_pool.base_virt &&
-        virt_addr < (uintptr_t)g_pool.base_virt + g_pool.total) {
-        return g_pool.base_phys + (virt_addr - (uintptr_t)g_pool.base_virt);
-    }
-    
-    return virt_addr + VIRT_TO_PHYS_OFFSET;
+
+    return (uint64_t)(uintptr_t)virt + VIRT_TO_PHYS_OFFSET;
 }
 
+/*
+ * Fragmentation report: "internal" is reserved-but-unrequested bytes inside
+ * live allocations (class rounding, page rounding); "cached" is free
+ * objects sitting in the small-class lists.
+ */
 void dma_dump_stats(void)
 {
-    if (!g_pool.initialized) {
+    if (!g_dma.initialized) {
         serial_write_string("[DMA] not initialized\n");
         return;
     }
 
     spinlock_lock(&g_lock);
 
-    uint32_t used_blocks = 0;
-    size_t   used_bytes  = 0;
-    size_t   free_bytes  = 0;
-
-    for (uint32_t i = 0; i < g_pool.block_cnt; i++) {
-        dma_block_t *b = &g_pool.blocks[i];
-        if (b->used) {
-            used_blocks++;
-            used_bytes += b->size;
-        } else {
-            free_bytes += b->size;
-        }
+    size_t reserved = g_dma.large_bytes;
+    size_t used = g_dma.large_bytes;
+    size_t requested = g_dma.large_requested;
+    size_t cached = 0;
+    for (uint32_t i = 0; i < DMA_CLASS_COUNT; ++i) {
+        const dma_class_t *c = &g_dma.classes[i];
+        size_t object_size = (size_t)DMA_MIN_ALIGN << i;
+        reserved += (size_t)c->chunks * DMA_SMALL_CHUNK_PAGES * PAGE_SIZE;
+        used += (size_t)c->used_objects * object_size;
+        requested += c->requested_bytes;
+        cached += (size_t)c->free_objects * object_size;
     }
-
-    size_t bump_remaining = g_pool.total - g_pool.offset;
+    uint32_t regions = g_dma.region_count;
+    uint32_t large_allocs = g_dma.large_allocs;
+    uint64_t failed = g_dma.failed_allocs;
 
     spinlock_unlock(&g_lock);
-    
-    serial_write_string("[DMA] used_blocks=");
-    serial_write_uint64((uint64_t)used_blocks);
+
+    serial_write_string("[DMA] regions=");
+    serial_write_uint64((uint64_t)regions);
+    serial_write_string(" large_allocs=");
+    serial_write_uint64((uint64_t)large_allocs);
+    serial_write_string(" reserved_bytes=");
+    serial_write_uint64((uint64_t)reserved);
     serial_write_string(" used_bytes=");
-    serial_write_uint64((uint64_t)used_bytes);
-    serial_write_string(" free_bytes=");
-    serial_write_uint64((uint64_t)free_bytes);
-    serial_write_string(" bump_remaining=");
-    serial_write_uint64((uint64_t)bump_remaining);
+    serial_write_uint64((uint64_t)used);
+    serial_write_string(" requested_bytes=");
+    serial_write_uint64((uint64_t)requested);
+    serial_write_string(" internal_frag=");
+    serial_write_uint64((uint64_t)(used - requested));
+    serial_write_string(" cached_free=");
+    serial_write_uint64((uint64_t)cached);
+    serial_write_string(" failed=");
+    serial_write_uint64(failed);
     serial_write_string("\n");
 }
@@ -5,6 +5,7 @@
 
 bool dma_init(void);
 void* dma_alloc(size_t bytes, uint64_t *phys_out);
+void* dma_alloc_aligned(size_t bytes, size_t align, uint64_t *phys_out);
 void dma_free(void *virt, size_t bytes);
 uint64_t virt_to_phys(void *virt);
 void dma_dump_stats(void);
\ No newline at end of file
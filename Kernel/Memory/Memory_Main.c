@@ -3,17 +3,22 @@
 #include "../Kernel_Main.h"
 #include "../ProcessManager/ProcessManager.h"
 #include "../Sync/Spinlock.h"
+#include "../SMP/SMP_Main.h"
+#include "../KernelConfig.h"
 #include <stddef.h>
 #include <stdint.h>
 
 #define PAGE_SIZE 4096
-#define MAX_PAGES 262144
 #define USER_RESERVED_TOP USER_STACK_TOP
 #define MAX_ALLOC_PAGE_RECURSION_DEPTH 5
 
-static uint8_t page_bitmap[MAX_PAGES];
 static uint32_t alloc_page_recursion_depth = 0;
 int paging_swap_reclaim_one_page(void);
+void paging_swap_print_stats(void);
+uint64_t paging_get_demand_fault_count(void);
+void paging_print_cow_stats(void);
+void paging_print_tlb_stats(void);
+void paging_print_huge_page_stats(void);
 
 extern uint8_t _kernel_end;
 
@@ -28,16 +33,33 @@ enum {
 #define HEAP_MAGIC 0x1BADB002
 #define HEAP_MAGIC_FREE 0x2BADB002
 
+/*
+ * Large-object heap blocks use boundary tags: every block is
+ * [memory_block_t][payload][memory_block_footer_t], so both physical neighbours
+ * are reachable by pointer arithmetic. Free blocks are additionally linked into
+ * a doubly linked free list for O(1) unlink during coalescing.
+ */
 typedef struct memory_block {
     uint32_t magic;
-    uint64_t size;
     uint8_t is_free;
     uint8_t is_sensitive;
     uint16_t reserved;
-    struct memory_block* next;
+    uint64_t size;
+    struct memory_block* next_free;
+    struct memory_block* prev_free;
 } memory_block_t;
 
+typedef struct {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t size;
+} memory_block_footer_t;
+
+#define BLOCK_OVERHEAD (sizeof(memory_block_t) + sizeof(memory_block_footer_t))
+
 static memory_block_t* heap_start = NULL;
+static uintptr_t heap_end = 0;
+static memory_block_t* heap_free_list = NULL;
 static memory_block_t* heap_search_hint = NULL;
 static uint32_t heap_initialized = 0;
 static uint32_t total_allocated = 0;
@@ -48,7 +70,8 @@ static uint32_t total_freed = 0;
 static uint32_t heap_start_page = 0;
 static spinlock_t heap_lock;
 static spinlock_t page_lock;
-static uint32_t page_alloc_hint = 0;
+static spinlock_stats_t heap_lock_stats;
+static spinlock_stats_t page_lock_stats;
 static uint32_t g_oom_total = 0;
 static uint32_t g_oom_kmalloc = 0;
 static uint32_t g_oom_pages = 0;
@@ -56,6 +79,85 @@ static uint32_t g_oom_pages = 0;
 #define MIN_ALLOC_ALIGN 8u
 #define MIN_SPLIT_REMAINDER 64u
 
+/*
+ * Small allocations (up to SLAB_MAX_OBJECT_SIZE) are served from per size-class
+ * slabs. Each slab is SLAB_PAGES physically contiguous pages aligned to its own
+ * size, so the owning slab of any object is found by masking the pointer. The
+ * first-fit block list below is only used for larger requests.
+ *
+ * Every slab keeps its own free list. Slabs with a free object sit on the
+ * class's doubly linked partial list, so alloc, free and handing an empty
+ * slab back to the page allocator are all O(1). One empty slab per class
+ * stays cached to absorb alloc/free bursts at a slab boundary.
+ */
+#define SLAB_MIN_SHIFT 4u
+#define SLAB_CLASS_COUNT 8u
+#define SLAB_MAX_OBJECT_SIZE (1u << (SLAB_MIN_SHIFT + SLAB_CLASS_COUNT - 1u))
+#define SLAB_PAGES 4u
+#define SLAB_BYTES ((uint64_t)SLAB_PAGES * PAGE_SIZE)
+#define SLAB_MAGIC 0x51AB51ABu
+
+typedef struct slab_object {
+    uint32_t magic;
+    uint8_t size_class;
+    uint8_t is_sensitive;
+    uint16_t owner_cpu;
+    struct slab_object *next_free;
+} slab_object_t;
+
+typedef struct slab {
+    uint32_t magic;
+    uint32_t size_class;
+    uint32_t object_count;
+    uint32_t free_count;
+    struct slab *next;
+    struct slab *prev;
+    slab_object_t *free_list;
+} slab_t;
+
+typedef struct {
+    uint32_t object_size;
+    uint32_t stride;
+    slab_t *partial;
+    uint32_t slab_count;
+    uint32_t free_objects;
+    uint32_t empty_slabs;
+} slab_cache_t;
+
+static slab_cache_t slab_caches[SLAB_CLASS_COUNT];
+
+/*
+ * Each CPU keeps a magazine of free objects per size class in front of the
+ * slabs, so the common kmalloc/kfree pair only disables interrupts and never
+ * touches heap_lock. Magazines are refilled from and flushed to the slabs in
+ * MAGAZINE_BATCH sized chunks. An object freed on a CPU other than the one
+ * that allocated it is pushed onto the owner's remote_free stack with a CAS;
+ * the owner takes the whole stack with one exchange when its magazine runs
+ * dry, so the stack is never popped piecemeal and has no ABA window.
+ */
+#define MEMORY_MAX_CPUS OS_CONFIG_SMP_MAX_CPUS
+#define MAGAZINE_CAPACITY 32u
+#define MAGAZINE_BATCH (MAGAZINE_CAPACITY / 2u)
+
+typedef struct {
+    slab_object_t *objects[MAGAZINE_CAPACITY];
+    uint32_t count;
+} slab_magazine_t;
+
+typedef struct {
+    slab_magazine_t magazines[SLAB_CLASS_COUNT];
+    slab_object_t *remote_free[SLAB_CLASS_COUNT];
+    int32_t remote_count[SLAB_CLASS_COUNT];
+    uint64_t bytes_allocated;
+    uint64_t bytes_freed;
+    uint64_t magazine_hits;
+    uint64_t magazine_refills;
+    uint64_t magazine_flushes;
+    uint64_t remote_frees;
+} __attribute__((aligned(64))) cpu_heap_t;
+
+static cpu_heap_t cpu_heaps[MEMORY_MAX_CPUS];
+
 static inline uint64_t irq_save_disable(void) {
     uint64_t flags;
     __asm__ volatile ("pushfq; popq %0; cli" : "=r"(flags) :: "memory");
@@ -91,63 +193,397 @@ static void memory_report_oom(const char *site, uint64_t request)
     serial_write_string("\n");
 }
 
-static memory_block_t* find_block_by_payload(void *ptr, memory_block_t **prev_out) {
-    memory_block_t *prev = NULL;
-    memory_block_t *current = heap_start;
-    uintptr_t target = (uintptr_t)ptr;
+static inline memory_block_footer_t* block_footer(memory_block_t *block) {
+    return (memory_block_footer_t*)((uint8_t*)block + sizeof(memory_block_t) + block->size);
+}
 
-    while (current != NULL) {
-        uintptr_t payload = (uintptr_t)current + sizeof(memory_block_t);
-        if (payload == target) {
-            if (prev_out != NULL) {
-                *prev_out = prev;
+static inline void block_write_tags(memory_block_t *block, uint32_t magic, uint8_t is_free) {
+    block->magic = magic;
+    block->is_free = is_free;
+    memory_block_footer_t *footer = block_footer(block);
+    footer->magic = magic;
+    footer->reserved = 0;
+    footer->size = block->size;
+}
+
+static inline memory_block_t* block_next_phys(memory_block_t *block) {
+    uintptr_t next = (uintptr_t)block + BLOCK_OVERHEAD + block->size;
+    if (next + BLOCK_OVERHEAD > heap_end) {
+        return NULL;
+    }
+    return (memory_block_t*)next;
+}
+
+static inline memory_block_t* block_prev_phys(memory_block_t *block) {
+    if ((uintptr_t)block <= (uintptr_t)heap_start) {
+        return NULL;
+    }
+    memory_block_footer_t *footer =
+        (memory_block_footer_t*)((uint8_t*)block - sizeof(memory_block_footer_t));
+    uintptr_t prev = (uintptr_t)block - BLOCK_OVERHEAD - footer->size;
+    if (prev < (uintptr_t)heap_start || footer->size > (uintptr_t)block) {
+        return NULL;
+    }
+    return (memory_block_t*)prev;
+}
+
+static void free_list_insert(memory_block_t *block) {
+    block->prev_free = NULL;
+    block->next_free = heap_free_list;
+    if (heap_free_list != NULL) {
+        heap_free_list->prev_free = block;
+    }
+    heap_free_list = block;
+}
+
+static void free_list_remove(memory_block_t *block) {
+    if (block->prev_free != NULL) {
+        block->prev_free->next_free = block->next_free;
+    } else {
+        heap_free_list = block->next_free;
+    }
+    if (block->next_free != NULL) {
+        block->next_free->prev_free = block->prev_free;
+    }
+    if (heap_search_hint == block) {
+        heap_search_hint = block->next_free;
+    }
+    block->next_free = NULL;
+    block->prev_free = NULL;
+}
+
+/*
+ * Validate that ptr is the payload of a live large-object block by checking
+ * the header and the mirrored footer. Returns NULL on any mismatch.
+ */
+static memory_block_t* block_from_payload(void *ptr) {
+    uintptr_t addr = (uintptr_t)ptr;
+    if (addr < (uintptr_t)heap_start + sizeof(memory_block_t) ||
+        addr + sizeof(memory_block_footer_t) > heap_end) {
+        return NULL;
+    }
+    memory_block_t *block = (memory_block_t*)(addr - sizeof(memory_block_t));
+    if (block->magic != HEAP_MAGIC && block->magic != HEAP_MAGIC_FREE) {
+        return NULL;
+    }
+    if (block->size > heap_end - addr - sizeof(memory_block_footer_t)) {
+        return NULL;
+    }
+    memory_block_footer_t *footer = block_footer(block);
+    if (footer->magic != block->magic || footer->size != block->size) {
+        return NULL;
+    }
+    return block;
+}
+
+/*
+ * Carve size bytes off the front of a free or allocated block. The tail, if
+ * large enough, becomes a new free block and is merged with a free successor.
+ */
+static void split_block_if_needed(memory_block_t *block, uint64_t size) {
+    if (block->size < size + BLOCK_OVERHEAD + MIN_SPLIT_REMAINDER) {
+        return;
+    }
+
+    uint64_t remainder = block->size - size - BLOCK_OVERHEAD;
+    block->size = size;
+    block_write_tags(block, block->magic, block->is_free);
+
+    memory_block_t *tail = block_next_phys(block);
+    tail->size = remainder;
+    tail->is_sensitive = 0;
+    tail->reserved = 0;
+
+    memory_block_t *after = block_next_phys(tail);
+    if (after != NULL && after->magic == HEAP_MAGIC_FREE) {
+        free_list_remove(after);
+        tail->size += BLOCK_OVERHEAD + after->size;
+    }
+    block_write_tags(tail, HEAP_MAGIC_FREE, 1);
+    free_list_insert(tail);
+}
+
+static int32_t slab_class_for_size(uint64_t size) {
+    if (size == 0 || size > SLAB_MAX_OBJECT_SIZE) {
+        return -1;
+    }
+    uint32_t cls = 0;
+    while (((uint64_t)1u << (SLAB_MIN_SHIFT + cls)) < size) {
+        ++cls;
+    }
+    return (int32_t)cls;
+}
+
+static void slab_init_caches(void) {
+    for (uint32_t i = 0; i < SLAB_CLASS_COUNT; ++i) {
+        slab_caches[i].object_size = 1u << (SLAB_MIN_SHIFT + i);
+        slab_caches[i].stride = slab_caches[i].object_size + (uint32_t)sizeof(slab_object_t);
+        slab_caches[i].partial = NULL;
+        slab_caches[i].slab_count = 0;
+        slab_caches[i].free_objects = 0;
+        slab_caches[i].empty_slabs = 0;
+    }
+}
+
+static void slab_link_partial(slab_cache_t *cache, slab_t *slab) {
+    slab->prev = NULL;
+    slab->next = cache->partial;
+    if (cache->partial != NULL) {
+        cache->partial->prev = slab;
+    }
+    cache->partial = slab;
+}
+
+static void slab_unlink_partial(slab_cache_t *cache, slab_t *slab) {
+    if (slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    } else {
+        cache->partial = slab->next;
+    }
+    if (slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+static int slab_grow_locked(uint32_t cls) {
+    slab_cache_t *cache = &slab_caches[cls];
+    slab_t *slab = (slab_t *)alloc_contiguous_pages(SLAB_PAGES, SLAB_PAGES);
+    if (slab == NULL) {
+        return -1;
+    }
+
+    slab->magic = SLAB_MAGIC;
+    slab->size_class = cls;
+    slab->object_count = (uint32_t)((SLAB_BYTES - sizeof(slab_t)) / cache->stride);
+    slab->free_count = slab->object_count;
+    slab->free_list = NULL;
+
+    uint8_t *first = (uint8_t *)slab + sizeof(slab_t);
+    for (uint32_t i = slab->object_count; i > 0; --i) {
+        slab_object_t *obj = (slab_object_t *)(first + (uint64_t)(i - 1u) * cache->stride);
+        obj->magic = HEAP_MAGIC_FREE;
+        obj->size_class = (uint8_t)cls;
+        obj->is_sensitive = 0;
+        obj->owner_cpu = (uint16_t)MEMORY_MAX_CPUS;
+        obj->next_free = slab->free_list;
+        slab->free_list = obj;
+    }
+    slab_link_partial(cache, slab);
+    cache->slab_count++;
+    cache->free_objects += slab->object_count;
+    cache->empty_slabs++;
+    return 0;
+}
+
+static slab_object_t* slab_pop_locked(uint32_t cls) {
+    slab_cache_t *cache = &slab_caches[cls];
+    if (cache->partial == NULL && slab_grow_locked(cls) < 0) {
+        return NULL;
+    }
+
+    slab_t *slab = cache->partial;
+    slab_object_t *obj = slab->free_list;
+    slab->free_list = obj->next_free;
+    if (slab->free_count == slab->object_count) {
+        cache->empty_slabs--;
+    }
+    if (--slab->free_count == 0) {
+        slab_unlink_partial(cache, slab);
+    }
+    cache->free_objects--;
+
+    return obj;
+}
+
+static void slab_push_locked(slab_object_t *obj) {
+    slab_cache_t *cache = &slab_caches[obj->size_class];
+    slab_t *slab = (slab_t *)((uintptr_t)obj & ~(uintptr_t)(SLAB_BYTES - 1u));
+
+    obj->next_free = slab->free_list;
+    slab->free_list = obj;
+    if (slab->free_count++ == 0) {
+        slab_link_partial(cache, slab);
+    }
+    cache->free_objects++;
+
+    /* Keep one empty slab per class cached so alloc/free bursts do not thrash. */
+    if (slab->free_count == slab->object_count) {
+        if (cache->empty_slabs != 0) {
+            slab_unlink_partial(cache, slab);
+            cache->slab_count--;
+            cache->free_objects -= slab->object_count;
+            slab->magic = 0;
+            free_contiguous_pages(slab, SLAB_PAGES);
+        } else {
+            cache->empty_slabs++;
+        }
+    }
+}
+
+static void* slab_object_hand_out(slab_object_t *obj, uint32_t cpu, uint8_t sensitive) {
+    obj->magic = HEAP_MAGIC;
+    obj->is_sensitive = sensitive;
+    obj->owner_cpu = (uint16_t)cpu;
+    obj->next_free = NULL;
+    return (void*)((uint8_t*)obj + sizeof(slab_object_t));
+}
+
+static uint32_t memory_current_cpu(void) {
+    uint32_t cpu = smp_get_current_cpu_id();
+    return (cpu < MEMORY_MAX_CPUS) ? cpu : MEMORY_MAX_CPUS;
+}
+
+/*
+ * Refill an empty magazine: first adopt everything other CPUs have freed back
+ * to us, then top up from the slabs under heap_lock. Interrupts must be off.
+ */
+static uint32_t magazine_refill(uint32_t cpu, uint32_t cls) {
+    cpu_heap_t *heap = &cpu_heaps[cpu];
+    slab_magazine_t *mag = &heap->magazines[cls];
+    slab_object_t *overflow = NULL;
+
+    slab_object_t *list = __atomic_exchange_n(&heap->remote_free[cls], NULL, __ATOMIC_ACQUIRE);
+    if (list != NULL) {
+        int32_t taken = 0;
+        while (list != NULL) {
+            slab_object_t *next = list->next_free;
+            if (mag->count < MAGAZINE_CAPACITY) {
+                mag->objects[mag->count++] = list;
+            } else {
+                list->next_free = overflow;
+                overflow = list;
             }
-            return current;
+            ++taken;
+            list = next;
         }
-        prev = current;
-        current = current->next;
+        __atomic_fetch_sub(&heap->remote_count[cls], taken, __ATOMIC_RELAXED);
     }
-    return NULL;
+
+    if (overflow == NULL && mag->count != 0) {
+        return mag->count;
+    }
+
+    spinlock_lock_stats(&heap_lock, &heap_lock_stats);
+    while (overflow != NULL) {
+        slab_object_t *next = overflow->next_free;
+        slab_push_locked(overflow);
+        overflow = next;
+    }
+    while (mag->count < MAGAZINE_BATCH) {
+        slab_object_t *obj = slab_pop_locked(cls);
+        if (obj == NULL) {
+            break;
+        }
+        mag->objects[mag->count++] = obj;
+    }
+    spinlock_unlock_stats(&heap_lock, &heap_lock_stats);
+    heap->magazine_refills++;
+    return mag->count;
 }
 
-static memory_block_t* split_block_if_needed(memory_block_t *block, uint32_t size) {
-    if (block->size >= size + sizeof(memory_block_t) + MIN_SPLIT_REMAINDER) {
-        memory_block_t* new_block =
-            (memory_block_t*)((uint8_t*)block + sizeof(memory_block_t) + size);
-        new_block->magic = HEAP_MAGIC_FREE;
-        new_block->size = block->size - size - sizeof(memory_block_t);
-        new_block->is_free = 1;
-        new_block->next = block->next;
+static void* magazine_alloc(uint32_t cpu, uint32_t cls, uint8_t sensitive) {
+    cpu_heap_t *heap = &cpu_heaps[cpu];
+    slab_magazine_t *mag = &heap->magazines[cls];
 
-        block->size = size;
-        block->next = new_block;
+    if (mag->count != 0) {
+        heap->magazine_hits++;
+    } else if (magazine_refill(cpu, cls) == 0) {
+        return NULL;
     }
-    return block;
+
+    slab_object_t *obj = mag->objects[--mag->count];
+    heap->bytes_allocated += slab_caches[cls].object_size;
+    return slab_object_hand_out(obj, cpu, sensitive);
 }
 
-static void* kmalloc_locked(uint64_t size) {
-    if (heap_search_hint == NULL) {
-        heap_search_hint = heap_start;
+/* Interrupts must be off; obj has already been marked HEAP_MAGIC_FREE. */
+static void magazine_free(uint32_t cpu, slab_object_t *obj) {
+    cpu_heap_t *heap = &cpu_heaps[cpu];
+    uint32_t cls = obj->size_class;
+    uint32_t owner = obj->owner_cpu;
+
+    heap->bytes_freed += slab_caches[cls].object_size;
+
+    if (owner != cpu && owner < MEMORY_MAX_CPUS) {
+        cpu_heap_t *owner_heap = &cpu_heaps[owner];
+        slab_object_t *head = __atomic_load_n(&owner_heap->remote_free[cls], __ATOMIC_RELAXED);
+        do {
+            obj->next_free = head;
+        } while (!__atomic_compare_exchange_n(&owner_heap->remote_free[cls], &head, obj, 1,
+                                              __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+        __atomic_fetch_add(&owner_heap->remote_count[cls], 1, __ATOMIC_RELAXED);
+        heap->remote_frees++;
+        return;
+    }
+
+    slab_magazine_t *mag = &heap->magazines[cls];
+    if (mag->count == MAGAZINE_CAPACITY) {
+        spinlock_lock_stats(&heap_lock, &heap_lock_stats);
+        for (uint32_t i = 0; i < MAGAZINE_BATCH; ++i) {
+            slab_push_locked(mag->objects[--mag->count]);
+        }
+        spinlock_unlock_stats(&heap_lock, &heap_lock_stats);
+        heap->magazine_flushes++;
+    }
+    mag->objects[mag->count++] = obj;
+}
+
+/*
+ * Resolve a payload pointer to its slab object header. Returns NULL if the
+ * pointer does not sit on an object boundary of a live slab.
+ */
+static slab_object_t* slab_object_from_payload(void *ptr) {
+    uintptr_t addr = (uintptr_t)ptr;
+    uintptr_t base = addr & ~(uintptr_t)(SLAB_BYTES - 1u);
+    if (base == 0 || addr < base + sizeof(slab_t) + sizeof(slab_object_t)) {
+        return NULL;
+    }
+
+    slab_t *slab = (slab_t *)base;
+    if (slab->magic != SLAB_MAGIC || slab->size_class >= SLAB_CLASS_COUNT) {
+        return NULL;
     }
 
-    memory_block_t *start = heap_search_hint;
+    const slab_cache_t *cache = &slab_caches[slab->size_class];
+    uintptr_t obj_addr = addr - sizeof(slab_object_t);
+    uintptr_t offset = obj_addr - (base + sizeof(slab_t));
+    if ((offset % cache->stride) != 0 || (offset / cache->stride) >= slab->object_count) {
+        return NULL;
+    }
+
+    slab_object_t *obj = (slab_object_t *)obj_addr;
+    if (obj->size_class != slab->size_class) {
+        return NULL;
+    }
+    return obj;
+}
+
+static int addr_in_block_heap(uintptr_t addr) {
+    return addr >= (uintptr_t)heap_start && addr < heap_end;
+}
+
+static void* kmalloc_locked(uint64_t size) {
+    memory_block_t *start = (heap_search_hint != NULL) ? heap_search_hint : heap_free_list;
     memory_block_t *current = start;
     int wrapped = 0;
 
     while (current != NULL) {
-        if (current->is_free && current->size >= size) {
-            current = split_block_if_needed(current, size);
+        if (current->size >= size) {
+            heap_search_hint = current->next_free;
+            free_list_remove(current);
             current->is_free = 0;
             current->is_sensitive = 0;
-            current->magic = HEAP_MAGIC;
-            total_allocated += current->size;
-            heap_search_hint = (current->next != NULL) ? current->next : heap_start;
+            block_write_tags(current, HEAP_MAGIC, 0);
+            split_block_if_needed(current, size);
+            total_allocated += (uint32_t)current->size;
             return (void*)((uint8_t*)current + sizeof(memory_block_t));
         }
 
-        current = current->next;
+        current = current->next_free;
         if (current == NULL && !wrapped) {
-            current = heap_start;
+            current = heap_free_list;
             wrapped = 1;
         }
         if (wrapped && current == start) {
@@ -166,15 +602,6 @@ static uint32_t calc_heap_start_page(void) {
     return heap_start_page;
 }
 
-static void mark_pages(uint64_t start_page, uint64_t page_count, uint8_t used) {
-    if (start_page >= MAX_PAGES) return;
-    uint64_t end_page = start_page + page_count;
-    if (end_page > MAX_PAGES) end_page = MAX_PAGES;
-    for (uint64_t i = start_page; i < end_page; i++) {
-        page_bitmap[i] = used;
-    }
-}
-
 static int is_usable_memory_type(uint32_t type) {
     return (type == EFI_LOADER_CODE) ||
            (type == EFI_LOADER_DATA) ||
@@ -183,31 +610,485 @@ static int is_usable_memory_type(uint32_t type) {
            (type == EFI_CONVENTIONAL_MEMORY);
 }
 
+/*
+ * Physical pages are managed by a binary buddy allocator. The per-page
+ * metadata is carved out of conventional memory at boot and sized for the
+ * highest usable page: next/prev links for the per-order free lists, a
+ * one-bit-per-page allocated map, and one bit per block for each order
+ * marking free block heads. Keeping the links out of the free pages
+ * themselves means init never writes into loader-owned memory that may
+ * still be in use (boot info, stack, modules).
+ *
+ * Every allocated page is tracked as its own order-0 block, so pages from
+ * alloc_contiguous_pages can be handed back one at a time with free_page.
+ * free_page ignores anything that is not an allocated page, which keeps
+ * reserved and identity-shared pages out of the free lists.
+ *
+ * Memory is split into zones (below 16 MiB, below 4 GiB, the rest), each
+ * with its own free lists. Zone boundaries are multiples of the largest
+ * block size, so buddies never straddle two zones. Callers name the highest
+ * zone they can use; lower zones are only borrowed while they stay above
+ * their low watermark, and the min watermark is only given up as a last
+ * resort once swap reclaim has failed.
+ */
+#define PMM_MAX_ORDER 10u
+#define PMM_ORDER_COUNT (PMM_MAX_ORDER + 1u)
+#define PMM_MAX_PHYS_PAGES ((64ULL << 30) / PAGE_SIZE)
+#define PMM_NO_PAGE 0xFFFFFFFFu
+#define PMM_WATERMARK_MIN_CAP 4096u
+
+typedef struct {
+    uint32_t next;
+    uint32_t prev;
+} pmm_link_t;
+
+typedef struct {
+    const char *name;
+    uint64_t start_page;
+    uint64_t end_page;
+    uint32_t free_heads[PMM_ORDER_COUNT];
+    uint64_t free_blocks[PMM_ORDER_COUNT];
+    uint32_t free_order_mask;
+    uint64_t free_pages;
+    uint64_t managed_pages;
+    uint64_t watermark_min;
+    uint64_t watermark_low;
+    uint64_t fallback_allocs;
+    uint64_t failed_allocs;
+} pmm_zone_t;
+
+#define PMM_ZONE_DMA_END_PAGE   ((16ULL << 20) / PAGE_SIZE)
+#define PMM_ZONE_DMA32_END_PAGE ((4ULL << 30) / PAGE_SIZE)
+
+static pmm_link_t *pmm_links = NULL;
+static uint64_t *pmm_used_bits = NULL;
+static uint64_t *pmm_free_bits[PMM_ORDER_COUNT];
+/* Extra owners of a page shared copy-on-write; 0 for ordinary pages. */
+static uint16_t *pmm_share_counts = NULL;
+static uint64_t pmm_page_count = 0;
+static pmm_zone_t pmm_zones[MEMORY_ZONE_COUNT];
+
+/*
+ * Pre-zeroed page pool. Pages are taken from the buddy allocator above the
+ * watermarks, cleared with non-temporal stores off the allocation path
+ * (timer tick) and handed out by alloc_zeroed_page(). Pool pages stay marked
+ * used in the buddy bitmap and are given back when an allocation would
+ * otherwise have to reclaim.
+ */
+#define ZERO_POOL_CAPACITY OS_CONFIG_ZERO_POOL_PAGES
+#define ZERO_POOL_LOW      (ZERO_POOL_CAPACITY / 2u)
+
+static void *zero_pool[ZERO_POOL_CAPACITY];
+static volatile uint32_t zero_pool_count = 0;
+static volatile int zero_pool_refilling = 0;
+static spinlock_t zero_pool_lock;
+static uint64_t zero_pool_hits = 0;
+static uint64_t zero_pool_misses = 0;
+static uint64_t zero_pool_refilled = 0;
+static uint64_t zero_pool_drained = 0;
+
+static inline int pmm_test_bit(const uint64_t *bits, uint64_t bit) {
+    return (int)((bits[bit >> 6] >> (bit & 63u)) & 1u);
+}
+
+static inline void pmm_set_bit(uint64_t *bits, uint64_t bit) {
+    bits[bit >> 6] |= 1ull << (bit & 63u);
+}
+
+static inline void pmm_clear_bit(uint64_t *bits, uint64_t bit) {
+    bits[bit >> 6] &= ~(1ull << (bit & 63u));
+}
+
+static inline uint64_t pmm_bitmap_words(uint32_t order) {
+    uint64_t blocks = (pmm_page_count + (1ull << order) - 1ull) >> order;
+    return (blocks + 63u) / 64u;
+}
+
+static inline int pmm_page_is_used(uint64_t idx) {
+    return idx < pmm_page_count && pmm_test_bit(pmm_used_bits, idx);
+}
+
+static inline int pmm_is_free_head(uint64_t idx, uint32_t order) {
+    return pmm_test_bit(pmm_free_bits[order], idx >> order);
+}
+
+/* Set or clear the allocated bit for [start, start + count), a word at a time. */
+static void pmm_mark_used_range(uint64_t start, uint64_t count, int used) {
+    uint64_t end = start + count;
+    while (start < end) {
+        uint64_t bit = start & 63u;
+        uint64_t span = 64u - bit;
+        if (span > end - start) {
+            span = end - start;
+        }
+        uint64_t mask = (span == 64u) ? ~0ull : (((1ull << span) - 1ull) << bit);
+        if (used) {
+            pmm_used_bits[start >> 6] |= mask;
+        } else {
+            pmm_used_bits[start >> 6] &= ~mask;
+        }
+        start += span;
+    }
+}
+
+static inline pmm_zone_t* pmm_zone_of(uint64_t idx) {
+    if (idx < PMM_ZONE_DMA_END_PAGE) {
+        return &pmm_zones[MEMORY_ZONE_DMA];
+    }
+    if (idx < PMM_ZONE_DMA32_END_PAGE) {
+        return &pmm_zones[MEMORY_ZONE_DMA32];
+    }
+    return &pmm_zones[MEMORY_ZONE_NORMAL];
+}
+
+static void pmm_list_push(pmm_zone_t *zone, uint32_t order, uint64_t idx) {
+    uint32_t head = zone->free_heads[order];
+    pmm_links[idx].next = head;
+    pmm_links[idx].prev = PMM_NO_PAGE;
+    if (head != PMM_NO_PAGE) {
+        pmm_links[head].prev = (uint32_t)idx;
+    }
+    zone->free_heads[order] = (uint32_t)idx;
+    pmm_set_bit(pmm_free_bits[order], idx >> order);
+    zone->free_order_mask |= 1u << order;
+    zone->free_blocks[order]++;
+    zone->free_pages += 1ull << order;
+}
+
+static void pmm_list_remove(pmm_zone_t *zone, uint32_t order, uint64_t idx) {
+    pmm_link_t *link = &pmm_links[idx];
+    if (link->prev != PMM_NO_PAGE) {
+        pmm_links[link->prev].next = link->next;
+    } else {
+        zone->free_heads[order] = link->next;
+    }
+    if (link->next != PMM_NO_PAGE) {
+        pmm_links[link->next].prev = link->prev;
+    }
+    pmm_clear_bit(pmm_free_bits[order], idx >> order);
+    if (zone->free_heads[order] == PMM_NO_PAGE) {
+        zone->free_order_mask &= ~(1u << order);
+    }
+    zone->free_blocks[order]--;
+    zone->free_pages -= 1ull << order;
+}
+
+static void pmm_free_block_locked(uint64_t idx, uint32_t order) {
+    pmm_zone_t *zone = pmm_zone_of(idx);
+    while (order < PMM_MAX_ORDER) {
+        uint64_t buddy = idx ^ (1ull << order);
+        if (buddy + (1ull << order) > pmm_page_count || !pmm_is_free_head(buddy, order)) {
+            break;
+        }
+        pmm_list_remove(zone, order, buddy);
+        idx = (buddy < idx) ? buddy : idx;
+        ++order;
+    }
+    pmm_list_push(zone, order, idx);
+}
+
+/* Free [start, end) as the largest naturally aligned blocks that fit. */
+static void pmm_release_range_locked(uint64_t start, uint64_t end) {
+    while (start < end) {
+        uint32_t order = 0;
+        while (order < PMM_MAX_ORDER &&
+               (start & ((2ull << order) - 1ull)) == 0 &&
+               start + (2ull << order) <= end) {
+            ++order;
+        }
+        pmm_free_block_locked(start, order);
+        start += 1ull << order;
+    }
+}
+
+static int pmm_take_block_locked(pmm_zone_t *zone, uint32_t order, uint64_t *out_idx) {
+    uint32_t candidates = zone->free_order_mask & ~((1u << order) - 1u);
+    if (candidates == 0) {
+        return -1;
+    }
+    uint32_t found = (uint32_t)__builtin_ctz(candidates);
+
+    uint64_t idx = zone->free_heads[found];
+    pmm_list_remove(zone, found, idx);
+    while (found > order) {
+        --found;
+        pmm_list_push(zone, found, idx + (1ull << found));
+    }
+    *out_idx = idx;
+    return 0;
+}
+
+/*
+ * Requests above the largest order need several physically adjacent
+ * max-order blocks. The max-order head bitmap is scanned a word at a time:
+ * empty words are skipped whole and runs of set bits are measured with
+ * tzcnt instead of probing block by block.
+ */
+static int pmm_take_run_locked(pmm_zone_t *zone, uint64_t page_count, uint64_t align_pages,
+                               uint64_t *out_idx, uint64_t *out_end) {
+    const uint64_t block_pages = 1ull << PMM_MAX_ORDER;
+    const uint64_t *bits = pmm_free_bits[PMM_MAX_ORDER];
+    uint64_t nbits = zone->end_page >> PMM_MAX_ORDER;
+    uint64_t blocks = (page_count + block_pages - 1ull) / block_pages;
+    uint64_t align_blocks = (align_pages > block_pages) ? (align_pages / block_pages) : 1u;
+
+    uint64_t i = zone->start_page >> PMM_MAX_ORDER;
+    while (i + blocks <= nbits) {
+        uint64_t word = bits[i >> 6] >> (i & 63u);
+        if (word == 0) {
+            i = (i | 63u) + 1u;
+            continue;
+        }
+        i += (uint64_t)__builtin_ctzll(word);
+        if ((i % align_blocks) != 0) {
+            i += align_blocks - (i % align_blocks);
+            continue;
+        }
+
+        uint64_t j = i;
+        while (j < nbits && j - i < blocks) {
+            uint64_t avail = 64u - (j & 63u);
+            uint64_t inverted = ~(bits[j >> 6] >> (j & 63u));
+            uint64_t ones = (inverted == 0) ? 64u : (uint64_t)__builtin_ctzll(inverted);
+            if (ones > avail) {
+                ones = avail;
+            }
+            j += ones;
+            if (ones < avail) {
+                break;
+            }
+        }
+        if (j - i >= blocks) {
+            for (uint64_t k = 0; k < blocks; ++k) {
+                pmm_list_remove(zone, PMM_MAX_ORDER, (i + k) * block_pages);
+            }
+            *out_idx = i * block_pages;
+            *out_end = (i + blocks) * block_pages;
+            return 0;
+        }
+        i = j;
+    }
+    return -1;
+}
+
+static uint32_t pmm_order_for(uint64_t pages) {
+    uint32_t order = 0;
+    while ((1ull << order) < pages) {
+        ++order;
+    }
+    return order;
+}
+
+static void pmm_add_range(uint64_t start, uint64_t end, uint64_t reserved_end, uint64_t meta_start, uint64_t meta_end) {
+    if (start < reserved_end) start = reserved_end;
+    if (end > pmm_page_count) end = pmm_page_count;
+    if (start >= end) return;
+
+    for (uint32_t z = 0; z < MEMORY_ZONE_COUNT; ++z) {
+        uint64_t boundary = pmm_zones[z].end_page;
+        if (start < boundary && end > boundary) {
+            pmm_add_range(start, boundary, reserved_end, meta_start, meta_end);
+            pmm_add_range(boundary, end, reserved_end, meta_start, meta_end);
+            return;
+        }
+    }
+
+    if (meta_start < end && meta_end > start) {
+        if (start < meta_start) {
+            pmm_release_range_locked(start, meta_start);
+        }
+        if (meta_end < end) {
+            pmm_release_range_locked(meta_end, end);
+        }
+    } else {
+        pmm_release_range_locked(start, end);
+    }
+}
+
 void init_physical_memory(void *memory_map, size_t map_size, size_t desc_size) {
     serial_write_string("[OS] [Memory] Start Initialize Physical Memory.\n");
-    
-    for (size_t i = 0; i < MAX_PAGES; i++)
-        page_bitmap[i] = 1;
 
-    if (memory_map != NULL && desc_size != 0) {
-        uint8_t* map = (uint8_t*)memory_map;
+    static const char *const zone_names[MEMORY_ZONE_COUNT] = { "DMA", "DMA32", "Normal" };
+    static const uint64_t zone_ends[MEMORY_ZONE_COUNT] = {
+        PMM_ZONE_DMA_END_PAGE, PMM_ZONE_DMA32_END_PAGE, PMM_MAX_PHYS_PAGES
+    };
+
+    pmm_links = NULL;
+    pmm_used_bits = NULL;
+    pmm_share_counts = NULL;
+    pmm_page_count = 0;
+    for (uint32_t i = 0; i < PMM_ORDER_COUNT; ++i) {
+        pmm_free_bits[i] = NULL;
+    }
+    for (uint32_t z = 0; z < MEMORY_ZONE_COUNT; ++z) {
+        pmm_zone_t *zone = &pmm_zones[z];
+        zone->name = zone_names[z];
+        zone->start_page = (z == 0) ? 0 : zone_ends[z - 1];
+        zone->end_page = zone_ends[z];
+        for (uint32_t i = 0; i < PMM_ORDER_COUNT; ++i) {
+            zone->free_heads[i] = PMM_NO_PAGE;
+            zone->free_blocks[i] = 0;
+        }
+        zone->free_order_mask = 0;
+        zone->free_pages = 0;
+        zone->managed_pages = 0;
+        zone->watermark_min = 0;
+        zone->watermark_low = 0;
+        zone->fallback_allocs = 0;
+        zone->failed_allocs = 0;
+    }
+
+    if (memory_map == NULL || desc_size == 0) {
+        serial_write_string("[OS] [Memory] No memory map, page allocator empty\n");
+        return;
+    }
+
+    uint8_t* map = (uint8_t*)memory_map;
+    uint64_t max_page = 0;
+    for (size_t offset = 0; offset + desc_size <= map_size; offset += desc_size) {
+        EFI_MEMORY_DESCRIPTOR* desc = (EFI_MEMORY_DESCRIPTOR*)(map + offset);
+        if (is_usable_memory_type(desc->Type)) {
+            uint64_t end_page = desc->PhysicalStart / PAGE_SIZE + desc->NumberOfPages;
+            if (end_page > max_page) {
+                max_page = end_page;
+            }
+        }
+    }
+    if (max_page > PMM_MAX_PHYS_PAGES) {
+        serial_write_string("[OS] [Memory] Physical memory above 64 GiB ignored\n");
+        max_page = PMM_MAX_PHYS_PAGES;
+    }
+
+    uint32_t start_page = calc_heap_start_page();
+    uint64_t reserved_end = (uint64_t)start_page + HEAP_PAGE_COUNT;
+    pmm_page_count = max_page;
+    uint64_t bitmap_words = pmm_bitmap_words(0);
+    for (uint32_t order = 0; order < PMM_ORDER_COUNT; ++order) {
+        bitmap_words += pmm_bitmap_words(order);
+    }
+    uint64_t meta_bytes = max_page * sizeof(pmm_link_t) + bitmap_words * sizeof(uint64_t) +
+                          max_page * sizeof(uint16_t);
+    uint64_t meta_pages = (meta_bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint64_t meta_start = 0;
+    for (size_t offset = 0; offset + desc_size <= map_size; offset += desc_size) {
+        EFI_MEMORY_DESCRIPTOR* desc = (EFI_MEMORY_DESCRIPTOR*)(map + offset);
+        if (desc->Type != EFI_CONVENTIONAL_MEMORY) {
+            continue;
+        }
+        uint64_t first = desc->PhysicalStart / PAGE_SIZE;
+        uint64_t last = first + desc->NumberOfPages;
+        if (first < reserved_end) first = reserved_end;
+        if (last > max_page) last = max_page;
+        if (first < last && last - first >= meta_pages) {
+            meta_start = first;
+            break;
+        }
+    }
+    if (meta_start == 0) {
+        pmm_page_count = 0;
+        serial_write_string("[OS] [Memory] No room for page metadata, page allocator empty\n");
+        return;
+    }
+
+    pmm_links = (pmm_link_t *)(uintptr_t)(meta_start * PAGE_SIZE);
+    uint64_t *bitmap = (uint64_t *)(pmm_links + max_page);
+    for (uint64_t i = 0; i < bitmap_words; ++i) {
+        bitmap[i] = 0;
+    }
+    pmm_used_bits = bitmap;
+    bitmap += pmm_bitmap_words(0);
+    for (uint32_t order = 0; order < PMM_ORDER_COUNT; ++order) {
+        pmm_free_bits[order] = bitmap;
+        bitmap += pmm_bitmap_words(order);
+    }
+    pmm_share_counts = (uint16_t *)bitmap;
+    for (uint64_t i = 0; i < max_page; ++i) {
+        pmm_share_counts[i] = 0;
+    }
+
+    /*
+     * Loader and boot-services ranges go in first and conventional memory
+     * last, so the LIFO free lists prefer memory nothing was using at boot.
+     */
+    for (uint32_t pass = 0; pass < 2; ++pass) {
         for (size_t offset = 0; offset + desc_size <= map_size; offset += desc_size) {
             EFI_MEMORY_DESCRIPTOR* desc = (EFI_MEMORY_DESCRIPTOR*)(map + offset);
-            if (is_usable_memory_type(desc->Type)) {
-                uint64_t start_page = desc->PhysicalStart / PAGE_SIZE;
-                uint64_t page_count = desc->NumberOfPages;
-                mark_pages(start_page, page_count, 0);
+            if (!is_usable_memory_type(desc->Type) ||
+                (desc->Type == EFI_CONVENTIONAL_MEMORY) != (pass == 1)) {
+                continue;
             }
+            uint64_t first = desc->PhysicalStart / PAGE_SIZE;
+            pmm_add_range(first, first + desc->NumberOfPages, reserved_end,
+                          meta_start, meta_start + meta_pages);
         }
     }
 
-    uint32_t start_page = calc_heap_start_page();
-    mark_pages(0, (uint64_t)start_page + HEAP_PAGE_COUNT, 1);
+    for (uint32_t z = 0; z < MEMORY_ZONE_COUNT; ++z) {
+        pmm_zone_t *zone = &pmm_zones[z];
+        if (zone->end_page > pmm_page_count) {
+            zone->end_page = (pmm_page_count > zone->start_page) ? pmm_page_count : zone->start_page;
+        }
+        zone->managed_pages = zone->free_pages;
+        zone->watermark_min = zone->managed_pages / 256u;
+        if (zone->watermark_min > PMM_WATERMARK_MIN_CAP) {
+            zone->watermark_min = PMM_WATERMARK_MIN_CAP;
+        }
+        zone->watermark_low = zone->watermark_min * 2u;
+    }
 
     serial_write_string("[OS] [Memory] Physical memory initialized.\n");
+    serial_write_string("[OS] [Memory] Buddy allocator: ");
+    serial_write_uint64(memory_get_free_page_count());
+    serial_write_string(" free pages, highest page ");
+    serial_write_uint64(pmm_page_count);
+    serial_write_string(", metadata at ");
+    serial_write_uint64(meta_start * PAGE_SIZE);
+    serial_write_string("\n");
     serial_write_string("[OS] [Memory] Heap will start at page ");
     serial_write_uint32(start_page);
     serial_write_string("\n");
+    memory_print_zone_info();
+}
+
+uint64_t memory_get_phys_limit(void) {
+    return pmm_page_count * PAGE_SIZE;
+}
+
+uint64_t memory_get_free_page_count(void) {
+    uint64_t pages = zero_pool_count;
+    for (uint32_t z = 0; z < MEMORY_ZONE_COUNT; ++z) {
+        pages += pmm_zones[z].free_pages;
+    }
+    return pages;
+}
+
+uint64_t memory_get_total_page_count(void) {
+    uint64_t pages = 0;
+    for (uint32_t z = 0; z < MEMORY_ZONE_COUNT; ++z) {
+        pages += pmm_zones[z].managed_pages;
+    }
+    return pages;
+}
+
+void memory_print_zone_info(void) {
+    for (uint32_t z = 0; z < MEMORY_ZONE_COUNT; ++z) {
+        const pmm_zone_t *zone = &pmm_zones[z];
+        serial_write_string("[OS] [Memory] Zone ");
+        serial_write_string(zone->name);
+        serial_write_string(": free=");
+        serial_write_uint64(zone->free_pages);
+        serial_write_string(" managed=");
+        serial_write_uint64(zone->managed_pages);
+        serial_write_string(" min=");
+        serial_write_uint64(zone->watermark_min);
+        serial_write_string(" low=");
+        serial_write_uint64(zone->watermark_low);
+        serial_write_string(" fallback=");
+        serial_write_uint64(zone->fallback_allocs);
+        serial_write_string(" failed=");
+        serial_write_uint64(zone->failed_allocs);
+        serial_write_string("\n");
+    }
 }
 
 void memory_init(void) {
@@ -218,31 +1099,50 @@ void memory_init(void) {
     
     uint32_t start_page = calc_heap_start_page();
     heap_start = (memory_block_t*)((uintptr_t)start_page * PAGE_SIZE);
+    heap_end = (uintptr_t)heap_start + (HEAP_PAGE_COUNT * PAGE_SIZE);
     
-    heap_start->magic = HEAP_MAGIC_FREE;
-    heap_start->size = (HEAP_PAGE_COUNT * PAGE_SIZE) - sizeof(memory_block_t);
-    heap_start->is_free = 1;
-    heap_start->next = NULL;
+    heap_start->size = (HEAP_PAGE_COUNT * PAGE_SIZE) - BLOCK_OVERHEAD;
+    heap_start->is_sensitive = 0;
+    heap_start->reserved = 0;
+    block_write_tags(heap_start, HEAP_MAGIC_FREE, 1);
+    heap_free_list = NULL;
+    free_list_insert(heap_start);
     heap_search_hint = heap_start;
+    slab_init_caches();
+    for (uint32_t cpu = 0; cpu < MEMORY_MAX_CPUS; ++cpu) {
+        cpu_heap_t *heap = &cpu_heaps[cpu];
+        for (uint32_t i = 0; i < SLAB_CLASS_COUNT; ++i) {
+            heap->magazines[i].count = 0;
+            heap->remote_free[i] = NULL;
+            heap->remote_count[i] = 0;
+        }
+        heap->bytes_allocated = 0;
+        heap->bytes_freed = 0;
+        heap->magazine_hits = 0;
+        heap->magazine_refills = 0;
+        heap->magazine_flushes = 0;
+        heap->remote_frees = 0;
+    }
     
     heap_initialized = 1;
     total_allocated = 0;
     total_freed = 0;
-    page_alloc_hint = 0;
     g_oom_total = 0;
     g_oom_kmalloc = 0;
     g_oom_pages = 0;
     spinlock_init(&heap_lock);
     spinlock_init(&page_lock);
+    heap_lock_stats = (spinlock_stats_t){0};
+    page_lock_stats = (spinlock_stats_t){0};
     
     serial_write_string("[OS] [Memory] Heap initialized at ");
     serial_write_uint64((uint64_t)heap_start);
     serial_write_string(" with size ");
-    serial_write_uint32(heap_start->size);
+    serial_write_uint64(heap_start->size);
     serial_write_string(" bytes\n");
 }
 
-void* kmalloc(uint64_t size) {
+static void* kmalloc_internal(uint64_t size, uint8_t sensitive) {
     if (!heap_initialized) {
         serial_write_string("[OS] [Memory] kmalloc called before heap init!\n");
         return NULL;
@@ -252,10 +1152,31 @@ void* kmalloc(uint64_t size) {
     
     size = align_up(size, MIN_ALLOC_ALIGN);
 
+    void *ptr = NULL;
+    int32_t cls = slab_class_for_size(size);
     uint64_t irq_flags = irq_save_disable();
-    spinlock_lock(&heap_lock);
-    void *ptr = kmalloc_locked(size);
-    spinlock_unlock(&heap_lock);
+    if (cls >= 0) {
+        uint32_t cpu = memory_current_cpu();
+        if (cpu < MEMORY_MAX_CPUS) {
+            ptr = magazine_alloc(cpu, (uint32_t)cls, sensitive);
+        } else {
+            spinlock_lock_stats(&heap_lock, &heap_lock_stats);
+            slab_object_t *obj = slab_pop_locked((uint32_t)cls);
+            if (obj != NULL) {
+                total_allocated += slab_caches[cls].object_size;
+                ptr = slab_object_hand_out(obj, cpu, sensitive);
+            }
+            spinlock_unlock_stats(&heap_lock, &heap_lock_stats);
+        }
+    }
+    if (ptr == NULL) {
+        spinlock_lock_stats(&heap_lock, &heap_lock_stats);
+        ptr = kmalloc_locked(size);
+        if (ptr != NULL) {
+            ((memory_block_t *)((uint8_t *)ptr - sizeof(memory_block_t)))->is_sensitive = sensitive;
+        }
+        spinlock_unlock_stats(&heap_lock, &heap_lock_stats);
+    }
     irq_restore(irq_flags);
     if (ptr != NULL) {
         return ptr;
@@ -265,6 +1186,10 @@ void* kmalloc(uint64_t size) {
     return NULL;
 }
 
+void* kmalloc(uint64_t size) {
+    return kmalloc_internal(size, 0);
+}
+
 void kfree(void* ptr) {
     if (ptr == NULL) return;
     
@@ -274,84 +1199,110 @@ void kfree(void* ptr) {
     }
 
     uintptr_t addr = (uintptr_t)ptr;
-    uintptr_t heap_start_addr = (uintptr_t)heap_start;
-    uintptr_t heap_end_addr = heap_start_addr + (HEAP_PAGE_COUNT * PAGE_SIZE);
-    
-    if (addr < heap_start_addr + sizeof(memory_block_t) || addr >= heap_end_addr) {
-        serial_write_string("[OS] [Memory] kfree: Invalid pointer\n");
-        return;
-    }
+    if (!addr_in_block_heap(addr)) {
+        slab_object_t *obj = slab_object_from_payload(ptr);
+        if (obj == NULL) {
+            serial_write_string("[OS] [Memory] kfree: Invalid pointer\n");
+            return;
+        }
+        uint32_t expected = HEAP_MAGIC;
+        if (!__atomic_compare_exchange_n(&obj->magic, &expected, HEAP_MAGIC_FREE, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            if (expected == HEAP_MAGIC_FREE) {
+                serial_write_string("[OS] [Memory] kfree: Double free detected\n");
+            } else {
+                serial_write_string("[OS] [Memory] kfree: Heap corruption detected (Invalid Magic)\n");
+            }
+            return;
+        }
+        if (obj->is_sensitive) {
+            uint32_t object_size = slab_caches[obj->size_class].object_size;
+            uint8_t* payload = (uint8_t*)ptr;
+            for (uint32_t i = 0; i < object_size; i++) {
+                payload[i] = 0;
+            }
+            obj->is_sensitive = 0;
+        }
 
-    uint64_t irq_flags = irq_save_disable();
-    spinlock_lock(&heap_lock);
-    memory_block_t* prev = NULL;
-    memory_block_t* block = find_block_by_payload(ptr, &prev);
-    if (block == NULL) {
-        spinlock_unlock(&heap_lock);
+        uint64_t irq_flags = irq_save_disable();
+        uint32_t cpu = memory_current_cpu();
+        if (cpu < MEMORY_MAX_CPUS) {
+            magazine_free(cpu, obj);
+        } else {
+            spinlock_lock_stats(&heap_lock, &heap_lock_stats);
+            slab_push_locked(obj);
+            total_freed += slab_caches[obj->size_class].object_size;
+            spinlock_unlock_stats(&heap_lock, &heap_lock_stats);
+        }
         irq_restore(irq_flags);
-        serial_write_string("[OS] [Memory] kfree: Pointer not tracked\n");
         return;
     }
 
-    if (block->magic != HEAP_MAGIC) {
-        spinlock_unlock(&heap_lock);
+    uint64_t irq_flags = irq_save_disable();
+    spinlock_lock_stats(&heap_lock, &heap_lock_stats);
+    memory_block_t* block = block_from_payload(ptr);
+    if (block == NULL) {
+        spinlock_unlock_stats(&heap_lock, &heap_lock_stats);
         irq_restore(irq_flags);
         serial_write_string("[OS] [Memory] kfree: Heap corruption detected (Invalid Magic)\n");
         return;
     }
 
-    if (block->is_free) {
-        spinlock_unlock(&heap_lock);
+    if (block->magic == HEAP_MAGIC_FREE || block->is_free) {
+        spinlock_unlock_stats(&heap_lock, &heap_lock_stats);
         irq_restore(irq_flags);
         serial_write_string("[OS] [Memory] kfree: Double free detected\n");
         return;
     }
     
-    block->is_free = 1;
-    block->magic = HEAP_MAGIC_FREE;
-    total_freed += block->size;
+    total_freed += (uint32_t)block->size;
 
     if (block->is_sensitive) {
         uint8_t* payload = (uint8_t*)ptr;
-        for (uint32_t i = 0; i < block->size; i++) {
+        for (uint64_t i = 0; i < block->size; i++) {
             payload[i] = 0;
         }
+        block->is_sensitive = 0;
     }
 
-    if (block->next != NULL && block->next->is_free) {
-        block->size += sizeof(memory_block_t) + block->next->size;
-        block->next = block->next->next;
+    memory_block_t *next = block_next_phys(block);
+    if (next != NULL && next->magic == HEAP_MAGIC_FREE) {
+        free_list_remove(next);
+        block->size += BLOCK_OVERHEAD + next->size;
     }
 
-    if (prev != NULL && prev->is_free) {
-        prev->size += sizeof(memory_block_t) + block->size;
-        prev->next = block->next;
+    memory_block_t *prev = block_prev_phys(block);
+    if (prev != NULL && prev->magic == HEAP_MAGIC_FREE) {
+        free_list_remove(prev);
+        prev->size += BLOCK_OVERHEAD + block->size;
         block = prev;
     }
 
+    block_write_tags(block, HEAP_MAGIC_FREE, 1);
+    free_list_insert(block);
     heap_search_hint = block;
-    spinlock_unlock(&heap_lock);
+    spinlock_unlock_stats(&heap_lock, &heap_lock_stats);
     irq_restore(irq_flags);
 }
 
 void* kmalloc_sensitive(uint64_t size) {
-    void* ptr = kmalloc(size);
-    if (ptr == NULL) return NULL;
-    
-    uintptr_t addr = (uintptr_t)ptr;
-    memory_block_t* block = (memory_block_t*)(addr - sizeof(memory_block_t));
-    block->is_sensitive = 1;
-    
-    return ptr;
+    return kmalloc_internal(size, 1);
 }
 
 void kfree_sensitive(void* ptr) {
     if (ptr == NULL) return;
     
     uintptr_t addr = (uintptr_t)ptr;
-    memory_block_t* block = (memory_block_t*)(addr - sizeof(memory_block_t));
-    if (block->magic == HEAP_MAGIC) {
-        block->is_sensitive = 1;
+    if (addr_in_block_heap(addr)) {
+        memory_block_t* block = block_from_payload(ptr);
+        if (block != NULL && block->magic == HEAP_MAGIC) {
+            block->is_sensitive = 1;
+        }
+    } else {
+        slab_object_t *obj = slab_object_from_payload(ptr);
+        if (obj != NULL && obj->magic == HEAP_MAGIC) {
+            obj->is_sensitive = 1;
+        }
     }
     
     kfree(ptr);
@@ -387,37 +1338,53 @@ void* krealloc(void* ptr, uint64_t new_size) {
 
     new_size = align_up(new_size, MIN_ALLOC_ALIGN);
 
-    uint32_t old_size = 0;
-    uint64_t irq_flags = irq_save_disable();
-    spinlock_lock(&heap_lock);
-    memory_block_t* block = find_block_by_payload(ptr, NULL);
-    if (block == NULL || block->is_free || block->magic != HEAP_MAGIC) {
-        spinlock_unlock(&heap_lock);
-        irq_restore(irq_flags);
-        serial_write_string("[OS] [Memory] krealloc: Invalid pointer\n");
-        return NULL;
-    }
-    old_size = block->size;
+    uint64_t old_size = 0;
+    if (!addr_in_block_heap((uintptr_t)ptr)) {
+        slab_object_t *obj = slab_object_from_payload(ptr);
+        if (obj == NULL || obj->magic != HEAP_MAGIC) {
+            serial_write_string("[OS] [Memory] krealloc: Invalid pointer\n");
+            return NULL;
+        }
+        old_size = slab_caches[obj->size_class].object_size;
+        if (new_size <= old_size) {
+            return ptr;
+        }
+    } else {
+        uint64_t irq_flags = irq_save_disable();
+        spinlock_lock_stats(&heap_lock, &heap_lock_stats);
+        memory_block_t* block = block_from_payload(ptr);
+        if (block == NULL || block->is_free || block->magic != HEAP_MAGIC) {
+            spinlock_unlock_stats(&heap_lock, &heap_lock_stats);
+            irq_restore(irq_flags);
+            serial_write_string("[OS] [Memory] krealloc: Invalid pointer\n");
+            return NULL;
+        }
+        old_size = block->size;
 
-    if (new_size <= old_size) {
-        split_block_if_needed(block, new_size);
-        spinlock_unlock(&heap_lock);
-        irq_restore(irq_flags);
-        return ptr;
-    }
+        if (new_size <= old_size) {
+            split_block_if_needed(block, new_size);
+            total_freed += (uint32_t)(old_size - block->size);
+            spinlock_unlock_stats(&heap_lock, &heap_lock_stats);
+            irq_restore(irq_flags);
+            return ptr;
+        }
 
-    if (block->next != NULL &&
-        block->next->is_free &&
-        block->size + sizeof(memory_block_t) + block->next->size >= new_size) {
-        block->size += sizeof(memory_block_t) + block->next->size;
-        block->next = block->next->next;
-        split_block_if_needed(block, new_size);
-        spinlock_unlock(&heap_lock);
+        memory_block_t *next = block_next_phys(block);
+        if (next != NULL &&
+            next->magic == HEAP_MAGIC_FREE &&
+            block->size + BLOCK_OVERHEAD + next->size >= new_size) {
+            free_list_remove(next);
+            block->size += BLOCK_OVERHEAD + next->size;
+            block_write_tags(block, HEAP_MAGIC, 0);
+            split_block_if_needed(block, new_size);
+            total_allocated += (uint32_t)(block->size - old_size);
+            spinlock_unlock_stats(&heap_lock, &heap_lock_stats);
+            irq_restore(irq_flags);
+            return ptr;
+        }
+        spinlock_unlock_stats(&heap_lock, &heap_lock_stats);
         irq_restore(irq_flags);
-        return ptr;
     }
-    spinlock_unlock(&heap_lock);
-    irq_restore(irq_flags);
 
     void* new_ptr = kmalloc(new_size);
     if (new_ptr == NULL) {
@@ -427,7 +1394,7 @@ void* krealloc(void* ptr, uint64_t new_size) {
     // Copy memory without holding locks - safe since we own the pointers
     uint8_t* src = (uint8_t*)ptr;
     uint8_t* dst = (uint8_t*)new_ptr;
-    for (uint32_t i = 0; i < old_size; i++) {
+    for (uint64_t i = 0; i < old_size; i++) {
         dst[i] = src[i];
     }
 
@@ -440,28 +1407,41 @@ uint32_t get_free_memory(void) {
     if (!heap_initialized) return 0;
     
     uint64_t irq_flags = irq_save_disable();
-    spinlock_lock(&heap_lock);
+    spinlock_lock_stats(&heap_lock, &heap_lock_stats);
     uint32_t free_memory = 0;
-    memory_block_t* current = heap_start;
+    memory_block_t* current = heap_free_list;
     
     while (current != NULL) {
-        if (current->is_free) {
-            free_memory += current->size;
+        free_memory += (uint32_t)current->size;
+        current = current->next_free;
+    }
+    for (uint32_t i = 0; i < SLAB_CLASS_COUNT; ++i) {
+        free_memory += slab_caches[i].free_objects * slab_caches[i].object_size;
+    }
+    spinlock_unlock_stats(&heap_lock, &heap_lock_stats);
+    for (uint32_t cpu = 0; cpu < MEMORY_MAX_CPUS; ++cpu) {
+        for (uint32_t i = 0; i < SLAB_CLASS_COUNT; ++i) {
+            int32_t remote = __atomic_load_n(&cpu_heaps[cpu].remote_count[i], __ATOMIC_RELAXED);
+            uint32_t cached = cpu_heaps[cpu].magazines[i].count + (remote > 0 ? (uint32_t)remote : 0u);
+            free_memory += cached * slab_caches[i].object_size;
         }
-        current = current->next;
     }
-    spinlock_unlock(&heap_lock);
     irq_restore(irq_flags);
     return free_memory;
 }
 
 uint32_t get_used_memory(void) {
     uint64_t irq_flags = irq_save_disable();
-    spinlock_lock(&heap_lock);
-    uint32_t used = (total_allocated >= total_freed) ? (total_allocated - total_freed) : 0;
-    spinlock_unlock(&heap_lock);
+    spinlock_lock_stats(&heap_lock, &heap_lock_stats);
+    uint64_t allocated = total_allocated;
+    uint64_t freed = total_freed;
+    spinlock_unlock_stats(&heap_lock, &heap_lock_stats);
     irq_restore(irq_flags);
-    return used;
+    for (uint32_t cpu = 0; cpu < MEMORY_MAX_CPUS; ++cpu) {
+        allocated += cpu_heaps[cpu].bytes_allocated;
+        freed += cpu_heaps[cpu].bytes_freed;
+    }
+    return (allocated >= freed) ? (uint32_t)(allocated - freed) : 0;
 }
 
 void debug_print_memory_info(void) {
@@ -471,9 +1451,9 @@ void debug_print_memory_info(void) {
     }
     
     uint64_t irq_flags = irq_save_disable();
-    spinlock_lock(&heap_lock);
+    spinlock_lock_stats(&heap_lock, &heap_lock_stats);
     memory_block_t* current = heap_start;
-    int block_count = 0;
+    uint32_t block_count = 0;
     uint32_t free_blocks = 0;
     uint32_t used_blocks = 0;
     
@@ -484,7 +1464,7 @@ void debug_print_memory_info(void) {
         } else {
             used_blocks++;
         }
-        current = current->next;
+        current = block_next_phys(current);
     }
     
     serial_write_string("[OS] [Memory] Total blocks: ");
@@ -494,112 +1474,222 @@ void debug_print_memory_info(void) {
     serial_write_string(", Used: ");
     serial_write_uint32(used_blocks);
     serial_write_string(")\n");
-    spinlock_unlock(&heap_lock);
+    for (uint32_t i = 0; i < SLAB_CLASS_COUNT; ++i) {
+        if (slab_caches[i].slab_count == 0) {
+            continue;
+        }
+        serial_write_string("[OS] [Memory] Slab class ");
+        serial_write_uint32(slab_caches[i].object_size);
+        serial_write_string(": slabs=");
+        serial_write_uint32(slab_caches[i].slab_count);
+        serial_write_string(" free_objects=");
+        serial_write_uint32(slab_caches[i].free_objects);
+        serial_write_string("\n");
+    }
+    spinlock_unlock_stats(&heap_lock, &heap_lock_stats);
     irq_restore(irq_flags);
+    memory_print_lock_stats();
+    memory_print_zero_pool_stats();
+    serial_write_string("[OS] [Memory] Demand-zero faults: ");
+    serial_write_uint64(paging_get_demand_fault_count());
+    serial_write_string("\n");
+    paging_print_huge_page_stats();
+    paging_print_cow_stats();
+    paging_print_tlb_stats();
+    paging_swap_print_stats();
 }
 
-void* alloc_page(void) {
-    if (alloc_page_recursion_depth >= MAX_ALLOC_PAGE_RECURSION_DEPTH) {
-        ++g_oom_pages;
-        memory_report_oom("alloc_page (recursion limit)", PAGE_SIZE);
-        return NULL;
+void memory_get_lock_stats(memory_lock_stats_t *out) {
+    if (out == NULL) {
+        return;
     }
 
     uint64_t irq_flags = irq_save_disable();
-    spinlock_lock(&page_lock);
-    for (size_t offset = 0; offset < MAX_PAGES; offset++) {
-        size_t i = (page_alloc_hint + offset) % MAX_PAGES;
-        if (page_bitmap[i] == 0) {
-            page_bitmap[i] = 1;
-            page_alloc_hint = (uint32_t)((i + 1) % MAX_PAGES);
-            spinlock_unlock(&page_lock);
-            irq_restore(irq_flags);
-            return (void*)(i * PAGE_SIZE);
-        }
-    }
-    spinlock_unlock(&page_lock);
+    out->heap_lock = heap_lock_stats;
+    out->page_lock = page_lock_stats;
     irq_restore(irq_flags);
 
-    ++alloc_page_recursion_depth;
-    int reclaim_result = paging_swap_reclaim_one_page();
-    --alloc_page_recursion_depth;
+    out->magazine_hits = 0;
+    out->magazine_refills = 0;
+    out->magazine_flushes = 0;
+    out->remote_frees = 0;
+    for (uint32_t cpu = 0; cpu < MEMORY_MAX_CPUS; ++cpu) {
+        out->magazine_hits += cpu_heaps[cpu].magazine_hits;
+        out->magazine_refills += cpu_heaps[cpu].magazine_refills;
+        out->magazine_flushes += cpu_heaps[cpu].magazine_flushes;
+        out->remote_frees += cpu_heaps[cpu].remote_frees;
+    }
+}
 
-    if (reclaim_result > 0) {
-        return alloc_page();
+static void memory_print_one_lock(const char *name, const spinlock_stats_t *stats) {
+    serial_write_string("[OS] [Memory] ");
+    serial_write_string(name);
+    serial_write_string(": acquisitions=");
+    serial_write_uint64(stats->acquisitions);
+    serial_write_string(" contended=");
+    serial_write_uint64(stats->contended);
+    serial_write_string(" wait_cycles=");
+    serial_write_uint64(stats->wait_cycles);
+    serial_write_string(" hold_cycles=");
+    serial_write_uint64(stats->hold_cycles);
+    serial_write_string(" max_hold=");
+    serial_write_uint64(stats->max_hold_cycles);
+    serial_write_string("\n");
+}
+
+void memory_print_lock_stats(void) {
+    memory_lock_stats_t stats;
+    memory_get_lock_stats(&stats);
+
+    memory_print_one_lock("heap_lock", &stats.heap_lock);
+    memory_print_one_lock("page_lock", &stats.page_lock);
+    serial_write_string("[OS] [Memory] Magazines: hits=");
+    serial_write_uint64(stats.magazine_hits);
+    serial_write_string(" refills=");
+    serial_write_uint64(stats.magazine_refills);
+    serial_write_string(" flushes=");
+    serial_write_uint64(stats.magazine_flushes);
+    serial_write_string(" remote_frees=");
+    serial_write_uint64(stats.remote_frees);
+    serial_write_string("\n");
+}
+
+/*
+ * Take a block for [page_count, align] from `highest` or a lower zone.
+ * With watermarks on, the requested zone keeps its min reserve and a lower
+ * zone is only borrowed while it stays above its low watermark.
+ */
+static int pmm_alloc_locked(uint32_t page_count, uint64_t align, memory_zone_t highest,
+                            int use_watermarks, uint64_t *out_idx) {
+    uint32_t order = pmm_order_for((page_count > align) ? page_count : align);
+    uint64_t need = (order <= PMM_MAX_ORDER) ? (1ull << order) : page_count;
+
+    for (int32_t z = (int32_t)highest; z >= 0; --z) {
+        pmm_zone_t *zone = &pmm_zones[z];
+        uint64_t floor = 0;
+        if (use_watermarks) {
+            floor = (z == (int32_t)highest) ? zone->watermark_min : zone->watermark_low;
+        }
+        if (zone->free_pages < need + floor) {
+            continue;
+        }
+
+        uint64_t idx = 0;
+        uint64_t end = 0;
+        int rc;
+        if (order <= PMM_MAX_ORDER) {
+            rc = pmm_take_block_locked(zone, order, &idx);
+            end = idx + (1ull << order);
+        } else {
+            rc = pmm_take_run_locked(zone, page_count, align, &idx, &end);
+        }
+        if (rc != 0) {
+            continue;
+        }
+
+        pmm_mark_used_range(idx, page_count, 1);
+        pmm_release_range_locked(idx + page_count, end);
+        if (z != (int32_t)highest) {
+            zone->fallback_allocs++;
+        }
+        *out_idx = idx;
+        return 0;
     }
-    ++g_oom_pages;
-    memory_report_oom("alloc_page", PAGE_SIZE);
-    return NULL;
+    return -1;
 }
 
-void* alloc_contiguous_pages(uint32_t page_count, uint32_t align_pages) {
-    if (page_count == 0 || page_count > MAX_PAGES) {
+/*
+ * Contiguous allocations come from a single buddy block of the covering
+ * order, so they are naturally aligned to that order; align_pages is
+ * rounded up to a power of two. Pages past page_count go straight back.
+ */
+static uint32_t memory_zero_pool_drain(void);
+
+static void* pmm_alloc_pages(uint32_t page_count, uint32_t align_pages, memory_zone_t zone, const char *site) {
+    if (page_count == 0 || zone >= MEMORY_ZONE_COUNT) {
         return NULL;
     }
     if (alloc_page_recursion_depth >= MAX_ALLOC_PAGE_RECURSION_DEPTH) {
         ++g_oom_pages;
-        memory_report_oom("alloc_contiguous_pages (recursion limit)", (uint64_t)page_count * PAGE_SIZE);
+        memory_report_oom(site, (uint64_t)page_count * PAGE_SIZE);
         return NULL;
     }
     if (align_pages == 0) {
         align_pages = 1;
     }
 
+    uint64_t align = 1ull << pmm_order_for(align_pages);
+    uint64_t idx = 0;
     uint64_t irq_flags = irq_save_disable();
-    spinlock_lock(&page_lock);
-
-    uint32_t limit = (uint32_t)(MAX_PAGES - page_count);
-    for (uint32_t start = 0; start <= limit; ++start) {
-        if ((start % align_pages) != 0) {
-            continue;
-        }
-
-        uint32_t run = 0;
-        while (run < page_count && page_bitmap[start + run] == 0) {
-            ++run;
-        }
-        if (run != page_count) {
-            start += run;
-            continue;
-        }
-
-        for (uint32_t i = 0; i < page_count; ++i) {
-            page_bitmap[start + i] = 1;
-        }
-        page_alloc_hint = (start + page_count) % MAX_PAGES;
-        spinlock_unlock(&page_lock);
-        irq_restore(irq_flags);
-        return (void *)((uintptr_t)start * PAGE_SIZE);
+    spinlock_lock_stats(&page_lock, &page_lock_stats);
+    int rc = pmm_alloc_locked(page_count, align, zone, 1, &idx);
+    spinlock_unlock_stats(&page_lock, &page_lock_stats);
+    irq_restore(irq_flags);
+    if (rc == 0) {
+        return (void *)(uintptr_t)(idx * PAGE_SIZE);
     }
 
-    spinlock_unlock(&page_lock);
-    irq_restore(irq_flags);
+    if (memory_zero_pool_drain() > 0) {
+        return pmm_alloc_pages(page_count, align_pages, zone, site);
+    }
 
     ++alloc_page_recursion_depth;
     int reclaim_result = paging_swap_reclaim_one_page();
     --alloc_page_recursion_depth;
 
     if (reclaim_result > 0) {
-        return alloc_contiguous_pages(page_count, align_pages);
+        return pmm_alloc_pages(page_count, align_pages, zone, site);
+    }
+
+    irq_flags = irq_save_disable();
+    spinlock_lock_stats(&page_lock, &page_lock_stats);
+    rc = pmm_alloc_locked(page_count, align, zone, 0, &idx);
+    if (rc != 0) {
+        pmm_zones[zone].failed_allocs++;
     }
+    spinlock_unlock_stats(&page_lock, &page_lock_stats);
+    irq_restore(irq_flags);
+    if (rc == 0) {
+        return (void *)(uintptr_t)(idx * PAGE_SIZE);
+    }
+
     ++g_oom_pages;
-    memory_report_oom("alloc_contiguous_pages", (uint64_t)page_count * PAGE_SIZE);
+    memory_report_oom(site, (uint64_t)page_count * PAGE_SIZE);
     return NULL;
 }
 
+void* alloc_page(void) {
+    return pmm_alloc_pages(1, 1, MEMORY_ZONE_NORMAL, "alloc_page");
+}
+
+void* alloc_page_zone(memory_zone_t zone) {
+    return pmm_alloc_pages(1, 1, zone, "alloc_page");
+}
+
+void* alloc_contiguous_pages(uint32_t page_count, uint32_t align_pages) {
+    return pmm_alloc_pages(page_count, align_pages, MEMORY_ZONE_NORMAL, "alloc_contiguous_pages");
+}
+
+void* alloc_contiguous_pages_zone(uint32_t page_count, uint32_t align_pages, memory_zone_t zone) {
+    return pmm_alloc_pages(page_count, align_pages, zone, "alloc_contiguous_pages");
+}
+
+/* A shared page only loses one owner; the last free_page releases it. */
 void free_page(void* addr) {
     if (addr == NULL) return;
 
-    uintptr_t page_num = (uintptr_t)addr / PAGE_SIZE;
+    uint64_t idx = (uintptr_t)addr / PAGE_SIZE;
     uint64_t irq_flags = irq_save_disable();
-    spinlock_lock(&page_lock);
-    if (page_num < MAX_PAGES) {
-        page_bitmap[page_num] = 0;
-        if (page_num < page_alloc_hint) {
-            page_alloc_hint = (uint32_t)page_num;
+    spinlock_lock_stats(&page_lock, &page_lock_stats);
+    if (pmm_page_is_used(idx)) {
+        if (pmm_share_counts[idx] != 0) {
+            pmm_share_counts[idx]--;
+        } else {
+            pmm_clear_bit(pmm_used_bits, idx);
+            pmm_free_block_locked(idx, 0);
         }
     }
-    spinlock_unlock(&page_lock);
+    spinlock_unlock_stats(&page_lock, &page_lock_stats);
     irq_restore(irq_flags);
 }
 
@@ -608,28 +1698,175 @@ void free_contiguous_pages(void* addr, uint32_t page_count) {
         return;
     }
 
-    uintptr_t start_page = (uintptr_t)addr / PAGE_SIZE;
-    if (start_page >= MAX_PAGES) {
-        return;
+    uint64_t start = (uintptr_t)addr / PAGE_SIZE;
+    uint64_t irq_flags = irq_save_disable();
+    spinlock_lock_stats(&page_lock, &page_lock_stats);
+    for (uint64_t idx = start; idx < start + page_count && idx < pmm_page_count; ++idx) {
+        if (pmm_page_is_used(idx)) {
+            pmm_clear_bit(pmm_used_bits, idx);
+            pmm_free_block_locked(idx, 0);
+        }
+    }
+    spinlock_unlock_stats(&page_lock, &page_lock_stats);
+    irq_restore(irq_flags);
+}
+
+/* Add an owner to an allocated page; each owner later calls free_page once. */
+int memory_page_share(void* addr) {
+    uint64_t idx = (uintptr_t)addr / PAGE_SIZE;
+    int rc = -1;
+    uint64_t irq_flags = irq_save_disable();
+    spinlock_lock_stats(&page_lock, &page_lock_stats);
+    if (pmm_page_is_used(idx) && pmm_share_counts[idx] != 0xFFFFu) {
+        pmm_share_counts[idx]++;
+        rc = 0;
     }
+    spinlock_unlock_stats(&page_lock, &page_lock_stats);
+    irq_restore(irq_flags);
+    return rc;
+}
 
+/* Number of owners besides the caller; 0 means the page is exclusive. */
+uint32_t memory_page_share_count(void* addr) {
+    uint64_t idx = (uintptr_t)addr / PAGE_SIZE;
+    uint32_t count = 0;
     uint64_t irq_flags = irq_save_disable();
-    spinlock_lock(&page_lock);
+    spinlock_lock_stats(&page_lock, &page_lock_stats);
+    if (pmm_page_is_used(idx)) {
+        count = pmm_share_counts[idx];
+    }
+    spinlock_unlock_stats(&page_lock, &page_lock_stats);
+    irq_restore(irq_flags);
+    return count;
+}
 
-    uint32_t max_pages = (uint32_t)(MAX_PAGES - start_page);
-    if (page_count > max_pages) {
-        page_count = max_pages;
+/* Streaming stores bypass the cache; callers fence once per batch. */
+static void memory_zero_page_nt(void *page) {
+    uint64_t *p = (uint64_t *)page;
+    for (uint32_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i += 8u) {
+        __asm__ volatile (
+            "movnti %1, 0(%0)\n\t"
+            "movnti %1, 8(%0)\n\t"
+            "movnti %1, 16(%0)\n\t"
+            "movnti %1, 24(%0)\n\t"
+            "movnti %1, 32(%0)\n\t"
+            "movnti %1, 40(%0)\n\t"
+            "movnti %1, 48(%0)\n\t"
+            "movnti %1, 56(%0)"
+            :
+            : "r"(p + i), "r"(0ull)
+            : "memory");
     }
+}
 
-    for (uint32_t i = 0; i < page_count; ++i) {
-        page_bitmap[start_page + i] = 0;
+static void memory_zero_page(void *page) {
+    uint64_t count = PAGE_SIZE / sizeof(uint64_t);
+    __asm__ volatile ("rep stosq"
+                      : "+D"(page), "+c"(count)
+                      : "a"(0ull)
+                      : "memory");
+}
+
+uint32_t memory_zero_pool_refill(uint32_t budget) {
+    if (pmm_page_count == 0 || zero_pool_count >= ZERO_POOL_CAPACITY) {
+        return 0;
     }
-    if (start_page < page_alloc_hint) {
-        page_alloc_hint = (uint32_t)start_page;
+    if (__atomic_exchange_n(&zero_pool_refilling, 1, __ATOMIC_ACQUIRE) != 0) {
+        return 0;
     }
 
-    spinlock_unlock(&page_lock);
+    uint32_t added = 0;
+    while (added < budget && zero_pool_count < ZERO_POOL_CAPACITY) {
+        uint64_t idx = 0;
+        uint64_t irq_flags = irq_save_disable();
+        spinlock_lock_stats(&page_lock, &page_lock_stats);
+        int rc = pmm_alloc_locked(1, 1, MEMORY_ZONE_NORMAL, 1, &idx);
+        spinlock_unlock_stats(&page_lock, &page_lock_stats);
+        irq_restore(irq_flags);
+        if (rc != 0) {
+            break;
+        }
+
+        void *page = (void *)(uintptr_t)(idx * PAGE_SIZE);
+        memory_zero_page_nt(page);
+        __asm__ volatile ("sfence" ::: "memory");
+
+        irq_flags = irq_save_disable();
+        spinlock_lock(&zero_pool_lock);
+        if (zero_pool_count < ZERO_POOL_CAPACITY) {
+            zero_pool[zero_pool_count++] = page;
+            zero_pool_refilled++;
+            page = NULL;
+        }
+        spinlock_unlock(&zero_pool_lock);
+        irq_restore(irq_flags);
+        if (page != NULL) {
+            free_page(page);
+            break;
+        }
+        added++;
+    }
+
+    __atomic_store_n(&zero_pool_refilling, 0, __ATOMIC_RELEASE);
+    return added;
+}
+
+void memory_zero_pool_tick(void) {
+    if (zero_pool_count < ZERO_POOL_LOW) {
+        memory_zero_pool_refill(OS_CONFIG_ZERO_POOL_REFILL_PER_TICK);
+    }
+}
+
+static uint32_t memory_zero_pool_drain(void) {
+    uint64_t irq_flags = irq_save_disable();
+    spinlock_lock(&zero_pool_lock);
+    uint32_t count = zero_pool_count;
+    while (zero_pool_count > 0) {
+        free_page(zero_pool[--zero_pool_count]);
+    }
+    zero_pool_drained += count;
+    spinlock_unlock(&zero_pool_lock);
     irq_restore(irq_flags);
+    return count;
+}
+
+void* alloc_zeroed_page(void) {
+    void *page = NULL;
+    uint64_t irq_flags = irq_save_disable();
+    spinlock_lock(&zero_pool_lock);
+    if (zero_pool_count > 0) {
+        page = zero_pool[--zero_pool_count];
+        zero_pool_hits++;
+    } else {
+        zero_pool_misses++;
+    }
+    spinlock_unlock(&zero_pool_lock);
+    irq_restore(irq_flags);
+    if (page != NULL) {
+        return page;
+    }
+
+    page = alloc_page();
+    if (page != NULL) {
+        memory_zero_page(page);
+    }
+    return page;
+}
+
+void memory_print_zero_pool_stats(void) {
+    serial_write_string("[OS] [Memory] Zero pool: cached=");
+    serial_write_uint32(zero_pool_count);
+    serial_write_string("/");
+    serial_write_uint32(ZERO_POOL_CAPACITY);
+    serial_write_string(" hits=");
+    serial_write_uint64(zero_pool_hits);
+    serial_write_string(" misses=");
+    serial_write_uint64(zero_pool_misses);
+    serial_write_string(" refilled=");
+    serial_write_uint64(zero_pool_refilled);
+    serial_write_string(" drained=");
+    serial_write_uint64(zero_pool_drained);
+    serial_write_string("\n");
 }
 
 static void memory_dump_hex_byte(uint8_t value)
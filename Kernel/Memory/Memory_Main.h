@@ -4,6 +4,28 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#include "../Sync/Spinlock.h"
+
+/*
+ * Physical memory zones, lowest first. Allocators take the highest zone the
+ * caller can use and fall back to lower ones.
+ */
+typedef enum {
+    MEMORY_ZONE_DMA = 0,    /* below 16 MiB (legacy ISA DMA) */
+    MEMORY_ZONE_DMA32,      /* below 4 GiB (32-bit DMA masters) */
+    MEMORY_ZONE_NORMAL,     /* everything else */
+    MEMORY_ZONE_COUNT
+} memory_zone_t;
+
+typedef struct {
+    spinlock_stats_t heap_lock;
+    spinlock_stats_t page_lock;
+    uint64_t magazine_hits;
+    uint64_t magazine_refills;
+    uint64_t magazine_flushes;
+    uint64_t remote_frees;
+} memory_lock_stats_t;
+
 void* kmalloc(uint64_t size);
 void* kmalloc_sensitive(uint64_t size);
 void kfree(void* ptr);
@@ -17,10 +39,24 @@ void init_physical_memory(void *memory_map, size_t map_size, size_t desc_size);
 void* alloc_page(void);
 void free_page(void* addr);
 void* alloc_contiguous_pages(uint32_t page_count, uint32_t align_pages);
+void* alloc_page_zone(memory_zone_t zone);
+void* alloc_contiguous_pages_zone(uint32_t page_count, uint32_t align_pages, memory_zone_t zone);
 void free_contiguous_pages(void* addr, uint32_t page_count);
+void* alloc_zeroed_page(void);
+int memory_page_share(void* addr);
+uint32_t memory_page_share_count(void* addr);
+uint32_t memory_zero_pool_refill(uint32_t budget);
+void memory_zero_pool_tick(void);
+void memory_print_zero_pool_stats(void);
+uint64_t memory_get_phys_limit(void);
+uint64_t memory_get_free_page_count(void);
+uint64_t memory_get_total_page_count(void);
+void memory_print_zone_info(void);
 
 uint32_t get_free_memory(void);
 uint32_t get_used_memory(void);
+void memory_get_lock_stats(memory_lock_stats_t *out);
+void memory_print_lock_stats(void);
 void memory_dump_virtual(const void *addr, uint32_t bytes);
 void memory_dump_physical(uint64_t phys_addr, uint32_t bytes);
 
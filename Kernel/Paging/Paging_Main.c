@@ -1,8 +1,12 @@
 #include "../DefaultLibrary/DefaultLibrary.h"
 
 #include "Paging_Main.h"
+#include "Swap_Device.h"
+#include "ZSwap.h"
+#include "TLB_Shootdown.h"
+#include "../KernelConfig.h"
 #include "../Memory/Memory_Main.h"
-#include "../ProcessManager/ProcessManager.h"
+#include "../SMP/SMP_Main.h"
 #include "../Serial.h"
 #include "../Sync/Spinlock.h"
 
@@ -15,19 +19,51 @@
 #define MMIO_WINDOW_BASE 0x00000000F0000000ULL
 #define MMIO_WINDOW_SLOTS 16
 #define MAX_PROCESS_SPACES 32
+/* Image, heap, stack and mmaps, plus the two splits a guarded thread stack costs. */
+#define PAGING_MAX_VMAS (32 + 2 * OS_CONFIG_PROCESS_MAX_COUNT)
 #define PAGING_BOOT_IDENTITY_GB 4ULL
-#define SWAP_SLOT_COUNT 128
 #define SWAP_TRACK_MAX 4096
+#define SWAP_TRACK_HASH_SIZE (SWAP_TRACK_MAX * 2)
+#define SWAP_TRACK_NIL 0u
+#define SWAP_TRACK_NO_SPACE 0xFFu
+#define SWAP_BATCH_PAGES OS_CONFIG_SWAP_BATCH_PAGES
 #define PAGE_SWAP (1ULL << 9)
+#define PAGE_ZSWAP (1ULL << 10)
+#define PAGE_COW   (1ULL << 11)
+#define SWAP_PTE_SLOT_SHIFT 12
+#define SWAP_PTE_SLOT(pte) ((uint32_t)(((pte) & PAGE_MASK) >> SWAP_PTE_SLOT_SHIFT))
+/* A swapped copy is private, so a copy-on-write page comes back writable. */
+#define SWAP_PTE_MAKE(slot, flags) \
+    (((uint64_t)(slot) << SWAP_PTE_SLOT_SHIFT) | PAGE_SWAP | ((flags) & (PAGE_USER | PAGE_RW)) | \
+     (((flags) & PAGE_COW) != 0 ? PAGE_RW : 0))
+#define SWAP_TRACK_RESIDENT 0u
+#define SWAP_TRACK_ON_DISK  1u
+#define SWAP_TRACK_IN_ZSWAP 2u
 
 #define PAGE_SIZE_BYTES 4096ULL
 
+/* PCID 0 tags the kernel's own tables; process space i runs as PCID i + 1. */
+#define CR3_PCID_MASK   0xFFFULL
+#define CR3_NOFLUSH     (1ULL << 63)
+#define CR4_PCIDE       (1ULL << 17)
+#define INVPCID_ADDRESS 0ULL
+#define INVPCID_CONTEXT 1ULL
+
 typedef struct {
     uint8_t used;
     uint64_t cr3;
     uint64_t *pml4;
     uint64_t *pdpt;
+    /* Private directories; NULL while the PDPT entry still points at the kernel's. */
     uint64_t *pd_tables[MAX_PDPT_ENTRIES];
+    uint16_t track_head;
+    /* CPUs whose TLB may hold stale entries under this space's PCID; each flushes on its next switch in. */
+    volatile uint32_t tlb_stale_cpus;
+    /* Sorted by start, non-overlapping. */
+    uint32_t vma_count;
+    paging_vma_t vmas[PAGING_MAX_VMAS];
+    /* Held by the demand, COW and swap fault paths while they populate PTEs. */
+    spinlock_t fault_lock;
 } paging_space_t;
 
 static uint64_t g_kernel_pml4[512] __attribute__((aligned(4096)));
@@ -39,33 +75,61 @@ static uint64_t g_kernel_identity_entries = PAGING_BOOT_IDENTITY_GB;
 static paging_space_t g_process_spaces[MAX_PROCESS_SPACES];
 static spinlock_t g_paging_space_lock;
 
-typedef struct {
-    uint8_t used;
-    uint8_t reserved[7];
-    uint8_t data[PAGE_SIZE_BYTES];
-} swap_slot_t;
-
+/*
+ * slot_valid: the page is resident but slot_index still holds an identical
+ * copy (it was swapped in and has not been dirtied), so eviction can drop
+ * the frame without writing it again.
+ *
+ * Tracks live in a fixed pool. g_swap_track_hash is an open-addressed
+ * (linear probing) index keyed by (cr3, virt_addr), and every track is also
+ * on its address space's list so teardown only visits its own pages. Hash
+ * entries and list links hold pool index + 1; SWAP_TRACK_NIL is empty.
+ */
 typedef struct {
     uint8_t used;
     uint8_t swapped;
-    uint16_t reserved0;
+    uint8_t slot_valid;
+    uint8_t space_index;
     uint32_t slot_index;
     uint64_t cr3;
     uint64_t virt_addr;
+    uint16_t space_prev;
+    uint16_t space_next;
 } swap_track_t;
 
-static swap_slot_t g_swap_slots[SWAP_SLOT_COUNT];
 static swap_track_t g_swap_tracks[SWAP_TRACK_MAX];
+static uint16_t g_swap_track_hash[SWAP_TRACK_HASH_SIZE];
+static uint16_t g_swap_track_free = SWAP_TRACK_NIL;
 static uint8_t g_swap_enabled = 1;
-static spinlock_t g_swap_lock;
-
-static inline uint64_t read_cr3(void)
+static volatile int g_swap_io_busy = 0;
+static uint32_t g_swap_clock_hand = 0;
+static uint64_t g_swap_fault_count[2];
+static uint64_t g_swap_fault_cycles[2];
+static uint64_t g_demand_fault_count = 0;
+static uint64_t g_huge_fault_count = 0;
+static uint64_t g_huge_fault_fallbacks = 0;
+static uint64_t g_huge_page_splits = 0;
+static uint64_t g_cow_fault_copies = 0;
+static uint64_t g_cow_fault_reuses = 0;
+static uint8_t g_pcid_enabled = 0;
+static uint8_t g_invpcid_supported = 0;
+static uint64_t g_cr3_switches = 0;
+static uint64_t g_cr3_switch_flushes = 0;
+static uint8_t g_swap_staging[SWAP_BATCH_PAGES * PAGE_SIZE_BYTES] __attribute__((aligned(4096)));
+
+static inline uint64_t read_cr3_raw(void)
 {
     uint64_t value;
     __asm__ volatile ("mov %%cr3, %0" : "=r"(value));
     return value;
 }
 
+/* Table address only, so callers can compare it against a space's cr3. */
+static inline uint64_t read_cr3(void)
+{
+    return read_cr3_raw() & ~CR3_PCID_MASK;
+}
+
 static inline void write_cr3(uint64_t value)
 {
     __asm__ volatile ("mov %0, %%cr3" :: "r"(value) : "memory");
@@ -84,41 +148,69 @@ static inline void enable_paging(void)
     __asm__ volatile ("mov %0, %%cr0" :: "r"(cr0));
 }
 
+/* Supervisor writes must honour read-only PTEs for copy-on-write to hold. */
+static inline void enable_write_protect(void)
+{
+    uint64_t cr0;
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(cr0));
+    cr0 |= (1ULL << 16);
+    __asm__ volatile ("mov %0, %%cr0" :: "r"(cr0));
+}
+
 static inline void invlpg_addr(uint64_t addr)
 {
     __asm__ volatile ("invlpg (%0)" :: "r"(addr) : "memory");
 }
 
-static void tlb_shootdown_smp_stub(uint64_t vaddr, uint64_t pages)
+static inline void invpcid(uint64_t type, uint64_t pcid, uint64_t addr)
 {
-    (void)vaddr;
-    (void)pages;
+    struct {
+        uint64_t pcid;
+        uint64_t addr;
+    } desc = { pcid, addr };
+    __asm__ volatile ("invpcid %0, %1" :: "m"(desc), "r"(type) : "memory");
 }
 
-static void copy_page_entries(uint64_t *dst, const uint64_t *src)
+/*
+ * PCID lets a CR3 load keep the previous translations of the incoming space.
+ * INVPCID is optional on top of it; without it, changes to an inactive space
+ * are deferred by marking the space stale.
+ */
+static void enable_pcid(void)
 {
-    for (uint32_t i = 0; i < 512; ++i) {
-        dst[i] = src[i];
+    uint32_t eax = 0, ebx = 0, ecx = 0, edx = 0;
+    __asm__ volatile ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1u), "c"(0u));
+    if ((ecx & (1u << 17)) == 0) {
+        serial_write_string("[OS] [Memory] PCID not supported\n");
+        return;
     }
+    __asm__ volatile ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0u), "c"(0u));
+    if (eax >= 7u) {
+        __asm__ volatile ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(7u), "c"(0u));
+        g_invpcid_supported = (ebx & (1u << 10)) != 0 ? 1u : 0u;
+    }
+
+    /* CR4.PCIDE may only be set while CR3[11:0] is zero, i.e. on PCID 0. */
+    uint64_t cr4;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_PCIDE;
+    __asm__ volatile ("mov %0, %%cr4" :: "r"(cr4) : "memory");
+    g_pcid_enabled = 1;
+
+    serial_write_string("[OS] [Memory] PCID enabled");
+    serial_write_string(g_invpcid_supported ? " (INVPCID)\n" : "\n");
 }
 
-static void copy_page_bytes(uint8_t *dst, const uint8_t *src)
+static void copy_page_entries(uint64_t *dst, const uint64_t *src)
 {
-    for (uint64_t i = 0; i < PAGE_SIZE_BYTES; ++i) {
+    for (uint32_t i = 0; i < 512; ++i) {
         dst[i] = src[i];
     }
 }
 
 static uint64_t *alloc_zeroed_page_table(void)
 {
-    uint64_t *table = (uint64_t *)alloc_page();
-    if (table == NULL) {
-        return NULL;
-    }
-    for (uint32_t i = 0; i < 512; ++i) {
-        table[i] = 0;
-    }
-    return table;
+    return (uint64_t *)alloc_zeroed_page();
 }
 
 static paging_space_t *find_space_by_cr3(uint64_t cr3)
@@ -131,6 +223,86 @@ static paging_space_t *find_space_by_cr3(uint64_t cr3)
     return NULL;
 }
 
+/*
+ * Threads of one process share a space and can fault on the same page from
+ * several CPUs, so each fault path checks and fills PTEs under the space's
+ * fault_lock. A CPU spinning for it keeps serving TLB shootdowns, which
+ * the holder may be waiting on while it reclaims memory.
+ */
+static paging_space_t *lock_space_faults(uint64_t cr3)
+{
+    paging_space_t *space = find_space_by_cr3(cr3);
+    if (space == NULL) {
+        return NULL;
+    }
+    while (!spinlock_trylock(&space->fault_lock)) {
+        tlb_shootdown_poll();
+        __asm__ volatile ("pause");
+    }
+    return space;
+}
+
+static void unlock_space_faults(paging_space_t *space)
+{
+    if (space != NULL) {
+        spinlock_unlock(&space->fault_lock);
+    }
+}
+
+static inline uint64_t space_pcid(const paging_space_t *space)
+{
+    return (uint64_t)(space - g_process_spaces) + 1u;
+}
+
+static inline uint32_t tlb_cpu_bit(void)
+{
+    uint32_t cpu = smp_get_current_cpu_id();
+    return (cpu < 32u) ? (1u << cpu) : 1u;
+}
+
+/* Invalidate [virt_addr, virt_addr + pages) of `cr3` here and on every other CPU; pages == 0 is the whole space. */
+static void tlb_invalidate(uint64_t cr3, uint64_t virt_addr, uint64_t pages)
+{
+    paging_space_t *space = find_space_by_cr3(cr3);
+    uint64_t pcid = (g_pcid_enabled && space != NULL) ? space_pcid(space) : 0;
+
+    if (cr3 == read_cr3()) {
+        if (pages == 0) {
+            /* Reload with the flush bit clear, keeping the current PCID. */
+            write_cr3(read_cr3_raw() & ~CR3_NOFLUSH);
+        } else {
+            for (uint64_t i = 0; i < pages; ++i) {
+                invlpg_addr((virt_addr & PAGE_MASK) + i * PAGE_SIZE_BYTES);
+            }
+        }
+    } else if (pcid != 0) {
+        /* Without PCID the next CR3 load drops everything anyway. */
+        if (g_invpcid_supported) {
+            if (pages == 0) {
+                invpcid(INVPCID_CONTEXT, pcid, 0);
+            } else {
+                for (uint64_t i = 0; i < pages; ++i) {
+                    invpcid(INVPCID_ADDRESS, pcid, (virt_addr & PAGE_MASK) + i * PAGE_SIZE_BYTES);
+                }
+            }
+        } else {
+            __atomic_fetch_or(&space->tlb_stale_cpus, tlb_cpu_bit(), __ATOMIC_SEQ_CST);
+        }
+    }
+
+    tlb_shootdown_range(cr3, pcid, (space != NULL) ? &space->tlb_stale_cpus : NULL, virt_addr, pages);
+}
+
+static void tlb_invalidate_page(uint64_t cr3, uint64_t virt_addr)
+{
+    tlb_invalidate(cr3, virt_addr, 1);
+}
+
+static void tlb_flush_space(uint64_t cr3)
+{
+    tlb_invalidate(cr3, 0, 0);
+}
+
 static paging_space_t *find_free_space_slot(void)
 {
     for (uint32_t i = 0; i < MAX_PROCESS_SPACES; ++i) {
@@ -141,6 +313,102 @@ static paging_space_t *find_free_space_slot(void)
     return NULL;
 }
 
+/* Index of the first VMA ending above addr, or vma_count if there is none. */
+static uint32_t vma_lower_bound(const paging_space_t *space, uint64_t addr)
+{
+    uint32_t lo = 0;
+    uint32_t hi = space->vma_count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2u;
+        if (space->vmas[mid].end <= addr) {
+            lo = mid + 1u;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static const paging_vma_t *vma_lookup(const paging_space_t *space, uint64_t addr)
+{
+    uint32_t index = vma_lower_bound(space, addr);
+    if (index < space->vma_count && space->vmas[index].start <= addr) {
+        return &space->vmas[index];
+    }
+    return NULL;
+}
+
+static int vma_insert(paging_space_t *space,
+                      uint64_t start,
+                      uint64_t end,
+                      uint64_t flags,
+                      uint8_t backing)
+{
+    if (space->vma_count >= PAGING_MAX_VMAS) {
+        return -1;
+    }
+
+    uint32_t index = vma_lower_bound(space, start);
+    if (index < space->vma_count && space->vmas[index].start < end) {
+        return -1;
+    }
+
+    for (uint32_t i = space->vma_count; i > index; --i) {
+        space->vmas[i] = space->vmas[i - 1u];
+    }
+    space->vmas[index].start = start;
+    space->vmas[index].end = end;
+    space->vmas[index].flags = flags & PAGE_RW;
+    space->vmas[index].backing = backing;
+    space->vma_count++;
+    return 0;
+}
+
+static void vma_remove_at(paging_space_t *space, uint32_t index)
+{
+    for (uint32_t i = index; i + 1u < space->vma_count; ++i) {
+        space->vmas[i] = space->vmas[i + 1u];
+    }
+    space->vma_count--;
+}
+
+/* Fold vmas[index] into touching neighbours of the same backing and flags. */
+static void vma_merge_around(paging_space_t *space, uint32_t index)
+{
+    paging_vma_t *vma = &space->vmas[index];
+    if (index + 1u < space->vma_count) {
+        const paging_vma_t *next = &space->vmas[index + 1u];
+        if (next->start == vma->end && next->backing == vma->backing && next->flags == vma->flags) {
+            vma->end = next->end;
+            vma_remove_at(space, index + 1u);
+        }
+    }
+    if (index > 0) {
+        paging_vma_t *prev = &space->vmas[index - 1u];
+        if (prev->end == vma->start && prev->backing == vma->backing && prev->flags == vma->flags) {
+            prev->end = vma->end;
+            vma_remove_at(space, index);
+        }
+    }
+}
+
+static int is_kernel_table(const void *table);
+
+/*
+ * Process PDPTs are snapshots of the kernel PDPT, so a kernel directory
+ * that appears later is linked into every live space as well.
+ */
+static void publish_kernel_pdpt_entry(uint64_t pdpt_index)
+{
+    for (uint32_t i = 0; i < MAX_PROCESS_SPACES; ++i) {
+        paging_space_t *space = &g_process_spaces[i];
+        if (space->used && space->pdpt != NULL &&
+            (space->pdpt[pdpt_index] & PAGE_PRESENT) == 0) {
+            space->pdpt[pdpt_index] = g_kernel_pdpt[pdpt_index];
+        }
+    }
+}
+
 static int ensure_kernel_pdpt_entry(uint64_t pdpt_index)
 {
     if (pdpt_index >= MAX_PDPT_ENTRIES) {
@@ -156,6 +424,7 @@ static int ensure_kernel_pdpt_entry(uint64_t pdpt_index)
         g_kernel_pd[pdpt_index][j] = (base + (j * MB2)) | PAGE_PRESENT | PAGE_RW | PAGE_PS;
     }
     g_kernel_pdpt[pdpt_index] = ((uint64_t)g_kernel_pd[pdpt_index]) | PAGE_PRESENT | PAGE_RW;
+    publish_kernel_pdpt_entry(pdpt_index);
 
     if (pdpt_index + 1 > g_kernel_identity_entries) {
         g_kernel_identity_entries = pdpt_index + 1;
@@ -218,10 +487,19 @@ static uint64_t *resolve_pd_table(uint64_t cr3, uint64_t pdpt_index)
         return NULL;
     }
 
-    if (space->pd_tables[pdpt_index] == NULL &&
-        (space->pdpt[pdpt_index] & PAGE_PRESENT) != 0) {
-        space->pd_tables[pdpt_index] =
-            (uint64_t *)(uintptr_t)(space->pdpt[pdpt_index] & PAGE_MASK);
+    uint64_t pdpte = space->pdpt[pdpt_index];
+    if (space->pd_tables[pdpt_index] == NULL && (pdpte & PAGE_PRESENT) != 0) {
+        uint64_t *pd = (uint64_t *)(uintptr_t)(pdpte & PAGE_MASK);
+        if (is_kernel_table(pd)) {
+            uint64_t *copy = alloc_zeroed_page_table();
+            if (copy == NULL) {
+                return NULL;
+            }
+            copy_page_entries(copy, pd);
+            space->pdpt[pdpt_index] = ((uint64_t)copy) | (pdpte & ~PAGE_MASK);
+            pd = copy;
+        }
+        space->pd_tables[pdpt_index] = pd;
     }
     return space->pd_tables[pdpt_index];
 }
@@ -352,13 +630,6 @@ static int resolve_user_pte_slot(uint64_t cr3,
     return 0;
 }
 
-static int is_user_virtual_address(uint64_t virt_addr)
-{
-    return ((virt_addr >= USER_CODE_BASE && virt_addr < USER_CODE_LIMIT) ||
-            (virt_addr >= USER_HEAP_BASE && virt_addr < USER_HEAP_LIMIT) ||
-            (virt_addr >= USER_STACK_BASE && virt_addr < USER_STACK_TOP));
-}
-
 static int resolve_fault_leaf_entry(uint64_t cr3,
                                     uint64_t virt_addr,
                                     uint64_t **pml4e_out,
@@ -404,87 +675,198 @@ static int resolve_fault_leaf_entry(uint64_t cr3,
     return 0;
 }
 
-static int swap_alloc_slot(void)
+static void swap_free_slot(uint32_t slot)
 {
-    spinlock_lock(&g_swap_lock);
-    for (uint32_t i = 0; i < SWAP_SLOT_COUNT; ++i) {
-        if (!g_swap_slots[i].used) {
-            g_swap_slots[i].used = 1;
-            spinlock_unlock(&g_swap_lock);
-            return (int)i;
-        }
+    swap_device_free_slot(slot);
+}
+
+static void swap_track_release_slot(swap_track_t *track)
+{
+    if (track->swapped == SWAP_TRACK_IN_ZSWAP) {
+        zswap_free(track->slot_index);
+    } else if (track->swapped || track->slot_valid) {
+        swap_free_slot(track->slot_index);
     }
-    spinlock_unlock(&g_swap_lock);
-    return -1;
+    track->swapped = 0;
+    track->slot_valid = 0;
+    track->slot_index = 0;
 }
 
-static void swap_free_slot(uint32_t slot)
+static uint32_t swap_track_bucket(uint64_t cr3, uint64_t virt_addr)
 {
-    if (slot >= SWAP_SLOT_COUNT) {
-        return;
+    uint64_t h = (cr3 >> 12) * 0x9E3779B97F4A7C15ULL;
+    h ^= (virt_addr >> 12) * 0xC2B2AE3D27D4EB4FULL;
+    h ^= h >> 29;
+    return (uint32_t)(h & (SWAP_TRACK_HASH_SIZE - 1u));
+}
+
+static inline swap_track_t *swap_track_at(uint16_t link)
+{
+    return &g_swap_tracks[link - 1u];
+}
+
+static inline uint16_t swap_track_link(const swap_track_t *track)
+{
+    return (uint16_t)((track - g_swap_tracks) + 1);
+}
+
+static void swap_tracks_reset(void)
+{
+    memset(g_swap_tracks, 0, sizeof(g_swap_tracks));
+    memset(g_swap_track_hash, 0, sizeof(g_swap_track_hash));
+    for (uint32_t i = 0; i < SWAP_TRACK_MAX; ++i) {
+        g_swap_tracks[i].space_index = SWAP_TRACK_NO_SPACE;
+        g_swap_tracks[i].space_next = (i + 1u < SWAP_TRACK_MAX) ? (uint16_t)(i + 2u) : SWAP_TRACK_NIL;
     }
-    spinlock_lock(&g_swap_lock);
-    g_swap_slots[slot].used = 0;
-    spinlock_unlock(&g_swap_lock);
+    g_swap_track_free = 1u;
 }
 
 static swap_track_t *swap_find_track(uint64_t cr3, uint64_t virt_addr)
 {
-    for (uint32_t i = 0; i < SWAP_TRACK_MAX; ++i) {
-        if (g_swap_tracks[i].used &&
-            g_swap_tracks[i].cr3 == cr3 &&
-            g_swap_tracks[i].virt_addr == virt_addr) {
-            return &g_swap_tracks[i];
+    uint32_t bucket = swap_track_bucket(cr3, virt_addr);
+    for (uint32_t probe = 0; probe < SWAP_TRACK_HASH_SIZE; ++probe) {
+        uint16_t link = g_swap_track_hash[bucket];
+        if (link == SWAP_TRACK_NIL) {
+            return NULL;
         }
+        swap_track_t *track = swap_track_at(link);
+        if (track->cr3 == cr3 && track->virt_addr == virt_addr) {
+            return track;
+        }
+        bucket = (bucket + 1u) & (SWAP_TRACK_HASH_SIZE - 1u);
     }
     return NULL;
 }
 
-static void swap_forget_track(uint64_t cr3, uint64_t virt_addr)
+static void swap_hash_insert(swap_track_t *track)
 {
-    swap_track_t *track = swap_find_track(cr3, virt_addr);
-    if (track == NULL) {
+    uint32_t bucket = swap_track_bucket(track->cr3, track->virt_addr);
+    while (g_swap_track_hash[bucket] != SWAP_TRACK_NIL) {
+        bucket = (bucket + 1u) & (SWAP_TRACK_HASH_SIZE - 1u);
+    }
+    g_swap_track_hash[bucket] = swap_track_link(track);
+}
+
+/* Backward-shift deletion keeps probe chains intact without tombstones. */
+static void swap_hash_remove(swap_track_t *track)
+{
+    const uint32_t mask = SWAP_TRACK_HASH_SIZE - 1u;
+    uint16_t link = swap_track_link(track);
+    uint32_t hole = swap_track_bucket(track->cr3, track->virt_addr);
+    while (g_swap_track_hash[hole] != link) {
+        if (g_swap_track_hash[hole] == SWAP_TRACK_NIL) {
+            return;
+        }
+        hole = (hole + 1u) & mask;
+    }
+
+    uint32_t next = hole;
+    for (;;) {
+        next = (next + 1u) & mask;
+        uint16_t moved = g_swap_track_hash[next];
+        if (moved == SWAP_TRACK_NIL) {
+            break;
+        }
+        const swap_track_t *other = swap_track_at(moved);
+        uint32_t home = swap_track_bucket(other->cr3, other->virt_addr);
+        int stays = (hole <= next) ? (hole < home && home <= next)
+                                   : (hole < home || home <= next);
+        if (stays) {
+            continue;
+        }
+        g_swap_track_hash[hole] = moved;
+        hole = next;
+    }
+    g_swap_track_hash[hole] = SWAP_TRACK_NIL;
+}
+
+static void swap_space_link(swap_track_t *track, uint64_t cr3)
+{
+    track->space_index = SWAP_TRACK_NO_SPACE;
+    track->space_prev = SWAP_TRACK_NIL;
+    track->space_next = SWAP_TRACK_NIL;
+
+    paging_space_t *space = find_space_by_cr3(cr3);
+    if (space == NULL) {
         return;
     }
-    if (track->swapped) {
-        swap_free_slot(track->slot_index);
+
+    track->space_index = (uint8_t)(space - g_process_spaces);
+    track->space_next = space->track_head;
+    if (space->track_head != SWAP_TRACK_NIL) {
+        swap_track_at(space->track_head)->space_prev = swap_track_link(track);
+    }
+    space->track_head = swap_track_link(track);
+}
+
+static void swap_space_unlink(swap_track_t *track)
+{
+    if (track->space_index == SWAP_TRACK_NO_SPACE) {
+        return;
+    }
+    paging_space_t *space = &g_process_spaces[track->space_index];
+    if (track->space_prev != SWAP_TRACK_NIL) {
+        swap_track_at(track->space_prev)->space_next = track->space_next;
+    } else {
+        space->track_head = track->space_next;
+    }
+    if (track->space_next != SWAP_TRACK_NIL) {
+        swap_track_at(track->space_next)->space_prev = track->space_prev;
     }
+    track->space_index = SWAP_TRACK_NO_SPACE;
+    track->space_prev = SWAP_TRACK_NIL;
+    track->space_next = SWAP_TRACK_NIL;
+}
+
+static void swap_track_remove(swap_track_t *track)
+{
+    swap_track_release_slot(track);
+    swap_hash_remove(track);
+    swap_space_unlink(track);
     track->used = 0;
-    track->swapped = 0;
-    track->slot_index = 0;
     track->cr3 = 0;
     track->virt_addr = 0;
+    track->space_next = g_swap_track_free;
+    g_swap_track_free = swap_track_link(track);
+}
+
+static void swap_forget_track(uint64_t cr3, uint64_t virt_addr)
+{
+    swap_track_t *track = swap_find_track(cr3, virt_addr);
+    if (track != NULL) {
+        swap_track_remove(track);
+    }
 }
 
-static void swap_track_page(uint64_t cr3, uint64_t virt_addr)
+static swap_track_t *swap_track_page(uint64_t cr3, uint64_t virt_addr)
 {
     virt_addr &= PAGE_MASK;
     swap_track_t *existing = swap_find_track(cr3, virt_addr);
     if (existing != NULL) {
-        if (existing->swapped) {
-            swap_free_slot(existing->slot_index);
-            existing->swapped = 0;
-            existing->slot_index = 0;
-        }
-        existing->used = 1;
-        return;
+        swap_track_release_slot(existing);
+        return existing;
     }
 
-    for (uint32_t i = 0; i < SWAP_TRACK_MAX; ++i) {
-        if (!g_swap_tracks[i].used) {
-            g_swap_tracks[i].used = 1;
-            g_swap_tracks[i].swapped = 0;
-            g_swap_tracks[i].slot_index = 0;
-            g_swap_tracks[i].cr3 = cr3;
-            g_swap_tracks[i].virt_addr = virt_addr;
-            return;
-        }
+    if (g_swap_track_free == SWAP_TRACK_NIL) {
+        return NULL;
     }
+    swap_track_t *track = swap_track_at(g_swap_track_free);
+    g_swap_track_free = track->space_next;
+
+    track->used = 1;
+    track->swapped = 0;
+    track->slot_valid = 0;
+    track->slot_index = 0;
+    track->cr3 = cr3;
+    track->virt_addr = virt_addr;
+    swap_hash_insert(track);
+    swap_space_link(track, cr3);
+    return track;
 }
 
 void *map_mmio_virt(uint64_t phys_addr)
 {
-    if (phys_addr < (4ULL * GB)) {
+    if (phys_addr < g_kernel_identity_entries * GB) {
         return (void *)(uintptr_t)phys_addr;
     }
 
@@ -514,6 +896,7 @@ void *map_mmio_virt(uint64_t phys_addr)
 
     g_kernel_pdpt[pdpt_index] = ((uint64_t)g_kernel_pd[pdpt_index]) | PAGE_PRESENT | PAGE_RW;
     g_kernel_pd[pdpt_index][pd_index] = phys_base | PAGE_PRESENT | PAGE_RW | PAGE_PS;
+    publish_kernel_pdpt_entry(pdpt_index);
     if (pdpt_index + 1 > g_kernel_identity_entries) {
         g_kernel_identity_entries = pdpt_index + 1;
     }
@@ -534,12 +917,14 @@ void init_paging(void)
     memset(g_kernel_pd, 0, sizeof(g_kernel_pd));
     memset(g_mmio_phys_base, 0, sizeof(g_mmio_phys_base));
     memset(g_process_spaces, 0, sizeof(g_process_spaces));
-    memset(g_swap_slots, 0, sizeof(g_swap_slots));
-    memset(g_swap_tracks, 0, sizeof(g_swap_tracks));
+    swap_tracks_reset();
     spinlock_init(&g_paging_space_lock);
-    spinlock_init(&g_swap_lock);
     g_mmio_slots_used = 0;
     g_kernel_identity_entries = PAGING_BOOT_IDENTITY_GB;
+    uint64_t phys_gb = (memory_get_phys_limit() + GB - 1) / GB;
+    if (phys_gb > g_kernel_identity_entries) {
+        g_kernel_identity_entries = phys_gb;
+    }
     if (g_kernel_identity_entries > MAX_PDPT_ENTRIES) {
         g_kernel_identity_entries = MAX_PDPT_ENTRIES;
     }
@@ -558,6 +943,10 @@ void init_paging(void)
     }
 
     write_cr3((uint64_t)g_kernel_pml4);
+    enable_write_protect();
+    enable_pcid();
+    tlb_shootdown_init(g_pcid_enabled, g_invpcid_supported);
+    tlb_shootdown_set_active_cr3((uint64_t)g_kernel_pml4);
 
     serial_write_string("[OS] [Memory] Success Initialize Paging.\n");
 }
@@ -572,12 +961,65 @@ uint64_t paging_get_active_cr3(void)
     return read_cr3();
 }
 
+/*
+ * With PCID each space keeps its own tagged TLB entries across switches, so
+ * the load sets the no-flush bit unless the space was marked stale while it
+ * was inactive. The lookup is lock-free: it runs from the scheduler.
+ */
 void paging_switch_cr3(uint64_t cr3)
 {
     if (cr3 == 0) {
         return;
     }
-    write_cr3(cr3);
+    g_cr3_switches++;
+    /* Threads of one process share the space; switching between them keeps CR3. */
+    if (cr3 == read_cr3()) {
+        return;
+    }
+    if (!g_pcid_enabled) {
+        g_cr3_switch_flushes++;
+        tlb_shootdown_set_active_cr3(cr3);
+        write_cr3(cr3);
+        return;
+    }
+
+    /* Publish first: a concurrent shootdown then either IPIs us or leaves our stale bit. */
+    tlb_shootdown_set_active_cr3(cr3);
+    paging_space_t *space = find_space_by_cr3(cr3);
+    if (space == NULL) {
+        g_cr3_switch_flushes++;
+        write_cr3(cr3);
+        return;
+    }
+    uint32_t bit = tlb_cpu_bit();
+    uint64_t value = cr3 | space_pcid(space);
+    if ((__atomic_fetch_and(&space->tlb_stale_cpus, ~bit, __ATOMIC_SEQ_CST) & bit) == 0) {
+        value |= CR3_NOFLUSH;
+    } else {
+        g_cr3_switch_flushes++;
+    }
+    write_cr3(value);
+}
+
+/* Makes the next switch to `cr3` start from an empty TLB for that space. */
+void paging_flush_space_tlb(uint64_t cr3)
+{
+    tlb_flush_space(cr3);
+}
+
+int paging_pcid_enabled(void)
+{
+    return g_pcid_enabled;
+}
+
+void paging_print_tlb_stats(void)
+{
+    serial_write_string("[OS] [Memory] CR3 switches: total=");
+    serial_write_uint64(g_cr3_switches);
+    serial_write_string(" flushing=");
+    serial_write_uint64(g_cr3_switch_flushes);
+    serial_write_string(g_pcid_enabled ? " pcid=on\n" : " pcid=off\n");
+    tlb_shootdown_print_stats();
 }
 
 uint64_t paging_create_process_space(void)
@@ -590,6 +1032,9 @@ uint64_t paging_create_process_space(void)
     }
     memset(space, 0, sizeof(*space));
     space->used = 1;
+    spinlock_init(&space->fault_lock);
+    /* A previous owner of this slot may have left entries under its PCID on any CPU. */
+    space->tlb_stale_cpus = 0xFFFFFFFFu;
     paging_space_t *space_ptr = space;
     spinlock_unlock(&g_paging_space_lock);
 
@@ -607,35 +1052,13 @@ uint64_t paging_create_process_space(void)
     copy_page_entries(space_ptr->pml4, g_kernel_pml4);
     copy_page_entries(space_ptr->pdpt, g_kernel_pdpt);
 
+    /*
+     * The PDPT is private but its entries point at the kernel's own page
+     * directories; resolve_pd_table takes a private copy of one only when a
+     * user mapping first needs to change it.
+     */
     space_ptr->pml4[0] = ((uint64_t)space_ptr->pdpt) | PAGE_PRESENT | PAGE_RW | PAGE_USER;
 
-    for (uint64_t i = 0; i < MAX_PDPT_ENTRIES; ++i) {
-        if ((g_kernel_pdpt[i] & PAGE_PRESENT) == 0) {
-            space_ptr->pd_tables[i] = NULL;
-            continue;
-        }
-
-        space_ptr->pd_tables[i] = alloc_zeroed_page_table();
-        if (space_ptr->pd_tables[i] == NULL) {
-            for (uint64_t j = 0; j < MAX_PDPT_ENTRIES; ++j) {
-                if (space_ptr->pd_tables[j] != NULL) {
-                    free_page(space_ptr->pd_tables[j]);
-                    space_ptr->pd_tables[j] = NULL;
-                }
-            }
-            free_page(space_ptr->pml4);
-            free_page(space_ptr->pdpt);
-            spinlock_lock(&g_paging_space_lock);
-            space_ptr->used = 0;
-            spinlock_unlock(&g_paging_space_lock);
-            return 0;
-        }
-
-        copy_page_entries(space_ptr->pd_tables[i], g_kernel_pd[i]);
-
-        space_ptr->pdpt[i] = ((uint64_t)space_ptr->pd_tables[i]) | PAGE_PRESENT | PAGE_RW;
-    }
-
     spinlock_lock(&g_paging_space_lock);
     space_ptr->cr3 = (uint64_t)space_ptr->pml4;
     spinlock_unlock(&g_paging_space_lock);
@@ -657,12 +1080,23 @@ void paging_destroy_process_space(uint64_t cr3)
     paging_space_t space_copy = *space;
     space->used = 0;
     space->cr3 = 0;
+    space->track_head = SWAP_TRACK_NIL;
     spinlock_unlock(&g_paging_space_lock);
 
     if (read_cr3() == cr3) {
+        tlb_shootdown_set_active_cr3((uint64_t)g_kernel_pml4);
         write_cr3((uint64_t)g_kernel_pml4);
     }
 
+    /* Every swapped-out PTE has a track, so dropping the tracks frees all slots. */
+    uint16_t link = space_copy.track_head;
+    while (link != SWAP_TRACK_NIL) {
+        swap_track_t *track = swap_track_at(link);
+        link = track->space_next;
+        track->space_index = SWAP_TRACK_NO_SPACE;
+        swap_track_remove(track);
+    }
+
     for (uint64_t i = 0; i < MAX_PDPT_ENTRIES; ++i) {
         if (space_copy.pd_tables[i] == NULL) {
             continue;
@@ -670,7 +1104,13 @@ void paging_destroy_process_space(uint64_t cr3)
 
         for (uint64_t j = 0; j < 512; ++j) {
             uint64_t pde = space_copy.pd_tables[i][j];
-            if ((pde & PAGE_PRESENT) == 0 || (pde & PAGE_PS) != 0) {
+            if ((pde & PAGE_PRESENT) == 0) {
+                continue;
+            }
+            if ((pde & PAGE_PS) != 0) {
+                if ((pde & PAGE_USER) != 0) {
+                    free_contiguous_pages((void *)(uintptr_t)(pde & PAGE_MASK & ~(MB2 - 1ULL)), 512u);
+                }
                 continue;
             }
 
@@ -680,14 +1120,9 @@ void paging_destroy_process_space(uint64_t cr3)
                 if ((pte & PAGE_USER) == 0) {
                     continue;
                 }
-                uint64_t virt_addr = (i << 30) | (j << 21) | (k << 12);
                 if ((pte & PAGE_PRESENT) != 0) {
                     free_page((void *)(uintptr_t)(pte & PAGE_MASK));
-                } else if ((pte & PAGE_SWAP) != 0) {
-                    uint32_t slot = (uint32_t)((pte & PAGE_MASK) >> 12);
-                    swap_free_slot(slot);
                 }
-                swap_forget_track(cr3, virt_addr);
                 pt[k] = 0;
             }
             free_page(pt);
@@ -701,19 +1136,6 @@ void paging_destroy_process_space(uint64_t cr3)
     if (space_copy.pml4 != NULL) {
         free_page(space_copy.pml4);
     }
-
-    for (uint32_t i = 0; i < SWAP_TRACK_MAX; ++i) {
-        if (g_swap_tracks[i].used && g_swap_tracks[i].cr3 == cr3) {
-            if (g_swap_tracks[i].swapped) {
-                swap_free_slot(g_swap_tracks[i].slot_index);
-            }
-            g_swap_tracks[i].used = 0;
-            g_swap_tracks[i].swapped = 0;
-            g_swap_tracks[i].slot_index = 0;
-            g_swap_tracks[i].cr3 = 0;
-            g_swap_tracks[i].virt_addr = 0;
-        }
-    }
 }
 
 int paging_set_user_access(uint64_t cr3,
@@ -792,12 +1214,11 @@ int paging_set_user_access(uint64_t cr3,
                 return -1;
             }
 
-            void *phys_page = alloc_page();
+            void *phys_page = alloc_zeroed_page();
             if (phys_page == NULL) {
                 free_page(pt);
                 return -1;
             }
-            memset(phys_page, 0, PAGE_SIZE_BYTES);
 
             pt[pt_index] = ((uint64_t)(uintptr_t)phys_page) |
                            PAGE_PRESENT |
@@ -815,11 +1236,10 @@ int paging_set_user_access(uint64_t cr3,
 
             if ((pte & PAGE_PRESENT) == 0 && (pte & PAGE_SWAP) == 0) {
                 if (enable_user) {
-                    void *phys_page = alloc_page();
+                    void *phys_page = alloc_zeroed_page();
                     if (phys_page == NULL) {
                         return -1;
                     }
-                    memset(phys_page, 0, PAGE_SIZE_BYTES);
                     pte = ((uint64_t)(uintptr_t)phys_page) |
                           PAGE_PRESENT |
                           PAGE_RW |
@@ -860,31 +1280,17 @@ int paging_set_user_access(uint64_t cr3,
         }
     }
 
-    if (read_cr3() == cr3)
-        write_cr3(cr3);
+    tlb_flush_space(cr3);
 
     return 0;
 }
 
-int paging_unmap_range(uint64_t cr3, uint64_t start, uint64_t size)
+static int unmap_page_span(uint64_t cr3, uint64_t start, uint64_t end)
 {
-    if (cr3 == 0 || size == 0) {
-        return -1;
-    }
-
-    uint64_t end = start + size;
-    if (end <= start) {
-        return -1;
-    }
-
-    uint64_t aligned_start = start & ~(PAGE_SIZE_BYTES - 1ULL);
-    uint64_t aligned_end = (end + PAGE_SIZE_BYTES - 1ULL) & ~(PAGE_SIZE_BYTES - 1ULL);
-    if (aligned_end < end) return -1;
-
-    for (uint64_t addr = aligned_start; addr < aligned_end; addr += PAGE_SIZE_BYTES) {
-        uint64_t pdpt_index = (addr >> 30) & 0x1FFULL;
-        uint64_t pd_index = (addr >> 21) & 0x1FFULL;
-        uint64_t pt_index = (addr >> 12) & 0x1FFULL;
+    for (uint64_t addr = start; addr < end; addr += PAGE_SIZE_BYTES) {
+        uint64_t pdpt_index = (addr >> 30) & 0x1FFULL;
+        uint64_t pd_index = (addr >> 21) & 0x1FFULL;
+        uint64_t pt_index = (addr >> 12) & 0x1FFULL;
 
         uint64_t *pd_table = resolve_pd_table(cr3, pdpt_index);
         if (pd_table == NULL) {
@@ -893,6 +1299,8 @@ int paging_unmap_range(uint64_t cr3, uint64_t start, uint64_t size)
 
         uint64_t pde = pd_table[pd_index];
         if ((pde & PAGE_PRESENT) == 0) {
+            /* Nothing below an empty PDE; skip to the next 2 MiB. */
+            addr = (addr | (MB2 - 1ULL)) - (PAGE_SIZE_BYTES - 1ULL);
             continue;
         }
 
@@ -909,10 +1317,7 @@ int paging_unmap_range(uint64_t cr3, uint64_t start, uint64_t size)
 
         uint64_t *pt = (uint64_t *)(uintptr_t)(pde & PAGE_MASK);
         uint64_t old_pte = pt[pt_index];
-        if ((old_pte & PAGE_SWAP) != 0 && (old_pte & PAGE_PRESENT) == 0) {
-            uint32_t slot = (uint32_t)((old_pte & PAGE_MASK) >> 12);
-            swap_free_slot(slot);
-        } else if ((old_pte & PAGE_PRESENT) != 0 && (old_pte & PAGE_USER) != 0) {
+        if ((old_pte & PAGE_PRESENT) != 0 && (old_pte & PAGE_USER) != 0) {
             free_page((void *)(uintptr_t)(old_pte & PAGE_MASK));
         }
         swap_forget_track(cr3, addr);
@@ -920,7 +1325,7 @@ int paging_unmap_range(uint64_t cr3, uint64_t start, uint64_t size)
 
         int any_present = 0;
         for (uint64_t i = 0; i < 512; ++i) {
-            if ((pt[i] & PAGE_PRESENT) != 0) {
+            if ((pt[i] & (PAGE_PRESENT | PAGE_SWAP)) != 0) {
                 any_present = 1;
                 break;
             }
@@ -935,9 +1340,59 @@ int paging_unmap_range(uint64_t cr3, uint64_t start, uint64_t size)
         }
     }
 
-    if (read_cr3() == cr3) {
-        write_cr3(cr3);
+    return 0;
+}
+
+/*
+ * In a process space every user mapping lies inside a VMA, so only the
+ * parts of the range that overlap one are walked; holes are skipped
+ * without touching the page tables.
+ */
+int paging_unmap_range(uint64_t cr3, uint64_t start, uint64_t size)
+{
+    if (cr3 == 0 || size == 0) {
+        return -1;
+    }
+
+    uint64_t end = start + size;
+    if (end <= start) {
+        return -1;
     }
+
+    uint64_t aligned_start = start & ~(PAGE_SIZE_BYTES - 1ULL);
+    uint64_t aligned_end = (end + PAGE_SIZE_BYTES - 1ULL) & ~(PAGE_SIZE_BYTES - 1ULL);
+    if (aligned_end < end) return -1;
+
+    if (cr3 == (uint64_t)g_kernel_pml4) {
+        if (unmap_page_span(cr3, aligned_start, aligned_end) < 0) {
+            return -1;
+        }
+    } else {
+        uint64_t addr = aligned_start;
+        while (addr < aligned_end) {
+            spinlock_lock(&g_paging_space_lock);
+            paging_space_t *space = find_space_by_cr3(cr3);
+            if (space == NULL) {
+                spinlock_unlock(&g_paging_space_lock);
+                return -1;
+            }
+            uint32_t index = vma_lower_bound(space, addr);
+            if (index >= space->vma_count || space->vmas[index].start >= aligned_end) {
+                spinlock_unlock(&g_paging_space_lock);
+                break;
+            }
+            uint64_t span_start = space->vmas[index].start > addr ? space->vmas[index].start : addr;
+            uint64_t span_end = space->vmas[index].end < aligned_end ? space->vmas[index].end : aligned_end;
+            spinlock_unlock(&g_paging_space_lock);
+
+            if (unmap_page_span(cr3, span_start, span_end) < 0) {
+                return -1;
+            }
+            addr = span_end;
+        }
+    }
+
+    tlb_flush_space(cr3);
     return 0;
 }
 
@@ -974,10 +1429,16 @@ void *pmm_alloc_pages(size_t num_pages)
     return alloc_contiguous_pages(num_pages, 1);
 }
 
-int paging_map_user_page(uint64_t cr3,
+/*
+ * With `replace`, a frame already mapped at virt_addr is released first.
+ * Without it an existing present or swapped entry is left alone and 1 is
+ * returned, so a fault path never frees a frame another thread filled.
+ */
+static int map_user_page(uint64_t cr3,
                          uint64_t virt_addr,
                          uint64_t phys_addr,
-                         uint64_t flags)
+                         uint64_t flags,
+                         int replace)
 {
     if (cr3 == 0) {
         return -1;
@@ -1060,31 +1521,238 @@ int paging_map_user_page(uint64_t cr3,
     }
 
     uint64_t old_pte = pt[i1];
+    if (!replace && (old_pte & (PAGE_PRESENT | PAGE_SWAP)) != 0) {
+        return 1;
+    }
     if ((old_pte & PAGE_PRESENT) != 0 && (old_pte & PAGE_USER) != 0) {
         free_page((void *)(uintptr_t)(old_pte & PAGE_MASK));
-    } else if ((old_pte & PAGE_SWAP) != 0 && (old_pte & PAGE_USER) != 0) {
-        uint32_t slot = (uint32_t)((old_pte & PAGE_MASK) >> 12);
-        swap_free_slot(slot);
     }
 
     pt[i1] = (phys_addr & PAGE_MASK) |
              PAGE_PRESENT |
              PAGE_USER |
-             (flags & PAGE_RW);
+             (flags & (PAGE_RW | PAGE_COW));
     swap_track_page(cr3, virt_addr);
 
-    if (cr3 == read_cr3()) {
-        invlpg_addr(virt_addr & PAGE_MASK);
+    tlb_invalidate_page(cr3, virt_addr);
+    return 0;
+}
+
+int paging_map_user_page(uint64_t cr3,
+                         uint64_t virt_addr,
+                         uint64_t phys_addr,
+                         uint64_t flags)
+{
+    return map_user_page(cr3, virt_addr, phys_addr, flags, 1);
+}
+
+int paging_vma_insert(uint64_t cr3,
+                      uint64_t start,
+                      uint64_t size,
+                      uint64_t flags,
+                      uint8_t backing)
+{
+    if (cr3 == 0 || cr3 == (uint64_t)g_kernel_pml4 || size == 0) {
+        return -1;
+    }
+
+    uint64_t end = start + size;
+    if (end <= start) {
+        return -1;
+    }
+
+    uint64_t aligned_start = start & ~(PAGE_SIZE_BYTES - 1ULL);
+    uint64_t aligned_end = (end + PAGE_SIZE_BYTES - 1ULL) & ~(PAGE_SIZE_BYTES - 1ULL);
+    if (aligned_end < end) return -1;
+
+    spinlock_lock(&g_paging_space_lock);
+    paging_space_t *space = find_space_by_cr3(cr3);
+    int rc = (space != NULL) ? vma_insert(space, aligned_start, aligned_end, flags, backing) : -1;
+    spinlock_unlock(&g_paging_space_lock);
+    return rc;
+}
+
+int paging_vma_find(uint64_t cr3, uint64_t addr, paging_vma_t *vma_out)
+{
+    if (cr3 == 0 || vma_out == NULL) {
+        return -1;
+    }
+
+    spinlock_lock(&g_paging_space_lock);
+    paging_space_t *space = find_space_by_cr3(cr3);
+    const paging_vma_t *vma = (space != NULL) ? vma_lookup(space, addr) : NULL;
+    if (vma != NULL) {
+        *vma_out = *vma;
+    }
+    spinlock_unlock(&g_paging_space_lock);
+    return (vma != NULL) ? 0 : -1;
+}
+
+/*
+ * Let the demand-zero part of [start, start + size) be populated with 2 MiB
+ * pages. The range is trimmed to whole 2 MiB blocks and carved out of the
+ * anonymous VMA that holds it. Returns 0 also when nothing is left after
+ * trimming (the caller just keeps 4 KiB pages) and -1 when the range is not
+ * inside one anonymous VMA or no VMA slots are left for the split.
+ */
+int paging_vma_set_huge(uint64_t cr3, uint64_t start, uint64_t size)
+{
+    if (cr3 == 0 || cr3 == (uint64_t)g_kernel_pml4 || size == 0) {
+        return -1;
+    }
+    uint64_t end = start + size;
+    if (end <= start) {
+        return -1;
     }
+#if !OS_CONFIG_USER_HUGE_PAGES
     return 0;
+#else
+    uint64_t huge_start = (start + MB2 - 1ULL) & ~(MB2 - 1ULL);
+    uint64_t huge_end = end & ~(MB2 - 1ULL);
+    if (huge_start < start || huge_end <= huge_start) {
+        return 0;
+    }
+
+    int rc = -1;
+    spinlock_lock(&g_paging_space_lock);
+    paging_space_t *space = find_space_by_cr3(cr3);
+    uint32_t index = (space != NULL) ? vma_lower_bound(space, huge_start) : 0;
+    if (space != NULL && index < space->vma_count &&
+        space->vmas[index].start <= huge_start && huge_end <= space->vmas[index].end) {
+        paging_vma_t vma = space->vmas[index];
+        uint32_t extra = (vma.start < huge_start ? 1u : 0u) + (huge_end < vma.end ? 1u : 0u);
+        if (vma.backing == PAGING_VMA_ANON_HUGE) {
+            rc = 0;
+        } else if (vma.backing == PAGING_VMA_ANON && space->vma_count + extra <= PAGING_MAX_VMAS) {
+            vma_remove_at(space, index);
+            if (vma.start < huge_start) {
+                vma_insert(space, vma.start, huge_start, vma.flags, PAGING_VMA_ANON);
+            }
+            vma_insert(space, huge_start, huge_end, vma.flags, PAGING_VMA_ANON_HUGE);
+            if (huge_end < vma.end) {
+                vma_insert(space, huge_end, vma.end, vma.flags, PAGING_VMA_ANON);
+            }
+            rc = 0;
+        }
+    }
+    spinlock_unlock(&g_paging_space_lock);
+    return rc;
+#endif
 }
 
-int paging_map_user_range_alloc(uint64_t cr3,
-                                uint64_t start,
-                                uint64_t size,
-                                uint64_t flags)
+/*
+ * Carve the page-aligned [start, start + size) out of the anonymous VMA
+ * holding it as a guard (guard != 0), dropping any page already there, or
+ * hand such a guard back to the demand-zero range around it. Returns -1
+ * when the range is not inside one VMA of the expected kind or no VMA
+ * slots are left for the split.
+ */
+int paging_vma_set_guard(uint64_t cr3, uint64_t start, uint64_t size, int guard)
 {
-    if (cr3 == 0 || size == 0) {
+    if (cr3 == 0 || cr3 == (uint64_t)g_kernel_pml4 || size == 0 ||
+        (start & (PAGE_SIZE_BYTES - 1ULL)) != 0 || (size & (PAGE_SIZE_BYTES - 1ULL)) != 0) {
+        return -1;
+    }
+    uint64_t end = start + size;
+    if (end <= start) {
+        return -1;
+    }
+
+    int rc = -1;
+    spinlock_lock(&g_paging_space_lock);
+    paging_space_t *space = find_space_by_cr3(cr3);
+    uint32_t index = (space != NULL) ? vma_lower_bound(space, start) : 0;
+    if (space != NULL && index < space->vma_count &&
+        space->vmas[index].start <= start && end <= space->vmas[index].end) {
+        paging_vma_t vma = space->vmas[index];
+        uint32_t extra = (vma.start < start ? 1u : 0u) + (end < vma.end ? 1u : 0u);
+        if (guard && (vma.backing == PAGING_VMA_ANON || vma.backing == PAGING_VMA_ANON_HUGE) &&
+            space->vma_count + extra <= PAGING_MAX_VMAS) {
+            vma_remove_at(space, index);
+            if (vma.start < start) {
+                vma_insert(space, vma.start, start, vma.flags, vma.backing);
+            }
+            vma_insert(space, start, end, vma.flags, PAGING_VMA_GUARD);
+            if (end < vma.end) {
+                vma_insert(space, end, vma.end, vma.flags, vma.backing);
+            }
+            rc = 0;
+        } else if (!guard && vma.backing == PAGING_VMA_GUARD && vma.start == start && vma.end == end) {
+            /* Rejoin the range it was carved from, which may have been a huge one. */
+            uint8_t backing = PAGING_VMA_ANON;
+            if (index > 0 && space->vmas[index - 1u].end == start &&
+                space->vmas[index - 1u].backing != PAGING_VMA_GUARD) {
+                backing = space->vmas[index - 1u].backing;
+            } else if (index + 1u < space->vma_count && space->vmas[index + 1u].start == end &&
+                       space->vmas[index + 1u].backing != PAGING_VMA_GUARD) {
+                backing = space->vmas[index + 1u].backing;
+            }
+            if (backing == PAGING_VMA_FIXED) {
+                backing = PAGING_VMA_ANON;
+            }
+            space->vmas[index].backing = backing;
+            vma_merge_around(space, index);
+            rc = 0;
+        }
+    }
+    spinlock_unlock(&g_paging_space_lock);
+
+    if (rc == 0 && guard) {
+        rc = paging_unmap_range(cr3, start, size);
+    }
+    return rc;
+}
+
+/*
+ * 1 when [addr, addr + len) is covered by back-to-back VMAs none of which
+ * is a guard, so a user buffer can span e.g. the end of the code image and
+ * the start of the heap but never a hole or a guard page.
+ */
+int paging_vma_range_ok(uint64_t cr3, uint64_t addr, uint64_t len)
+{
+    if (len == 0) {
+        return 1;
+    }
+    if (cr3 == 0 || addr > (0xFFFFFFFFFFFFFFFFULL - len)) {
+        return 0;
+    }
+
+    uint64_t end = addr + len;
+    int ok = 0;
+    spinlock_lock(&g_paging_space_lock);
+    paging_space_t *space = find_space_by_cr3(cr3);
+    if (space != NULL) {
+        uint32_t index = vma_lower_bound(space, addr);
+        uint64_t cursor = addr;
+        while (index < space->vma_count) {
+            const paging_vma_t *vma = &space->vmas[index];
+            if (vma->start > cursor || vma->backing == PAGING_VMA_GUARD) {
+                break;
+            }
+            if (vma->end >= end) {
+                ok = 1;
+                break;
+            }
+            cursor = vma->end;
+            index++;
+        }
+    }
+    spinlock_unlock(&g_paging_space_lock);
+    return ok;
+}
+
+/*
+ * Record [start, start + size) as a demand-zero range of the address space
+ * and drop whatever the space inherited from the kernel identity map there.
+ * No frames are allocated; paging_handle_demand_fault populates pages as
+ * they are touched.
+ */
+int paging_reserve_user_range(uint64_t cr3,
+                              uint64_t start,
+                              uint64_t size,
+                              uint64_t flags)
+{
+    if (cr3 == 0 || cr3 == (uint64_t)g_kernel_pml4 || size == 0) {
         return -1;
     }
 
@@ -1097,46 +1765,404 @@ int paging_map_user_range_alloc(uint64_t cr3,
     uint64_t aligned_end = (end + PAGE_SIZE_BYTES - 1ULL) & ~(PAGE_SIZE_BYTES - 1ULL);
     if (aligned_end < end) return -1;
 
-    for (uint64_t addr = aligned_start; addr < aligned_end; addr += PAGE_SIZE_BYTES) {
-        uint64_t *entry = NULL;
-        if (resolve_user_page_entry(cr3, addr, &entry) == 0) {
+    spinlock_lock(&g_paging_space_lock);
+    paging_space_t *space = find_space_by_cr3(cr3);
+    if (space == NULL ||
+        vma_insert(space, aligned_start, aligned_end, flags, PAGING_VMA_ANON) < 0) {
+        spinlock_unlock(&g_paging_space_lock);
+        return -1;
+    }
+    spinlock_unlock(&g_paging_space_lock);
+
+    /* Whole 2 MiB identity entries are cleared directly; edges go page by page. */
+    uint64_t addr = aligned_start;
+    while (addr < aligned_end) {
+        uint64_t chunk_end = (addr & ~(MB2 - 1ULL)) + MB2;
+        if (chunk_end > aligned_end) {
+            chunk_end = aligned_end;
+        }
+
+        uint64_t pdpt_index = (addr >> 30) & 0x1FFULL;
+        uint64_t pd_index = (addr >> 21) & 0x1FFULL;
+        uint64_t *pd_table = resolve_pd_table(cr3, pdpt_index);
+        if (pd_table != NULL && (pd_table[pd_index] & PAGE_PRESENT) != 0) {
+            if ((addr & (MB2 - 1ULL)) == 0 && chunk_end - addr == MB2 &&
+                (pd_table[pd_index] & PAGE_PS) != 0) {
+                pd_table[pd_index] = 0;
+                if (update_pdpt_user_flag(cr3, pdpt_index, pd_table) < 0) {
+                    return -1;
+                }
+            } else if (paging_unmap_range(cr3, addr, chunk_end - addr) < 0) {
+                return -1;
+            }
+        }
+        addr = chunk_end;
+    }
+
+    tlb_flush_space(cr3);
+    return 0;
+}
+
+/* Kept for callers that map anonymous ranges; pages now arrive on first touch. */
+int paging_map_user_range_alloc(uint64_t cr3,
+                                uint64_t start,
+                                uint64_t size,
+                                uint64_t flags)
+{
+    return paging_reserve_user_range(cr3, start, size, flags);
+}
+
+/*
+ * Back the whole 2 MiB block around `virt_addr` with one zeroed PS entry.
+ * Only done while the block is fully inside the VMA and its directory slot
+ * is still empty; any 4 KiB page already there keeps the block on a page
+ * table. Returns -1 when the block does not qualify or no naturally
+ * aligned 2 MiB run is free, and the caller falls back to a 4 KiB page.
+ */
+static int map_user_huge_page(uint64_t cr3, uint64_t virt_addr, const paging_vma_t *vma)
+{
+    uint64_t base = virt_addr & ~(MB2 - 1ULL);
+    uint64_t pdpt_index = PDPT_INDEX(base);
+    if (base < vma->start || base + MB2 > vma->end || pdpt_index >= MAX_PDPT_ENTRIES) {
+        return -1;
+    }
+
+    uint64_t *pd = resolve_pd_table(cr3, pdpt_index);
+    if (pd == NULL || pd[PD_INDEX(base)] != 0) {
+        return -1;
+    }
+
+    void *block = alloc_contiguous_pages(512u, 512u);
+    if (block == NULL) {
+        g_huge_fault_fallbacks++;
+        return -1;
+    }
+    memset(block, 0, (size_t)MB2);
+
+    pd[PD_INDEX(base)] = (uint64_t)(uintptr_t)block | PAGE_PRESENT | PAGE_USER | PAGE_PS |
+                         (vma->flags & PAGE_RW);
+    if (update_pdpt_user_flag(cr3, pdpt_index, pd) < 0) {
+        pd[PD_INDEX(base)] = 0;
+        free_contiguous_pages(block, 512u);
+        return -1;
+    }
+    tlb_invalidate_page(cr3, base);
+    return 0;
+}
+
+/*
+ * Populate a not-present page inside a reserved range with a zeroed frame.
+ * Returns 1 when the page was mapped, 0 when the address is not demand-zero
+ * (outside every range, or already backed by a frame or swap entry) and -1
+ * when no frame could be allocated.
+ */
+static int demand_fault_locked(uint64_t cr3, uint64_t virt_addr, const paging_vma_t *vma)
+{
+    uint64_t *pte = NULL;
+    if (resolve_user_pte_slot(cr3, virt_addr, &pte) == 0 && pte != NULL &&
+        (*pte & (PAGE_PRESENT | PAGE_SWAP)) != 0) {
+        return 0;
+    }
+
+    if (vma->backing == PAGING_VMA_ANON_HUGE && map_user_huge_page(cr3, virt_addr, vma) == 0) {
+        g_huge_fault_count++;
+        return 1;
+    }
+
+    void *phys_page = alloc_zeroed_page();
+    if (phys_page == NULL) {
+        return -1;
+    }
+    int rc = map_user_page(cr3, virt_addr, (uint64_t)(uintptr_t)phys_page, vma->flags, 0);
+    if (rc != 0) {
+        free_page(phys_page);
+        return (rc < 0) ? -1 : 1;
+    }
+
+    g_demand_fault_count++;
+    return 1;
+}
+
+int paging_handle_demand_fault(uint64_t cr3, uint64_t fault_addr)
+{
+    if (cr3 == 0 || cr3 == (uint64_t)g_kernel_pml4) {
+        return 0;
+    }
+
+    uint64_t virt_addr = fault_addr & PAGE_MASK;
+    paging_vma_t vma;
+    if (paging_vma_find(cr3, virt_addr, &vma) < 0 ||
+        (vma.backing != PAGING_VMA_ANON && vma.backing != PAGING_VMA_ANON_HUGE)) {
+        return 0;
+    }
+
+    paging_space_t *space = lock_space_faults(cr3);
+    int rc = demand_fault_locked(cr3, virt_addr, &vma);
+    unlock_space_faults(space);
+    return rc;
+}
+
+uint64_t paging_get_demand_fault_count(void)
+{
+    return g_demand_fault_count;
+}
+
+void paging_print_huge_page_stats(void)
+{
+    serial_write_string("[OS] [Memory] 2 MiB user pages: faults=");
+    serial_write_uint64(g_huge_fault_count);
+    serial_write_string(" fallbacks=");
+    serial_write_uint64(g_huge_fault_fallbacks);
+    serial_write_string(" splits=");
+    serial_write_uint64(g_huge_page_splits);
+    serial_write_string("\n");
+}
+
+/*
+ * Give the child its own copy of a page the parent has swapped out. Swap
+ * slots and zswap entries belong to exactly one track, so they are never
+ * shared.
+ */
+static int cow_copy_swapped_page(uint64_t child_cr3, uint64_t virt_addr, uint64_t entry)
+{
+    void *copy = alloc_page();
+    if (copy == NULL) {
+        return -1;
+    }
+
+    uint32_t slot = SWAP_PTE_SLOT(entry);
+    int rc = ((entry & PAGE_ZSWAP) != 0) ? zswap_load(slot, copy) : swap_device_read(slot, copy);
+    if (rc != 0 ||
+        paging_map_user_page(child_cr3, virt_addr, (uint64_t)(uintptr_t)copy, entry & PAGE_RW) < 0) {
+        free_page(copy);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Replace a user 2 MiB page by a page table mapping the same frames, which
+ * then become individually swappable and shareable.
+ */
+static int split_user_huge_page(uint64_t cr3, uint64_t virt_addr)
+{
+    uint64_t base = virt_addr & ~(MB2 - 1ULL);
+    uint64_t *pd = resolve_pd_table(cr3, PDPT_INDEX(base));
+    if (pd == NULL || split_huge_page(pd, PD_INDEX(base)) < 0) {
+        return -1;
+    }
+    for (uint64_t i = 0; i < 512; ++i) {
+        swap_track_page(cr3, base + i * PAGE_SIZE_BYTES);
+    }
+    tlb_invalidate_page(cr3, base);
+    g_huge_page_splits++;
+    return 0;
+}
+
+/*
+ * Share every populated page of [start, end) with the child: writable
+ * pages become read-only + PAGE_COW in both spaces and the frame gains an
+ * owner. Empty 2 MiB regions are skipped.
+ */
+static int cow_share_range(uint64_t parent_cr3, uint64_t child_cr3, uint64_t start, uint64_t end)
+{
+    uint64_t addr = start;
+    while (addr < end) {
+        uint64_t *pte = NULL;
+        if (resolve_user_pte_slot(parent_cr3, addr, &pte) < 0 || pte == NULL) {
+            addr = (addr | (MB2 - 1ULL)) + 1ULL;
             continue;
         }
 
-        void *phys_page = alloc_page();
-        if (phys_page == NULL) {
-            return -1;
+        uint64_t entry = *pte;
+        if ((entry & (PAGE_PRESENT | PAGE_USER | PAGE_PS)) == (PAGE_PRESENT | PAGE_USER | PAGE_PS)) {
+            /* Share counts are per 4 KiB frame, so the parent's huge page is split first. */
+            if (split_user_huge_page(parent_cr3, addr) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        if ((entry & PAGE_PRESENT) != 0 && (entry & PAGE_USER) != 0) {
+            void *frame = (void *)(uintptr_t)(entry & PAGE_MASK);
+            if ((entry & (PAGE_RW | PAGE_COW)) != 0) {
+                entry = (entry & ~PAGE_RW) | PAGE_COW;
+                *pte = entry;
+            }
+            if (memory_page_share(frame) < 0) {
+                return -1;
+            }
+            if (paging_map_user_page(child_cr3, addr, (uint64_t)(uintptr_t)frame, entry & PAGE_COW) < 0) {
+                free_page(frame);
+                return -1;
+            }
+        } else if ((entry & PAGE_PRESENT) == 0 && (entry & PAGE_SWAP) != 0) {
+            if (cow_copy_swapped_page(child_cr3, addr, entry) < 0) {
+                return -1;
+            }
         }
-        memset(phys_page, 0, PAGE_SIZE_BYTES);
+        addr += PAGE_SIZE_BYTES;
+    }
+    return 0;
+}
 
-        if (paging_map_user_page(cr3,
-                                 addr,
-                                 (uint64_t)(uintptr_t)phys_page,
-                                 flags) < 0) {
-            free_page(phys_page);
-            return -1;
+/*
+ * Build a copy-on-write clone of a process address space. The child gets
+ * the same VMAs; the ELF image is shared as before, demand-zero ranges
+ * share their populated frames read-only and guard pages stay unmapped.
+ * Returns the child cr3, or 0 on failure.
+ */
+uint64_t paging_clone_process_space(uint64_t parent_cr3)
+{
+    if (parent_cr3 == 0 || parent_cr3 == (uint64_t)g_kernel_pml4) {
+        return 0;
+    }
+
+    /* Too large for a kernel stack once the table is sized for many threads. */
+    paging_vma_t *vmas = (paging_vma_t *)kmalloc(PAGING_MAX_VMAS * sizeof(paging_vma_t));
+    if (vmas == NULL) {
+        return 0;
+    }
+    uint32_t vma_count = 0;
+    spinlock_lock(&g_paging_space_lock);
+    paging_space_t *parent = find_space_by_cr3(parent_cr3);
+    if (parent != NULL) {
+        vma_count = parent->vma_count;
+        for (uint32_t i = 0; i < vma_count; ++i) {
+            vmas[i] = parent->vmas[i];
         }
     }
+    spinlock_unlock(&g_paging_space_lock);
+    if (parent == NULL) {
+        kfree(vmas);
+        return 0;
+    }
 
-    if (cr3 == read_cr3()) {
-        write_cr3(cr3);
+    uint64_t child_cr3 = paging_create_process_space();
+    if (child_cr3 == 0) {
+        kfree(vmas);
+        return 0;
     }
-    return 0;
+
+    int rc = 0;
+    for (uint32_t i = 0; i < vma_count && rc == 0; ++i) {
+        const paging_vma_t *vma = &vmas[i];
+        uint64_t size = vma->end - vma->start;
+        switch (vma->backing) {
+            case PAGING_VMA_FIXED:
+                if (paging_vma_insert(child_cr3, vma->start, size, vma->flags, PAGING_VMA_FIXED) < 0 ||
+                    paging_set_user_access(child_cr3, vma->start, size, 1) < 0) {
+                    rc = -1;
+                }
+                break;
+            case PAGING_VMA_GUARD:
+                if (paging_vma_insert(child_cr3, vma->start, size, 0, PAGING_VMA_GUARD) < 0 ||
+                    paging_unmap_range(child_cr3, vma->start, size) < 0) {
+                    rc = -1;
+                }
+                break;
+            default:
+                if (paging_reserve_user_range(child_cr3, vma->start, size, vma->flags) < 0 ||
+                    (vma->backing == PAGING_VMA_ANON_HUGE &&
+                     paging_vma_set_huge(child_cr3, vma->start, size) < 0) ||
+                    cow_share_range(parent_cr3, child_cr3, vma->start, vma->end) < 0) {
+                    rc = -1;
+                }
+                break;
+        }
+    }
+
+    kfree(vmas);
+
+    /* Parent PTEs lost their write bit; stale writable TLB entries must go. */
+    tlb_flush_space(parent_cr3);
+
+    if (rc < 0) {
+        paging_destroy_process_space(child_cr3);
+        return 0;
+    }
+    return child_cr3;
 }
 
-void paging_swap_set_enabled(int enable)
+/*
+ * Resolve a write to a present PAGE_COW page. The last owner just gets the
+ * write bit back; otherwise the page is copied into a private frame and one
+ * share on the old frame is dropped. Returns 1 when the access can be
+ * retried, 0 when the fault is not copy-on-write and -1 on allocation
+ * failure.
+ */
+static int cow_fault_locked(uint64_t cr3, uint64_t virt_addr)
 {
-    g_swap_enabled = (enable != 0) ? 1u : 0u;
+    uint64_t *pte = NULL;
+    if (resolve_user_pte_slot(cr3, virt_addr, &pte) < 0 || pte == NULL) {
+        return 0;
+    }
+
+    uint64_t entry = *pte;
+    if ((entry & (PAGE_PRESENT | PAGE_USER | PAGE_COW)) != (PAGE_PRESENT | PAGE_USER | PAGE_COW)) {
+        return 0;
+    }
+
+    void *frame = (void *)(uintptr_t)(entry & PAGE_MASK);
+    if (memory_page_share_count(frame) == 0) {
+        *pte = (entry & ~PAGE_COW) | PAGE_RW;
+        g_cow_fault_reuses++;
+    } else {
+        void *copy = alloc_page();
+        if (copy == NULL) {
+            return -1;
+        }
+        /* Allocation may have reclaimed this very page; retry the access then. */
+        if (*pte != entry) {
+            free_page(copy);
+            return 1;
+        }
+        memcpy(copy, frame, PAGE_SIZE_BYTES);
+        *pte = (entry & ~(PAGE_MASK | PAGE_COW)) | (uint64_t)(uintptr_t)copy | PAGE_RW;
+        free_page(frame);
+        g_cow_fault_copies++;
+    }
+
+    tlb_invalidate_page(cr3, virt_addr);
+    return 1;
 }
 
-int paging_swap_reclaim_one_page(void)
+int paging_handle_cow_fault(uint64_t cr3, uint64_t fault_addr)
 {
-    if (!g_swap_enabled) {
+    if (cr3 == 0 || cr3 == (uint64_t)g_kernel_pml4) {
         return 0;
     }
 
-    for (uint32_t i = 0; i < SWAP_TRACK_MAX; ++i) {
-        swap_track_t *track = &g_swap_tracks[i];
+    paging_space_t *space = lock_space_faults(cr3);
+    int rc = cow_fault_locked(cr3, fault_addr & PAGE_MASK);
+    unlock_space_faults(space);
+    return rc;
+}
+
+void paging_print_cow_stats(void)
+{
+    serial_write_string("[OS] [Memory] COW faults: copied=");
+    serial_write_uint64(g_cow_fault_copies);
+    serial_write_string(" reused=");
+    serial_write_uint64(g_cow_fault_reuses);
+    serial_write_string("\n");
+}
+
+void paging_swap_set_enabled(int enable)
+{
+    g_swap_enabled = (enable != 0) ? 1u : 0u;
+}
+
+/*
+ * CLOCK (second chance) over the tracked pages: a page whose Accessed bit
+ * is set gets the bit cleared and is skipped; the hand stops at pages that
+ * were not touched since its last pass. Returns the track to evict and its
+ * PTE, or NULL after two full sweeps without a candidate.
+ */
+static swap_track_t *swap_clock_next_victim(uint64_t **pte_out)
+{
+    for (uint32_t step = 0; step < 2u * SWAP_TRACK_MAX; ++step) {
+        swap_track_t *track = &g_swap_tracks[g_swap_clock_hand];
+        g_swap_clock_hand = (g_swap_clock_hand + 1u) % SWAP_TRACK_MAX;
         if (!track->used || track->swapped) {
             continue;
         }
@@ -1147,50 +2173,145 @@ int paging_swap_reclaim_one_page(void)
         }
 
         uint64_t entry = *pte;
-        if ((entry & PAGE_PRESENT) == 0 || (entry & PAGE_USER) == 0) {
+        if ((entry & PAGE_PRESENT) == 0 || (entry & PAGE_USER) == 0 || (entry & PAGE_PS) != 0) {
             continue;
         }
-        if ((entry & PAGE_PS) != 0) {
+        if ((entry & PAGE_ACCESSED) != 0) {
+            __atomic_fetch_and(pte, ~PAGE_ACCESSED, __ATOMIC_RELAXED);
+            tlb_invalidate_page(track->cr3, track->virt_addr);
             continue;
         }
 
-        int slot = swap_alloc_slot();
-        if (slot < 0) {
-            return 0;
-        }
-
-        uint8_t *src = (uint8_t *)(uintptr_t)(entry & PAGE_MASK);
-        copy_page_bytes(g_swap_slots[(uint32_t)slot].data, src);
-        free_page((void *)(uintptr_t)(entry & PAGE_MASK));
+        *pte_out = pte;
+        return track;
+    }
+    return NULL;
+}
 
-        uint64_t flags = entry & (PAGE_USER | PAGE_RW);
-        *pte = ((uint64_t)(uint32_t)slot << 12) | PAGE_SWAP | flags;
+/*
+ * Evict up to SWAP_BATCH_PAGES pages chosen by the clock. Clean pages that
+ * still have a valid slot are dropped without I/O. Dirty pages are unmapped
+ * and offered to zswap first; pages it rejects are staged and written to
+ * consecutive device slots with a single write. If that write fails they
+ * are mapped back. Returns the number of frames freed.
+ */
+int paging_swap_reclaim_one_page(void)
+{
+    if (!g_swap_enabled || (!swap_device_ready() && !zswap_enabled())) {
+        return 0;
+    }
+    if (__atomic_exchange_n(&g_swap_io_busy, 1, __ATOMIC_ACQUIRE) != 0) {
+        return 0;
+    }
 
-        track->swapped = 1;
-        track->slot_index = (uint32_t)slot;
+    uint32_t first_slot = 0;
+    uint32_t slots = swap_device_alloc_slots(SWAP_BATCH_PAGES, &first_slot);
+
+    swap_track_t *victims[SWAP_BATCH_PAGES];
+    uint64_t *victim_ptes[SWAP_BATCH_PAGES];
+    uint64_t victim_entries[SWAP_BATCH_PAGES];
+    uint32_t candidates = 0;
+    uint32_t dirty = 0;
+    uint32_t dropped = 0;
+    uint32_t compressed = 0;
+
+    /*
+     * Unmap the whole batch first and shoot it down with one round of IPIs;
+     * only once no CPU can still write through a stale entry is the frame
+     * content read or the frame freed. The exchange also catches a Dirty
+     * bit set between the read and the unmap.
+     */
+    tlb_shootdown_batch_begin();
+    for (uint32_t n = 0; n < SWAP_BATCH_PAGES; ++n) {
+        uint64_t *pte = NULL;
+        swap_track_t *track = swap_clock_next_victim(&pte);
+        if (track == NULL) {
+            break;
+        }
+        uint64_t entry = *pte;
+        victims[candidates] = track;
+        victim_ptes[candidates] = pte;
+        victim_entries[candidates] = __atomic_exchange_n(pte, entry & ~PAGE_PRESENT, __ATOMIC_SEQ_CST);
+        candidates++;
+        tlb_invalidate_page(track->cr3, track->virt_addr);
+    }
+    tlb_shootdown_batch_end();
+
+    for (uint32_t n = 0; n < candidates; ++n) {
+        swap_track_t *track = victims[n];
+        uint64_t *pte = victim_ptes[n];
+        uint64_t entry = victim_entries[n];
+        if (track->slot_valid && (entry & PAGE_DIRTY) == 0) {
+            *pte = SWAP_PTE_MAKE(track->slot_index, entry);
+            free_page((void *)(uintptr_t)(entry & PAGE_MASK));
+            track->slot_valid = 0;
+            track->swapped = SWAP_TRACK_ON_DISK;
+            dropped++;
+            continue;
+        }
 
-        if (track->cr3 == read_cr3()) {
-            invlpg_addr(track->virt_addr & PAGE_MASK);
+        uint32_t handle = 0;
+        if (zswap_store((const void *)(uintptr_t)(entry & PAGE_MASK), &handle) == 0) {
+            *pte = SWAP_PTE_MAKE(handle, entry) | PAGE_ZSWAP;
+            free_page((void *)(uintptr_t)(entry & PAGE_MASK));
+            swap_track_release_slot(track);
+            track->swapped = SWAP_TRACK_IN_ZSWAP;
+            track->slot_index = handle;
+            compressed++;
+            continue;
+        }
+        if (dirty == slots) {
+            *pte = entry;
+            continue;
         }
 
-        serial_write_string("[OS] [SWAP] reclaim succeeded\n");
-        return 1;
+        *pte = SWAP_PTE_MAKE(first_slot + dirty, entry);
+        memcpy(g_swap_staging + (uint64_t)dirty * PAGE_SIZE_BYTES,
+               (const void *)(uintptr_t)(entry & PAGE_MASK),
+               PAGE_SIZE_BYTES);
+
+        victims[dirty] = track;
+        victim_ptes[dirty] = pte;
+        victim_entries[dirty] = entry;
+        dirty++;
     }
 
-    return 0;
-}
+    for (uint32_t i = dirty; i < slots; ++i) {
+        swap_free_slot(first_slot + i);
+    }
 
-int paging_handle_swap_fault(uint64_t cr3, uint64_t fault_addr)
-{
-    if (cr3 == 0) {
-        return 0;
+    if (dirty != 0 && swap_device_write(first_slot, g_swap_staging, dirty) != 0) {
+        for (uint32_t i = 0; i < dirty; ++i) {
+            *victim_ptes[i] = victim_entries[i];
+            swap_free_slot(first_slot + i);
+        }
+        serial_write_string("[OS] [SWAP] swap-out write failed\n");
+        dirty = 0;
     }
 
-    uint64_t virt_addr = fault_addr & PAGE_MASK;
-    if (!is_user_virtual_address(virt_addr)) {
-        return 0;
+    for (uint32_t i = 0; i < dirty; ++i) {
+        free_page((void *)(uintptr_t)(victim_entries[i] & PAGE_MASK));
+        swap_track_release_slot(victims[i]);
+        victims[i]->swapped = SWAP_TRACK_ON_DISK;
+        victims[i]->slot_index = first_slot + i;
+    }
+
+    __atomic_store_n(&g_swap_io_busy, 0, __ATOMIC_RELEASE);
+    uint32_t freed = dirty + dropped + compressed;
+    if (freed != 0) {
+        serial_write_string("[OS] [SWAP] reclaimed ");
+        serial_write_uint32(freed);
+        serial_write_string(" pages (");
+        serial_write_uint32(dropped);
+        serial_write_string(" clean, ");
+        serial_write_uint32(compressed);
+        serial_write_string(" compressed)\n");
     }
+    return (int)freed;
+}
 
+static int swap_fault_locked(uint64_t cr3, uint64_t virt_addr)
+{
     uint64_t *pml4e = NULL;
     uint64_t *pdpte = NULL;
     uint64_t *pde = NULL;
@@ -1227,9 +2348,7 @@ int paging_handle_swap_fault(uint64_t cr3, uint64_t fault_addr)
         }
 
         if (repaired_permissions) {
-            if (cr3 == read_cr3()) {
-                invlpg_addr(virt_addr);
-            }
+            tlb_invalidate_page(cr3, virt_addr);
             serial_write_string("[OS] [SWAP] repaired user page permissions\n");
             return 1;
         }
@@ -1240,8 +2359,10 @@ int paging_handle_swap_fault(uint64_t cr3, uint64_t fault_addr)
         return 0;
     }
 
-    uint32_t slot = (uint32_t)((entry & PAGE_MASK) >> 12);
-    if (slot >= SWAP_SLOT_COUNT || !g_swap_slots[slot].used) {
+    uint64_t t0 = spinlock_read_tsc();
+    uint32_t slot = SWAP_PTE_SLOT(entry);
+    uint32_t from_zswap = (entry & PAGE_ZSWAP) != 0 ? 1u : 0u;
+    if (from_zswap ? !zswap_handle_valid(slot) : !swap_device_slot_in_use(slot)) {
         return -1;
     }
 
@@ -1250,9 +2371,13 @@ int paging_handle_swap_fault(uint64_t cr3, uint64_t fault_addr)
         return -1;
     }
 
-    copy_page_bytes((uint8_t *)phys_page, g_swap_slots[slot].data);
-    swap_free_slot(slot);
+    int read_rc = from_zswap ? zswap_load(slot, phys_page) : swap_device_read(slot, phys_page);
+    if (read_rc != 0) {
+        free_page(phys_page);
+        return -1;
+    }
 
+    /* The slot stays reserved; while the PTE stays clean it is the backing copy. */
     uint64_t flags = entry & PAGE_RW;
     *pte = ((uint64_t)(uintptr_t)phys_page) |
            PAGE_PRESENT |
@@ -1260,21 +2385,69 @@ int paging_handle_swap_fault(uint64_t cr3, uint64_t fault_addr)
            flags;
 
     swap_track_t *track = swap_find_track(cr3, virt_addr);
-    if (track != NULL) {
-        track->swapped = 0;
-        track->slot_index = 0;
+    if (from_zswap) {
+        zswap_free(slot);
+        if (track != NULL) {
+            track->swapped = SWAP_TRACK_RESIDENT;
+            track->slot_index = 0;
+        } else {
+            swap_track_page(cr3, virt_addr);
+        }
     } else {
-        swap_track_page(cr3, virt_addr);
+        if (track == NULL) {
+            track = swap_track_page(cr3, virt_addr);
+        }
+        if (track != NULL) {
+            track->swapped = SWAP_TRACK_RESIDENT;
+            track->slot_valid = 1;
+            track->slot_index = slot;
+        } else {
+            swap_free_slot(slot);
+        }
     }
 
-    if (cr3 == read_cr3()) {
-        invlpg_addr(virt_addr);
-    }
+    tlb_invalidate_page(cr3, virt_addr);
 
-    serial_write_string("[OS] [SWAP] page-in succeeded\n");
+    g_swap_fault_count[from_zswap]++;
+    g_swap_fault_cycles[from_zswap] += spinlock_read_tsc() - t0;
     return 1;
 }
 
+int paging_handle_swap_fault(uint64_t cr3, uint64_t fault_addr)
+{
+    if (cr3 == 0) {
+        return 0;
+    }
+
+    uint64_t virt_addr = fault_addr & PAGE_MASK;
+    paging_vma_t vma;
+    if (paging_vma_find(cr3, virt_addr, &vma) < 0 || vma.backing == PAGING_VMA_GUARD) {
+        return 0;
+    }
+
+    paging_space_t *space = lock_space_faults(cr3);
+    int rc = swap_fault_locked(cr3, virt_addr);
+    unlock_space_faults(space);
+    return rc;
+}
+
+void paging_swap_print_stats(void)
+{
+    static const char *const sources[2] = { "disk", "zswap" };
+
+    swap_device_print_stats();
+    zswap_print_stats();
+    for (uint32_t i = 0; i < 2u; ++i) {
+        serial_write_string("[OS] [SWAP] page-in from ");
+        serial_write_string(sources[i]);
+        serial_write_string(": faults=");
+        serial_write_uint64(g_swap_fault_count[i]);
+        serial_write_string(" cycles/fault=");
+        serial_write_uint64((g_swap_fault_count[i] != 0) ? (g_swap_fault_cycles[i] / g_swap_fault_count[i]) : 0);
+        serial_write_string("\n");
+    }
+}
+
 void pmm_free_pages(void *virt, size_t num_pages)
 {
     if (virt == NULL || num_pages == 0) return;
@@ -8,6 +8,8 @@
 #define PAGE_PRESENT (1ULL << 0)
 #define PAGE_RW      (1ULL << 1)
 #define PAGE_USER    (1ULL << 2)
+#define PAGE_ACCESSED (1ULL << 5)
+#define PAGE_DIRTY   (1ULL << 6)
 #define PAGE_PS      (1ULL << 7)
 #define PAGE_SIZE 4096ULL
 #define PAGE_MASK 0xFFFFFFFFFFFFF000ULL
@@ -17,11 +19,27 @@
 #define PD_INDEX(x)   (((x) >> 21) & 0x1FF)
 #define PT_INDEX(x)   (((x) >> 12) & 0x1FF)
 
+/* VMA backing types. */
+#define PAGING_VMA_ANON  0  /* demand-zero, populated on first touch */
+#define PAGING_VMA_FIXED 1  /* mapped up front (the ELF image) */
+#define PAGING_VMA_GUARD 2  /* never mapped; a fault here is an overflow */
+#define PAGING_VMA_ANON_HUGE 3  /* demand-zero, 2 MiB pages where a whole block fits */
+
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+    uint64_t flags;
+    uint8_t backing;
+} paging_vma_t;
+
 void init_paging(void);
 void *map_mmio_virt(uint64_t phys_addr);
 uint64_t paging_get_kernel_cr3(void);
 uint64_t paging_get_active_cr3(void);
 void paging_switch_cr3(uint64_t cr3);
+void paging_flush_space_tlb(uint64_t cr3);
+int paging_pcid_enabled(void);
+void paging_print_tlb_stats(void);
 uint64_t paging_create_process_space(void);
 void paging_destroy_process_space(uint64_t cr3);
 int paging_set_user_access(uint64_t cr3, uint64_t start, uint64_t size, int enable_user);
@@ -31,13 +49,33 @@ int paging_map_user_page(uint64_t cr3,
                          uint64_t virt_addr,
                          uint64_t phys_addr,
                          uint64_t flags);
+int paging_vma_insert(uint64_t cr3,
+                      uint64_t start,
+                      uint64_t size,
+                      uint64_t flags,
+                      uint8_t backing);
+int paging_vma_find(uint64_t cr3, uint64_t addr, paging_vma_t *vma_out);
+int paging_vma_range_ok(uint64_t cr3, uint64_t addr, uint64_t len);
+int paging_reserve_user_range(uint64_t cr3,
+                              uint64_t start,
+                              uint64_t size,
+                              uint64_t flags);
 int paging_map_user_range_alloc(uint64_t cr3,
                                 uint64_t start,
                                 uint64_t size,
                                 uint64_t flags);
+int paging_vma_set_huge(uint64_t cr3, uint64_t start, uint64_t size);
+int paging_vma_set_guard(uint64_t cr3, uint64_t start, uint64_t size, int guard);
+int paging_handle_demand_fault(uint64_t cr3, uint64_t fault_addr);
+uint64_t paging_get_demand_fault_count(void);
+void paging_print_huge_page_stats(void);
+uint64_t paging_clone_process_space(uint64_t parent_cr3);
+int paging_handle_cow_fault(uint64_t cr3, uint64_t fault_addr);
+void paging_print_cow_stats(void);
 void paging_swap_set_enabled(int enable);
 int paging_swap_reclaim_one_page(void);
 int paging_handle_swap_fault(uint64_t cr3, uint64_t fault_addr);
+void paging_swap_print_stats(void);
 void *pmm_alloc_pages(size_t num_pages);
 void pmm_free_pages(void *virt, size_t num_pages);
 uint64_t get_phys_base(void);
@@ -0,0 +1,261 @@
+#include "../DefaultLibrary/DefaultLibrary.h"
+
+#include "Swap_Device.h"
+#include "../Drivers/FileSystem/FAT32/FAT32_Main.h"
+#include "../Memory/Memory_Main.h"
+#include "../Serial.h"
+#include "../Sync/Spinlock.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SWAP_SLOT_BYTES 4096u
+
+static swap_device_t g_swap_device;
+static uint64_t *g_swap_slot_bits = NULL;
+static uint32_t g_swap_slot_hint = 0;
+static uint32_t g_swap_slots_used = 0;
+static uint8_t g_swap_device_ready = 0;
+static spinlock_t g_swap_slot_lock;
+
+static uint64_t g_swap_pages_out = 0;
+static uint64_t g_swap_pages_in = 0;
+static uint64_t g_swap_write_ios = 0;
+static uint64_t g_swap_read_ios = 0;
+static uint64_t g_swap_io_errors = 0;
+
+static FAT32_FILE g_swap_file;
+
+static inline int swap_slot_test(uint32_t slot)
+{
+    return (int)((g_swap_slot_bits[slot >> 6] >> (slot & 63u)) & 1u);
+}
+
+static inline void swap_slot_set(uint32_t slot)
+{
+    g_swap_slot_bits[slot >> 6] |= 1ull << (slot & 63u);
+}
+
+static inline void swap_slot_clear(uint32_t slot)
+{
+    g_swap_slot_bits[slot >> 6] &= ~(1ull << (slot & 63u));
+}
+
+int swap_device_register(const swap_device_t *device)
+{
+    if (device == NULL || device->slot_count == 0 ||
+        device->read_slots == NULL || device->write_slots == NULL) {
+        return -1;
+    }
+    if (g_swap_device_ready) {
+        serial_write_string("[OS] [SWAP] device already registered\n");
+        return -1;
+    }
+
+    uint32_t words = (device->slot_count + 63u) / 64u;
+    uint64_t *bits = (uint64_t *)kmalloc(words * (uint32_t)sizeof(uint64_t));
+    if (bits == NULL) {
+        return -1;
+    }
+    memset(bits, 0, words * sizeof(uint64_t));
+
+    spinlock_init(&g_swap_slot_lock);
+    g_swap_device = *device;
+    g_swap_slot_bits = bits;
+    g_swap_slot_hint = 0;
+    g_swap_slots_used = 0;
+    g_swap_device_ready = 1;
+
+    serial_write_string("[OS] [SWAP] device ");
+    serial_write_string(device->name);
+    serial_write_string(": ");
+    serial_write_uint32(device->slot_count);
+    serial_write_string(" slots\n");
+    return 0;
+}
+
+int swap_device_ready(void)
+{
+    return g_swap_device_ready;
+}
+
+/*
+ * Reserve up to `want` consecutive slots so one batch becomes one write.
+ * Next-fit from the last allocation; returns how many slots were taken
+ * starting at *first_out (0 when the device is full).
+ */
+uint32_t swap_device_alloc_slots(uint32_t want, uint32_t *first_out)
+{
+    if (!g_swap_device_ready || want == 0 || first_out == NULL) {
+        return 0;
+    }
+
+    uint32_t total = g_swap_device.slot_count;
+    uint32_t best_start = 0;
+    uint32_t best_len = 0;
+
+    spinlock_lock(&g_swap_slot_lock);
+    uint32_t slot = g_swap_slot_hint;
+    for (uint32_t scanned = 0; scanned < total && best_len < want;) {
+        if (slot >= total) {
+            slot = 0;
+        }
+        if (swap_slot_test(slot)) {
+            ++slot;
+            ++scanned;
+            continue;
+        }
+
+        uint32_t start = slot;
+        uint32_t len = 0;
+        while (slot < total && len < want && !swap_slot_test(slot)) {
+            ++slot;
+            ++len;
+        }
+        scanned += len;
+        if (len > best_len) {
+            best_start = start;
+            best_len = len;
+        }
+    }
+
+    for (uint32_t i = 0; i < best_len; ++i) {
+        swap_slot_set(best_start + i);
+    }
+    g_swap_slots_used += best_len;
+    if (best_len != 0) {
+        g_swap_slot_hint = best_start + best_len;
+    }
+    spinlock_unlock(&g_swap_slot_lock);
+
+    *first_out = best_start;
+    return best_len;
+}
+
+void swap_device_free_slot(uint32_t slot)
+{
+    if (!g_swap_device_ready || slot >= g_swap_device.slot_count) {
+        return;
+    }
+    spinlock_lock(&g_swap_slot_lock);
+    if (swap_slot_test(slot)) {
+        swap_slot_clear(slot);
+        g_swap_slots_used--;
+    }
+    spinlock_unlock(&g_swap_slot_lock);
+}
+
+int swap_device_slot_in_use(uint32_t slot)
+{
+    if (!g_swap_device_ready || slot >= g_swap_device.slot_count) {
+        return 0;
+    }
+    return swap_slot_test(slot);
+}
+
+int swap_device_read(uint32_t slot, void *page)
+{
+    if (!swap_device_slot_in_use(slot) || page == NULL) {
+        return -1;
+    }
+    g_swap_read_ios++;
+    if (g_swap_device.read_slots(slot, page, 1) != 0) {
+        g_swap_io_errors++;
+        return -1;
+    }
+    g_swap_pages_in++;
+    return 0;
+}
+
+int swap_device_write(uint32_t first_slot, const void *pages, uint32_t count)
+{
+    if (!g_swap_device_ready || pages == NULL || count == 0 ||
+        first_slot >= g_swap_device.slot_count ||
+        count > g_swap_device.slot_count - first_slot) {
+        return -1;
+    }
+    g_swap_write_ios++;
+    if (g_swap_device.write_slots(first_slot, pages, count) != 0) {
+        g_swap_io_errors++;
+        return -1;
+    }
+    g_swap_pages_out += count;
+    return 0;
+}
+
+void swap_device_print_stats(void)
+{
+    if (!g_swap_device_ready) {
+        serial_write_string("[OS] [SWAP] no swap device\n");
+        return;
+    }
+    serial_write_string("[OS] [SWAP] ");
+    serial_write_string(g_swap_device.name);
+    serial_write_string(": used=");
+    serial_write_uint32(g_swap_slots_used);
+    serial_write_string("/");
+    serial_write_uint32(g_swap_device.slot_count);
+    serial_write_string(" out=");
+    serial_write_uint64(g_swap_pages_out);
+    serial_write_string(" in=");
+    serial_write_uint64(g_swap_pages_in);
+    serial_write_string(" write_ios=");
+    serial_write_uint64(g_swap_write_ios);
+    serial_write_string(" read_ios=");
+    serial_write_uint64(g_swap_read_ios);
+    serial_write_string(" errors=");
+    serial_write_uint64(g_swap_io_errors);
+    serial_write_string("\n");
+}
+
+static int swap_file_read_slots(uint32_t first_slot, void *buffer, uint32_t count)
+{
+    return fat32_read_at(&g_swap_file,
+                         first_slot * SWAP_SLOT_BYTES,
+                         (uint8_t *)buffer,
+                         count * SWAP_SLOT_BYTES) ? 0 : -1;
+}
+
+static int swap_file_write_slots(uint32_t first_slot, const void *buffer, uint32_t count)
+{
+    return fat32_write_at(&g_swap_file,
+                          first_slot * SWAP_SLOT_BYTES,
+                          (const uint8_t *)buffer,
+                          count * SWAP_SLOT_BYTES) ? 0 : -1;
+}
+
+/*
+ * Back swap with a preallocated file on the FAT32 volume. The file is
+ * reused across boots when it already has the right size; slot contents
+ * never outlive a boot, so it is not cleared.
+ */
+int swap_file_init(const char *path, uint32_t pages)
+{
+    if (path == NULL || pages == 0 || pages > (0xFFFFFFFFu / SWAP_SLOT_BYTES)) {
+        return -1;
+    }
+
+    if (!fat32_find_file(path, &g_swap_file)) {
+        if (!fat32_creat(path) || !fat32_find_file(path, &g_swap_file)) {
+            serial_write_string("[OS] [SWAP] cannot create swap file\n");
+            return -1;
+        }
+    }
+
+    uint32_t bytes = pages * SWAP_SLOT_BYTES;
+    if (fat32_get_file_size(&g_swap_file) != bytes) {
+        serial_write_string("[OS] [SWAP] sizing swap file\n");
+        if (!fat32_truncate(&g_swap_file, bytes)) {
+            serial_write_string("[OS] [SWAP] cannot size swap file\n");
+            return -1;
+        }
+    }
+
+    swap_device_t device = {
+        .name = path,
+        .slot_count = pages,
+        .read_slots = swap_file_read_slots,
+        .write_slots = swap_file_write_slots,
+    };
+    return swap_device_register(&device);
+}
@@ -0,0 +1,29 @@
+#pragma once
+#ifndef SWAP_DEVICE_H
+#define SWAP_DEVICE_H
+
+#include <stdint.h>
+
+/*
+ * A swap device stores evicted user pages in fixed 4 KiB slots. The backend
+ * only moves whole slots; slot allocation and accounting live here.
+ */
+typedef struct {
+    const char *name;
+    uint32_t slot_count;
+    int (*read_slots)(uint32_t first_slot, void *buffer, uint32_t count);
+    int (*write_slots)(uint32_t first_slot, const void *buffer, uint32_t count);
+} swap_device_t;
+
+int swap_device_register(const swap_device_t *device);
+int swap_device_ready(void);
+uint32_t swap_device_alloc_slots(uint32_t want, uint32_t *first_out);
+void swap_device_free_slot(uint32_t slot);
+int swap_device_slot_in_use(uint32_t slot);
+int swap_device_read(uint32_t slot, void *page);
+int swap_device_write(uint32_t first_slot, const void *pages, uint32_t count);
+void swap_device_print_stats(void);
+
+int swap_file_init(const char *path, uint32_t pages);
+
+#endif
@@ -0,0 +1,326 @@
+#include "TLB_Shootdown.h"
+
+#include "Paging_Main.h"
+#include "../KernelConfig.h"
+#include "../SMP/SMP_Main.h"
+#include "../Serial.h"
+#include "../Sync/Spinlock.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TLB_MAX_CPUS        OS_CONFIG_SMP_MAX_CPUS
+#define TLB_QUEUE_DEPTH     16u
+/* Ranges longer than this are cheaper to drop with one CR3 reload. */
+#define TLB_FLUSH_ALL_PAGES 32u
+#define CR3_PCID_MASK       0xFFFULL
+#define CR3_NOFLUSH         (1ULL << 63)
+#define INVPCID_ADDRESS     0ULL
+#define INVPCID_CONTEXT     1ULL
+
+#if TLB_MAX_CPUS > 32
+#error "TLB shootdown stale masks hold at most 32 CPUs"
+#endif
+
+/* pages == 0 means the whole address space. */
+typedef struct {
+    uint64_t cr3;
+    uint64_t pcid;
+    volatile uint32_t *stale_cpus;
+    uint64_t start;
+    uint64_t pages;
+} tlb_range_t;
+
+/*
+ * A CPU's inbound queue. Senders bump `posted` per range under the lock;
+ * the owner copies the queue out, then publishes the `posted` value it
+ * consumed as `done`, which is what senders wait on.
+ */
+typedef struct {
+    spinlock_t lock;
+    uint32_t count;
+    tlb_range_t ranges[TLB_QUEUE_DEPTH];
+    volatile uint64_t posted;
+    volatile uint64_t done;
+    volatile uint64_t active_cr3;
+} __attribute__((aligned(64))) tlb_cpu_t;
+
+/* Outbound state of a CPU that is initiating shootdowns. */
+typedef struct {
+    uint32_t depth;
+    uint32_t targets;
+    uint64_t wait_for[TLB_MAX_CPUS];
+} tlb_batch_t;
+
+static tlb_cpu_t g_tlb_cpus[TLB_MAX_CPUS];
+static tlb_batch_t g_tlb_batches[TLB_MAX_CPUS];
+static uint8_t g_tlb_pcid_enabled = 0;
+static uint8_t g_tlb_invpcid_supported = 0;
+static uint64_t g_tlb_ranges_queued = 0;
+static uint64_t g_tlb_ranges_merged = 0;
+static uint64_t g_tlb_ipis_sent = 0;
+static uint64_t g_tlb_stale_marks = 0;
+
+static inline uint64_t tlb_irq_save_disable(void)
+{
+    uint64_t flags;
+    __asm__ volatile ("pushfq; popq %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static inline void tlb_irq_restore(uint64_t flags)
+{
+    if (flags & (1ULL << 9)) {
+        __asm__ volatile ("sti" ::: "memory");
+    }
+}
+
+static inline uint32_t tlb_current_cpu(void)
+{
+    uint32_t cpu = smp_get_current_cpu_id();
+    return (cpu < TLB_MAX_CPUS) ? cpu : 0;
+}
+
+static inline uint64_t tlb_read_cr3(void)
+{
+    uint64_t value;
+    __asm__ volatile ("mov %%cr3, %0" : "=r"(value));
+    return value;
+}
+
+static inline void tlb_invpcid(uint64_t type, uint64_t pcid, uint64_t addr)
+{
+    struct {
+        uint64_t pcid;
+        uint64_t addr;
+    } desc = { pcid, addr };
+    __asm__ volatile ("invpcid %0, %1" :: "m"(desc), "r"(type) : "memory");
+}
+
+static void tlb_apply_range(const tlb_range_t *range, uint32_t cpu)
+{
+    uint64_t raw_cr3 = tlb_read_cr3();
+    if ((raw_cr3 & ~CR3_PCID_MASK) == range->cr3) {
+        if (range->pages == 0 || range->pages > TLB_FLUSH_ALL_PAGES) {
+            __asm__ volatile ("mov %0, %%cr3" :: "r"(raw_cr3 & ~CR3_NOFLUSH) : "memory");
+            return;
+        }
+        for (uint64_t i = 0; i < range->pages; ++i) {
+            __asm__ volatile ("invlpg (%0)" :: "r"(range->start + i * PAGE_SIZE) : "memory");
+        }
+        return;
+    }
+
+    /* Switched away since the range was queued; without PCID that already flushed. */
+    if (!g_tlb_pcid_enabled || range->pcid == 0) {
+        return;
+    }
+    if (g_tlb_invpcid_supported) {
+        tlb_invpcid(INVPCID_CONTEXT, range->pcid, 0);
+    } else if (range->stale_cpus != NULL) {
+        __atomic_fetch_or(range->stale_cpus, 1u << cpu, __ATOMIC_SEQ_CST);
+    }
+}
+
+/* Drain this CPU's queue. Runs with interrupts off. */
+static void tlb_service_queue(uint32_t cpu)
+{
+    tlb_cpu_t *self = &g_tlb_cpus[cpu];
+    tlb_range_t ranges[TLB_QUEUE_DEPTH];
+
+    spinlock_lock(&self->lock);
+    uint32_t count = self->count;
+    uint64_t posted = self->posted;
+    for (uint32_t i = 0; i < count; ++i) {
+        ranges[i] = self->ranges[i];
+    }
+    self->count = 0;
+    spinlock_unlock(&self->lock);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        tlb_apply_range(&ranges[i], cpu);
+    }
+    __atomic_store_n(&self->done, posted, __ATOMIC_RELEASE);
+}
+
+/*
+ * Send one IPI to every CPU this batch queued work for and wait until each
+ * has consumed it. Our own queue is drained while spinning so two CPUs
+ * shooting at each other with interrupts off cannot deadlock.
+ */
+static void tlb_batch_flush(uint32_t cpu)
+{
+    tlb_batch_t *batch = &g_tlb_batches[cpu];
+    uint32_t targets = batch->targets;
+    if (targets == 0) {
+        return;
+    }
+    batch->targets = 0;
+
+    for (uint32_t t = 0; t < TLB_MAX_CPUS; ++t) {
+        if ((targets & (1u << t)) != 0 && smp_send_ipi(t, SMP_TLB_SHOOTDOWN_VECTOR) == 0) {
+            __atomic_fetch_add(&g_tlb_ipis_sent, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    uint64_t irq_flags = tlb_irq_save_disable();
+    for (uint32_t t = 0; t < TLB_MAX_CPUS; ++t) {
+        if ((targets & (1u << t)) == 0) {
+            continue;
+        }
+        while (__atomic_load_n(&g_tlb_cpus[t].done, __ATOMIC_ACQUIRE) < batch->wait_for[t]) {
+            if (__atomic_load_n(&g_tlb_cpus[cpu].done, __ATOMIC_ACQUIRE) !=
+                __atomic_load_n(&g_tlb_cpus[cpu].posted, __ATOMIC_ACQUIRE)) {
+                tlb_service_queue(cpu);
+            }
+            __asm__ volatile ("pause");
+        }
+    }
+    tlb_irq_restore(irq_flags);
+}
+
+/* Queue a range for `target`, merging it into an adjacent one for the same space. */
+static void tlb_queue_range(uint32_t cpu, uint32_t target, const tlb_range_t *range)
+{
+    tlb_cpu_t *dst = &g_tlb_cpus[target];
+    tlb_batch_t *batch = &g_tlb_batches[cpu];
+
+    for (;;) {
+        uint64_t irq_flags = tlb_irq_save_disable();
+        spinlock_lock(&dst->lock);
+        int queued = 0;
+        if (dst->count != 0) {
+            tlb_range_t *last = &dst->ranges[dst->count - 1u];
+            if (last->cr3 == range->cr3 && last->pages != 0 && range->pages != 0 &&
+                last->start + last->pages * PAGE_SIZE == range->start) {
+                last->pages += range->pages;
+                queued = 1;
+                __atomic_fetch_add(&g_tlb_ranges_merged, 1, __ATOMIC_RELAXED);
+            }
+        }
+        if (!queued && dst->count < TLB_QUEUE_DEPTH) {
+            dst->ranges[dst->count++] = *range;
+            queued = 1;
+        }
+        if (queued) {
+            dst->posted++;
+            batch->wait_for[target] = dst->posted;
+            batch->targets |= 1u << target;
+        }
+        spinlock_unlock(&dst->lock);
+        tlb_irq_restore(irq_flags);
+
+        if (queued) {
+            return;
+        }
+        /* Queue full: push out what this batch has so far, then retry. */
+        tlb_batch_flush(cpu);
+    }
+}
+
+void tlb_shootdown_init(int pcid_enabled, int invpcid_supported)
+{
+    for (uint32_t i = 0; i < TLB_MAX_CPUS; ++i) {
+        spinlock_init(&g_tlb_cpus[i].lock);
+        g_tlb_cpus[i].count = 0;
+        g_tlb_cpus[i].posted = 0;
+        g_tlb_cpus[i].done = 0;
+        g_tlb_cpus[i].active_cr3 = 0;
+        g_tlb_batches[i].depth = 0;
+        g_tlb_batches[i].targets = 0;
+    }
+    g_tlb_pcid_enabled = pcid_enabled ? 1u : 0u;
+    g_tlb_invpcid_supported = invpcid_supported ? 1u : 0u;
+}
+
+/* Must be published before the CR3 load so senders either see it or we see their stale bit. */
+void tlb_shootdown_set_active_cr3(uint64_t cr3)
+{
+    __atomic_store_n(&g_tlb_cpus[tlb_current_cpu()].active_cr3, cr3, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Invalidate [start, start + pages) of `cr3` on every other CPU; the caller
+ * has already handled the local TLB. The PTE update must be visible first.
+ */
+void tlb_shootdown_range(uint64_t cr3,
+                         uint64_t pcid,
+                         volatile uint32_t *stale_cpus,
+                         uint64_t start,
+                         uint64_t pages)
+{
+    uint32_t cpu_count = smp_get_cpu_count();
+    if (cpu_count <= 1) {
+        return;
+    }
+    if (cpu_count > TLB_MAX_CPUS) {
+        cpu_count = TLB_MAX_CPUS;
+    }
+
+    uint32_t cpu = tlb_current_cpu();
+    tlb_range_t range = { cr3, pcid, stale_cpus, start & PAGE_MASK, pages };
+    memory_barrier_full();
+
+    tlb_shootdown_batch_begin();
+    for (uint32_t target = 0; target < cpu_count; ++target) {
+        if (target == cpu) {
+            continue;
+        }
+        tlb_cpu_t *dst = &g_tlb_cpus[target];
+        if (__atomic_load_n(&dst->active_cr3, __ATOMIC_SEQ_CST) != cr3 &&
+            g_tlb_pcid_enabled && stale_cpus != NULL) {
+            __atomic_fetch_or(stale_cpus, 1u << target, __ATOMIC_SEQ_CST);
+            __atomic_fetch_add(&g_tlb_stale_marks, 1, __ATOMIC_RELAXED);
+        }
+        /* Re-checked after the stale mark: a CPU switching in right now sees one or the other. */
+        if (__atomic_load_n(&dst->active_cr3, __ATOMIC_SEQ_CST) == cr3) {
+            tlb_queue_range(cpu, target, &range);
+            __atomic_fetch_add(&g_tlb_ranges_queued, 1, __ATOMIC_RELAXED);
+        }
+    }
+    tlb_shootdown_batch_end();
+}
+
+void tlb_shootdown_batch_begin(void)
+{
+    g_tlb_batches[tlb_current_cpu()].depth++;
+}
+
+void tlb_shootdown_batch_end(void)
+{
+    uint32_t cpu = tlb_current_cpu();
+    tlb_batch_t *batch = &g_tlb_batches[cpu];
+    if (batch->depth == 0 || --batch->depth != 0) {
+        return;
+    }
+    tlb_batch_flush(cpu);
+}
+
+void tlb_shootdown_handle_ipi(void)
+{
+    tlb_service_queue(tlb_current_cpu());
+    smp_lapic_eoi();
+}
+
+/* For CPUs spinning with interrupts off: serve queued ranges without the IPI. */
+void tlb_shootdown_poll(void)
+{
+    uint32_t cpu = tlb_current_cpu();
+    if (__atomic_load_n(&g_tlb_cpus[cpu].done, __ATOMIC_ACQUIRE) !=
+        __atomic_load_n(&g_tlb_cpus[cpu].posted, __ATOMIC_ACQUIRE)) {
+        tlb_service_queue(cpu);
+    }
+}
+
+void tlb_shootdown_print_stats(void)
+{
+    serial_write_string("[OS] [Memory] TLB shootdown: ranges=");
+    serial_write_uint64(g_tlb_ranges_queued);
+    serial_write_string(" merged=");
+    serial_write_uint64(g_tlb_ranges_merged);
+    serial_write_string(" ipis=");
+    serial_write_uint64(g_tlb_ipis_sent);
+    serial_write_string(" stale_marks=");
+    serial_write_uint64(g_tlb_stale_marks);
+    serial_write_string("\n");
+}
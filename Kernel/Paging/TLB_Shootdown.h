@@ -0,0 +1,30 @@
+#pragma once
+#ifndef TLB_SHOOTDOWN_H
+#define TLB_SHOOTDOWN_H
+
+#include <stdint.h>
+
+/*
+ * Cross-CPU TLB invalidation. Each CPU publishes the cr3 it runs on; a
+ * change to an address space queues the range on every other CPU running
+ * it and sends one IPI per CPU, then waits for each to acknowledge. CPUs
+ * not running the space only get their bit set in the space's stale mask
+ * (with PCID), so their next switch to it flushes.
+ *
+ * Callers doing several changes wrap them in batch_begin/batch_end so all
+ * ranges for a CPU go out under a single IPI.
+ */
+void tlb_shootdown_init(int pcid_enabled, int invpcid_supported);
+void tlb_shootdown_set_active_cr3(uint64_t cr3);
+void tlb_shootdown_range(uint64_t cr3,
+                         uint64_t pcid,
+                         volatile uint32_t *stale_cpus,
+                         uint64_t start,
+                         uint64_t pages);
+void tlb_shootdown_batch_begin(void);
+void tlb_shootdown_batch_end(void);
+void tlb_shootdown_handle_ipi(void);
+void tlb_shootdown_poll(void);
+void tlb_shootdown_print_stats(void);
+
+#endif
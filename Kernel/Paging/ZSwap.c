@@ -0,0 +1,376 @@
+#include "../DefaultLibrary/DefaultLibrary.h"
+
+#include "ZSwap.h"
+#include "../KernelConfig.h"
+#include "../Memory/Memory_Main.h"
+#include "../Serial.h"
+#include "../Sync/Spinlock.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ZSWAP_PAGE_BYTES   4096u
+#define ZSWAP_MAX_ENTRIES  OS_CONFIG_ZSWAP_MAX_ENTRIES
+#define ZSWAP_ACCEPT_BYTES (ZSWAP_PAGE_BYTES * 3u / 4u)
+
+/*
+ * LZ block format (LZ4-style): each sequence is a token byte whose high
+ * nibble is the literal count and low nibble the match length minus
+ * LZ_MIN_MATCH, a nibble of 15 continuing in 255-valued extension bytes.
+ * Literals follow, then a 16-bit little-endian match offset. The block
+ * ends with a literal-only sequence.
+ */
+#define LZ_MIN_MATCH    4u
+#define LZ_HASH_BITS    12u
+#define LZ_MAX_OFFSET   65535u
+#define LZ_LAST_LITERALS 5u
+#define LZ_MATCH_LIMIT  12u
+
+typedef struct {
+    uint8_t *data;
+    uint16_t length;
+    uint8_t used;
+    uint8_t zero;
+} zswap_entry_t;
+
+static zswap_entry_t g_zswap_entries[ZSWAP_MAX_ENTRIES];
+static uint16_t g_zswap_free_stack[ZSWAP_MAX_ENTRIES];
+static uint32_t g_zswap_free_count = 0;
+static uint8_t g_zswap_initialized = 0;
+static spinlock_t g_zswap_lock;
+
+static uint16_t g_lz_table[1u << LZ_HASH_BITS];
+static uint8_t g_zswap_scratch[ZSWAP_PAGE_BYTES + ZSWAP_PAGE_BYTES / 128u + 16u];
+
+static uint64_t g_zswap_stored = 0;
+static uint64_t g_zswap_zero = 0;
+static uint64_t g_zswap_rejected = 0;
+static uint64_t g_zswap_pool_bytes = 0;
+static uint64_t g_zswap_loads = 0;
+static uint64_t g_zswap_load_cycles = 0;
+
+static inline uint32_t lz_read32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint32_t lz_hash(uint32_t value)
+{
+    return (value * 2654435761u) >> (32u - LZ_HASH_BITS);
+}
+
+static uint32_t lz_put_length(uint8_t *dst, uint32_t op, uint32_t cap, uint32_t length)
+{
+    while (length >= 255u) {
+        if (op >= cap) {
+            return 0;
+        }
+        dst[op++] = 255u;
+        length -= 255u;
+    }
+    if (op >= cap) {
+        return 0;
+    }
+    dst[op++] = (uint8_t)length;
+    return op;
+}
+
+static uint32_t lz_emit(uint8_t *dst, uint32_t op, uint32_t cap,
+                        const uint8_t *literals, uint32_t literal_len,
+                        uint32_t offset, uint32_t match_len)
+{
+    if (op >= cap) {
+        return 0;
+    }
+    uint32_t token_pos = op++;
+    uint8_t token = (uint8_t)((literal_len >= 15u ? 15u : literal_len) << 4);
+    if (literal_len >= 15u) {
+        op = lz_put_length(dst, op, cap, literal_len - 15u);
+        if (op == 0) {
+            return 0;
+        }
+    }
+    if (literal_len > cap - op) {
+        return 0;
+    }
+    memcpy(dst + op, literals, literal_len);
+    op += literal_len;
+
+    if (match_len != 0) {
+        uint32_t code = match_len - LZ_MIN_MATCH;
+        token |= (uint8_t)(code >= 15u ? 15u : code);
+        if (cap - op < 2u) {
+            return 0;
+        }
+        dst[op++] = (uint8_t)offset;
+        dst[op++] = (uint8_t)(offset >> 8);
+        if (code >= 15u) {
+            op = lz_put_length(dst, op, cap, code - 15u);
+            if (op == 0) {
+                return 0;
+            }
+        }
+    }
+    dst[token_pos] = token;
+    return op;
+}
+
+/* Returns the compressed size, or 0 if it does not fit in dst_cap. */
+uint32_t lz_compress(const uint8_t *src, uint32_t src_len, uint8_t *dst, uint32_t dst_cap)
+{
+    uint32_t ip = 0;
+    uint32_t anchor = 0;
+    uint32_t op = 0;
+
+    memset(g_lz_table, 0, sizeof(g_lz_table));
+    if (src_len > LZ_MATCH_LIMIT && src_len <= LZ_MAX_OFFSET) {
+        uint32_t limit = src_len - LZ_MATCH_LIMIT;
+        while (ip < limit) {
+            uint32_t value = lz_read32(src + ip);
+            uint32_t h = lz_hash(value);
+            uint32_t ref = g_lz_table[h];
+            g_lz_table[h] = (uint16_t)(ip + 1u);
+
+            if (ref == 0 || lz_read32(src + ref - 1u) != value) {
+                ip += 1u + ((ip - anchor) >> 6);
+                continue;
+            }
+            ref -= 1u;
+
+            uint32_t len = LZ_MIN_MATCH;
+            while (ip + len < src_len - LZ_LAST_LITERALS && src[ref + len] == src[ip + len]) {
+                ++len;
+            }
+
+            op = lz_emit(dst, op, dst_cap, src + anchor, ip - anchor, ip - ref, len);
+            if (op == 0) {
+                return 0;
+            }
+            ip += len;
+            anchor = ip;
+        }
+    }
+
+    return lz_emit(dst, op, dst_cap, src + anchor, src_len - anchor, 0, 0);
+}
+
+static int lz_get_length(const uint8_t *src, uint32_t src_len, uint32_t *ip, uint32_t *length)
+{
+    uint8_t b;
+    do {
+        if (*ip >= src_len) {
+            return -1;
+        }
+        b = src[(*ip)++];
+        *length += b;
+    } while (b == 255u);
+    return 0;
+}
+
+/* Returns 0 when exactly dst_len bytes were produced. */
+int lz_decompress(const uint8_t *src, uint32_t src_len, uint8_t *dst, uint32_t dst_len)
+{
+    uint32_t ip = 0;
+    uint32_t op = 0;
+
+    while (ip < src_len) {
+        uint8_t token = src[ip++];
+        uint32_t literal_len = token >> 4;
+        if (literal_len == 15u && lz_get_length(src, src_len, &ip, &literal_len) != 0) {
+            return -1;
+        }
+        if (literal_len > src_len - ip || literal_len > dst_len - op) {
+            return -1;
+        }
+        memcpy(dst + op, src + ip, literal_len);
+        ip += literal_len;
+        op += literal_len;
+        if (ip == src_len) {
+            break;
+        }
+
+        if (src_len - ip < 2u) {
+            return -1;
+        }
+        uint32_t offset = (uint32_t)src[ip] | ((uint32_t)src[ip + 1u] << 8);
+        ip += 2u;
+        uint32_t match_len = (token & 15u);
+        if (match_len == 15u && lz_get_length(src, src_len, &ip, &match_len) != 0) {
+            return -1;
+        }
+        match_len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > op || match_len > dst_len - op) {
+            return -1;
+        }
+
+        /* Byte copy: matches may overlap their own output (runs). */
+        const uint8_t *from = dst + op - offset;
+        for (uint32_t i = 0; i < match_len; ++i) {
+            dst[op + i] = from[i];
+        }
+        op += match_len;
+    }
+    return (op == dst_len) ? 0 : -1;
+}
+
+static void zswap_init_locked(void)
+{
+    for (uint32_t i = 0; i < ZSWAP_MAX_ENTRIES; ++i) {
+        g_zswap_free_stack[i] = (uint16_t)(ZSWAP_MAX_ENTRIES - 1u - i);
+    }
+    g_zswap_free_count = ZSWAP_MAX_ENTRIES;
+    g_zswap_initialized = 1;
+}
+
+int zswap_enabled(void)
+{
+    return OS_CONFIG_ZSWAP_ENABLED != 0;
+}
+
+static int zswap_page_is_zero(const uint8_t *page)
+{
+    static const uint64_t zero_line[8];
+    for (uint32_t off = 0; off < ZSWAP_PAGE_BYTES; off += sizeof(zero_line)) {
+        if (memcmp(page + off, zero_line, sizeof(zero_line)) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Compress one page into the pool. Zero-filled pages take no buffer;
+ * pages that do not shrink below ZSWAP_ACCEPT_BYTES are rejected so the
+ * caller writes them to the swap device instead. The compressor state is
+ * shared, so callers must be serialized (the swap-out path is).
+ */
+int zswap_store(const void *page, uint32_t *handle_out)
+{
+    if (!zswap_enabled() || page == NULL || handle_out == NULL) {
+        return -1;
+    }
+
+    uint8_t *data = NULL;
+    uint32_t length = 0;
+    int zero = zswap_page_is_zero((const uint8_t *)page);
+    if (!zero) {
+        length = lz_compress((const uint8_t *)page, ZSWAP_PAGE_BYTES,
+                             g_zswap_scratch, ZSWAP_ACCEPT_BYTES);
+        if (length == 0 ||
+            g_zswap_pool_bytes + length > (uint64_t)OS_CONFIG_ZSWAP_MAX_POOL_BYTES) {
+            g_zswap_rejected++;
+            return -1;
+        }
+        data = (uint8_t *)kmalloc(length);
+        if (data == NULL) {
+            g_zswap_rejected++;
+            return -1;
+        }
+        memcpy(data, g_zswap_scratch, length);
+    }
+
+    spinlock_lock(&g_zswap_lock);
+    if (!g_zswap_initialized) {
+        zswap_init_locked();
+    }
+    if (g_zswap_free_count == 0) {
+        spinlock_unlock(&g_zswap_lock);
+        kfree(data);
+        g_zswap_rejected++;
+        return -1;
+    }
+    uint32_t handle = g_zswap_free_stack[--g_zswap_free_count];
+    zswap_entry_t *entry = &g_zswap_entries[handle];
+    entry->data = data;
+    entry->length = (uint16_t)length;
+    entry->zero = (uint8_t)zero;
+    entry->used = 1;
+    if (zero) {
+        g_zswap_zero++;
+    } else {
+        g_zswap_stored++;
+        g_zswap_pool_bytes += length;
+    }
+    spinlock_unlock(&g_zswap_lock);
+
+    *handle_out = handle;
+    return 0;
+}
+
+int zswap_handle_valid(uint32_t handle)
+{
+    return handle < ZSWAP_MAX_ENTRIES && g_zswap_entries[handle].used;
+}
+
+int zswap_load(uint32_t handle, void *page)
+{
+    if (!zswap_handle_valid(handle) || page == NULL) {
+        return -1;
+    }
+
+    uint64_t t0 = spinlock_read_tsc();
+    const zswap_entry_t *entry = &g_zswap_entries[handle];
+    int rc = 0;
+    if (entry->zero) {
+        memset(page, 0, ZSWAP_PAGE_BYTES);
+    } else {
+        rc = lz_decompress(entry->data, entry->length, (uint8_t *)page, ZSWAP_PAGE_BYTES);
+    }
+    g_zswap_load_cycles += spinlock_read_tsc() - t0;
+    g_zswap_loads++;
+    return rc;
+}
+
+void zswap_free(uint32_t handle)
+{
+    if (handle >= ZSWAP_MAX_ENTRIES) {
+        return;
+    }
+
+    uint8_t *data = NULL;
+    spinlock_lock(&g_zswap_lock);
+    zswap_entry_t *entry = &g_zswap_entries[handle];
+    if (entry->used) {
+        data = entry->data;
+        if (entry->zero) {
+            g_zswap_zero--;
+        } else {
+            g_zswap_stored--;
+            g_zswap_pool_bytes -= entry->length;
+        }
+        entry->data = NULL;
+        entry->length = 0;
+        entry->zero = 0;
+        entry->used = 0;
+        g_zswap_free_stack[g_zswap_free_count++] = (uint16_t)handle;
+    }
+    spinlock_unlock(&g_zswap_lock);
+    kfree(data);
+}
+
+void zswap_print_stats(void)
+{
+    serial_write_string("[OS] [ZSWAP] stored=");
+    serial_write_uint64(g_zswap_stored);
+    serial_write_string(" zero=");
+    serial_write_uint64(g_zswap_zero);
+    serial_write_string(" rejected=");
+    serial_write_uint64(g_zswap_rejected);
+    serial_write_string(" pool_bytes=");
+    serial_write_uint64(g_zswap_pool_bytes);
+    serial_write_string(" ratio=");
+    if (g_zswap_pool_bytes != 0) {
+        uint64_t centi = g_zswap_stored * ZSWAP_PAGE_BYTES * 100u / g_zswap_pool_bytes;
+        serial_write_uint64(centi / 100u);
+        serial_write_string(".");
+        serial_write_char((char)('0' + (centi / 10u) % 10u));
+        serial_write_char((char)('0' + centi % 10u));
+    } else {
+        serial_write_string("n/a");
+    }
+    serial_write_string(" loads=");
+    serial_write_uint64(g_zswap_loads);
+    serial_write_string(" load_cycles/op=");
+    serial_write_uint64((g_zswap_loads != 0) ? (g_zswap_load_cycles / g_zswap_loads) : 0);
+    serial_write_string("\n");
+}
@@ -0,0 +1,22 @@
+#pragma once
+#ifndef ZSWAP_H
+#define ZSWAP_H
+
+#include <stdint.h>
+
+/*
+ * Compressed RAM cache in front of the swap device. Evicted pages are LZ
+ * compressed into kernel heap buffers; a handle identifies the stored copy
+ * and is what a compressed swap PTE carries instead of a device slot.
+ */
+int zswap_enabled(void);
+int zswap_store(const void *page, uint32_t *handle_out);
+int zswap_load(uint32_t handle, void *page);
+void zswap_free(uint32_t handle);
+int zswap_handle_valid(uint32_t handle);
+void zswap_print_stats(void);
+
+uint32_t lz_compress(const uint8_t *src, uint32_t src_len, uint8_t *dst, uint32_t dst_cap);
+int lz_decompress(const uint8_t *src, uint32_t src_len, uint8_t *dst, uint32_t dst_len);
+
+#endif
@@ -23,6 +23,14 @@
 #error "Invalid user stack range"
 #endif
 
+typedef struct {
+    int32_t current_pid;
+    uint32_t nr_ready;
+    uint64_t switches;
+    uint64_t steals;
+    uint64_t stolen;
+} process_sched_stats_t;
+
 typedef uint64_t process_capability_mask_t;
 
 #define PROCESS_CAP_SERIAL  (1ULL << 0)
@@ -41,8 +49,11 @@ void process_manager_init(void);
 int32_t process_register_boot_process(uint64_t entry, uint64_t user_stack_top);
 int32_t process_create_user(uint64_t entry);
 int32_t process_spawn_user_elf(const char *path);
+int32_t process_fork_current(uint64_t saved_rsp, uint64_t user_rsp);
+int32_t process_create_thread(uint64_t entry, uint64_t arg0, uint64_t arg1);
 void process_exit_current(void);
 int32_t process_get_current_pid(void);
+int32_t process_get_current_group_pid(void);
 uint64_t process_get_current_user_rsp(void);
 uint64_t process_get_current_cr3(void);
 uint64_t process_schedule_on_syscall(uint64_t current_saved_rsp,
@@ -50,6 +61,11 @@ uint64_t process_schedule_on_syscall(uint64_t current_saved_rsp,
                                      int request_switch,
                                      uint64_t *next_user_rsp_out);
 uint64_t process_schedule_after_exit(uint64_t *next_user_rsp_out);
+void process_scheduler_tick(void);
+uint64_t process_schedule_on_tick(uint64_t saved_rsp, void *fpu_area);
+void process_finish_switch(void);
+__attribute__((noreturn)) void process_idle_loop(void);
+uint64_t process_idle_stack_top(uint32_t cpu_id);
 int process_user_buffer_is_valid(const void *ptr, uint64_t len);
 int process_user_cstring_length(const char *str, uint64_t max_len, uint64_t *len_out);
 void *process_user_alloc(uint32_t size);
@@ -61,4 +77,7 @@ process_capability_mask_t process_default_capabilities(void);
 process_capability_mask_t process_get_current_capabilities(void);
 int process_current_has_capability(process_capability_mask_t capability);
 int process_set_capabilities(int32_t pid, process_capability_mask_t capabilities);
+int process_set_priority(int32_t pid, uint8_t priority);
+int process_get_sched_stats(uint32_t cpu_id, process_sched_stats_t *out);
+void process_print_sched_stats(void);
 int process_get_capabilities(int32_t pid, process_capability_mask_t *capabilities_out);
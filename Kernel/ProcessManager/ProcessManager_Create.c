@@ -1,13 +1,16 @@
 #include "ProcessManager.h"
 
+#include "../DefaultLibrary/DefaultLibrary.h"
 #include "../ELF/ELF_Loader.h"
 #include "../GDT/GDT_Main.h"
 #include "../Memory/Memory_Main.h"
 #include "../Paging/Paging_Main.h"
+#include "../SMP/SMP_Main.h"
 #include "../Serial.h"
 #include "../Sync/Spinlock.h"
 #include "../Syscall/Syscall_File.h"
 #include "../Syscall/Syscall_Main.h"
+#include "../Timer/Timer.h"
 #include "../WindowManager/WindowManager.h"
 
 #include <stddef.h>
@@ -18,14 +21,28 @@
 #define PROCESS_SIGNAL_MAX 32
 #define PROCESS_RFLAGS_DEFAULT 0x202ULL
 #define PROCESS_GUARD_PAGE_SIZE PAGE_SIZE
+#define PROCESS_HUGE_PAGE_SIZE (2ULL * 1024ULL * 1024ULL)
+#define PROCESS_FPU_STATE_SIZE 512
+#define PROCESS_FPU_STATE_ALIGN 16
+#define PROCESS_FPU_DEFAULT_FCW 0x037FU
+#define PROCESS_FPU_DEFAULT_MXCSR 0x1F80U
 
 #define PROCESS_STATE_UNUSED 0
 #define PROCESS_STATE_READY  1
 #define PROCESS_STATE_RUNNING 2
 #define PROCESS_STATE_DEAD 3
+#define PROCESS_STATE_NEW  4
+
+#define PROCESS_PRIORITY_LEVELS 8
+#define PROCESS_PRIORITY_DEFAULT 4
+#define PROCESS_RUNQ_NIL (-1)
 
 #define PROCESS_CONTEXT_QWORDS SYSCALL_FRAME_QWORDS
+#if (PROCESS_CONTEXT_QWORDS * 8) > 4096
+#error "Initial user context frame must fit in one stack page"
+#endif
 #define PROCESS_ELF_MAX_SIZE (2ULL * 1024ULL * 1024ULL)
+#define PROCESS_THREAD_STACK_SIZE (256U * 1024U)
 
 typedef struct {
     uint8_t used;
@@ -33,8 +50,31 @@ typedef struct {
     uint32_t size;
 } user_alloc_t;
 
+/*
+ * A slot is either a process (its own address space) or a thread of one.
+ * A thread has its own kernel stack, FPU image, user stack and saved
+ * context, and shares the group leader's cr3, files and windows, which are
+ * owned by the leader's pid. Per-space state (user heap allocations, signal
+ * handlers) lives in the leader slot only, under group_lock.
+ *
+ * group_live counts members not yet DEAD; the last one to exit closes the
+ * group's files and windows. group_threads counts threads whose CPU may
+ * still run on the address space (dropped in process_finish_switch once a
+ * dead thread has been switched away from); the leader slot, which owns
+ * the address space, is only recycled once it is zero.
+ */
 typedef struct {
     uint8_t state;
+    uint8_t priority;
+    uint8_t cpu;
+    volatile uint8_t on_cpu;
+    uint8_t is_thread;
+    int32_t group_pid;
+    volatile uint32_t group_live;
+    volatile uint32_t group_threads;
+    spinlock_t group_lock;
+    int32_t runq_prev;
+    int32_t runq_next;
     process_capability_mask_t capability_mask;
     uint64_t entry;
     uint64_t saved_rsp;
@@ -42,6 +82,8 @@ typedef struct {
     uint64_t cr3;
     uint8_t *kernel_stack_base;
     uint64_t kernel_stack_top;
+    uint8_t *fpu_state_base;
+    uint8_t *fpu_state;
     uint64_t user_code_base;
     uint64_t user_code_limit;
     uint64_t user_heap_base;
@@ -57,14 +99,54 @@ typedef struct {
 
 static process_t *g_processes = NULL;
 static int32_t g_process_capacity = 0;
-static int32_t g_current_pid = -1;
-static spinlock_t g_process_table_lock;
+static spinlock_t g_process_slot_lock;
+
+/*
+ * Each CPU owns its current process, its time slice and its READY queues:
+ * one FIFO per priority level (0 is the highest), linked through the process
+ * slots. Bit n of runq_bitmap is set while level n is non-empty, so picking
+ * the next process is a bit scan plus a list pop no matter how large the
+ * table is. RUNNING, DEAD and UNUSED slots are never queued;
+ * set_process_state keeps the queues in step with the state. A queue and the
+ * proc->cpu of every process on it are guarded by that CPU's lock.
+ *
+ * on_cpu stays set while a CPU may still be running on the process's kernel
+ * stack, which is until the switch away from it has moved to the next stack
+ * (process_finish_switch). Other CPUs neither steal such a process nor
+ * recycle its slot.
+ *
+ * A CPU with nothing to run sits in process_idle_loop on its own idle stack
+ * with current_pid -1; APs start there once they are up.
+ */
+typedef struct {
+    int32_t head;
+    int32_t tail;
+} process_runq_t;
 
-#define OS_CONFIG_SMP_MAX_CPUS_LOCAL 4
-static int32_t g_current_pid_per_cpu[OS_CONFIG_SMP_MAX_CPUS_LOCAL];
+typedef struct {
+    spinlock_t lock;
+    int32_t current_pid;
+    int32_t prev_pid;
+    process_runq_t runq[PROCESS_PRIORITY_LEVELS];
+    uint32_t runq_bitmap;
+    volatile uint32_t nr_ready;
+    volatile uint32_t slice_ticks_left;
+    volatile uint8_t need_resched;
+    uint64_t switches;
+    uint64_t steals;
+    uint64_t stolen;
+    uint8_t *idle_stack_base;
+    uint64_t idle_stack_top;
+} process_cpu_t;
+
+static process_cpu_t g_process_cpus[OS_CONFIG_SMP_MAX_CPUS];
+
+/* IDT.asm: pops a saved SYSCALL_FRAME and irets into it. */
+extern __attribute__((noreturn)) void process_resume_frame(uint64_t saved_rsp);
 
 static void halt_forever(void)
 {
+    process_print_sched_stats();
     serial_write_string("[OS] [PROC] Halting system - no more runnable processes\n");
     while (1) {
         __asm__ volatile ("hlt");
@@ -82,6 +164,31 @@ static int is_valid_user_entry(uint64_t entry)
            (entry < USER_CODE_LIMIT);
 }
 
+static inline uint32_t this_cpu_id(void)
+{
+    uint32_t cpu_id = smp_get_current_cpu_id();
+    return (cpu_id < OS_CONFIG_SMP_MAX_CPUS) ? cpu_id : 0;
+}
+
+static inline process_cpu_t *this_cpu(void)
+{
+    return &g_process_cpus[this_cpu_id()];
+}
+
+static inline int32_t current_pid(void)
+{
+    return this_cpu()->current_pid;
+}
+
+static uint32_t online_cpu_count(void)
+{
+    uint32_t count = smp_get_cpu_count();
+    if (count < 1u) {
+        return 1u;
+    }
+    return (count > OS_CONFIG_SMP_MAX_CPUS) ? OS_CONFIG_SMP_MAX_CPUS : count;
+}
+
 static int process_table_ready(void)
 {
     return g_processes != NULL && g_process_capacity > 0;
@@ -99,6 +206,16 @@ static void reset_process_slot(process_t *proc)
     }
 
     proc->state = PROCESS_STATE_UNUSED;
+    proc->priority = PROCESS_PRIORITY_DEFAULT;
+    proc->cpu = 0;
+    proc->on_cpu = 0;
+    proc->is_thread = 0;
+    proc->group_pid = -1;
+    proc->group_live = 0;
+    proc->group_threads = 0;
+    spinlock_init(&proc->group_lock);
+    proc->runq_prev = PROCESS_RUNQ_NIL;
+    proc->runq_next = PROCESS_RUNQ_NIL;
     proc->capability_mask = 0;
     proc->entry = 0;
     proc->saved_rsp = 0;
@@ -106,6 +223,8 @@ static void reset_process_slot(process_t *proc)
     proc->cr3 = 0;
     proc->kernel_stack_base = NULL;
     proc->kernel_stack_top = 0;
+    proc->fpu_state_base = NULL;
+    proc->fpu_state = NULL;
     proc->user_code_base = 0;
     proc->user_code_limit = 0;
     proc->user_heap_base = 0;
@@ -131,15 +250,20 @@ static void release_process_resources(process_t *proc)
         return;
     }
 
-    if (proc->cr3 != 0) {
+    if (proc->cr3 != 0 && !proc->is_thread) {
         paging_destroy_process_space(proc->cr3);
-        proc->cr3 = 0;
     }
+    proc->cr3 = 0;
     if (proc->kernel_stack_base != NULL) {
         kfree(proc->kernel_stack_base);
         proc->kernel_stack_base = NULL;
     }
     proc->kernel_stack_top = 0;
+    if (proc->fpu_state_base != NULL) {
+        kfree(proc->fpu_state_base);
+        proc->fpu_state_base = NULL;
+    }
+    proc->fpu_state = NULL;
     proc->capability_mask = 0;
     proc->user_code_base = 0;
     proc->user_code_limit = 0;
@@ -176,57 +300,295 @@ static void release_process_table(void)
     kfree(g_processes);
     g_processes = NULL;
     g_process_capacity = 0;
-    g_current_pid = -1;
 }
 
+static int slot_recyclable(const process_t *proc)
+{
+    return proc->state == PROCESS_STATE_DEAD &&
+           !__atomic_load_n(&proc->on_cpu, __ATOMIC_ACQUIRE) &&
+           __atomic_load_n(&proc->group_threads, __ATOMIC_ACQUIRE) == 0;
+}
+
+/*
+ * Claims a free slot, recycling a DEAD one if needed, and returns it reset
+ * and in PROCESS_STATE_NEW so no other CPU can claim it meanwhile.
+ */
 static int32_t find_free_slot(void)
 {
     if (!process_table_ready()) {
         return -1;
     }
 
+    int32_t found = -1;
+    spinlock_lock(&g_process_slot_lock);
     for (int32_t i = 0; i < g_process_capacity; ++i) {
-        if (g_processes[i].state == PROCESS_STATE_UNUSED) {
-            return i;
+        process_t *proc = &g_processes[i];
+        if (proc->state == PROCESS_STATE_UNUSED) {
+            found = i;
+            break;
         }
-        if (g_processes[i].state == PROCESS_STATE_DEAD && i != g_current_pid) {
-            release_process_resources(&g_processes[i]);
-            reset_process_slot(&g_processes[i]);
-            return i;
+        if (slot_recyclable(proc)) {
+            release_process_resources(proc);
+            found = i;
+            break;
         }
     }
-    return -1;
+    if (found >= 0) {
+        reset_process_slot(&g_processes[found]);
+        g_processes[found].state = PROCESS_STATE_NEW;
+        g_processes[found].group_pid = found;
+        g_processes[found].group_live = 1;
+    }
+    spinlock_unlock(&g_process_slot_lock);
+    return found;
 }
 
-static int32_t pick_next_ready(int32_t current_pid)
+static inline process_t *group_leader_of(int32_t pid)
 {
-    if (!process_table_ready()) {
-        return -1;
+    return &g_processes[g_processes[pid].group_pid];
+}
+
+static void process_cpus_reset(void)
+{
+    for (uint32_t c = 0; c < OS_CONFIG_SMP_MAX_CPUS; ++c) {
+        process_cpu_t *cpu = &g_process_cpus[c];
+        spinlock_init(&cpu->lock);
+        cpu->current_pid = -1;
+        cpu->prev_pid = -1;
+        for (uint32_t i = 0; i < PROCESS_PRIORITY_LEVELS; ++i) {
+            cpu->runq[i].head = PROCESS_RUNQ_NIL;
+            cpu->runq[i].tail = PROCESS_RUNQ_NIL;
+        }
+        cpu->runq_bitmap = 0;
+        cpu->nr_ready = 0;
+        cpu->slice_ticks_left = 0;
+        cpu->need_resched = 0;
+        cpu->switches = 0;
+        cpu->steals = 0;
+        cpu->stolen = 0;
     }
+}
 
-    if (current_pid < 0) {
-        for (int32_t i = 0; i < g_process_capacity; ++i) {
-            if (g_processes[i].state == PROCESS_STATE_READY ||
-                g_processes[i].state == PROCESS_STATE_RUNNING) {
-                return i;
-            }
+static void runq_push_tail(int32_t pid)
+{
+    process_t *proc = &g_processes[pid];
+    process_cpu_t *cpu = &g_process_cpus[proc->cpu];
+    process_runq_t *q = &cpu->runq[proc->priority];
+
+    proc->runq_next = PROCESS_RUNQ_NIL;
+    proc->runq_prev = q->tail;
+    if (q->tail != PROCESS_RUNQ_NIL) {
+        g_processes[q->tail].runq_next = pid;
+    } else {
+        q->head = pid;
+    }
+    q->tail = pid;
+    cpu->runq_bitmap |= 1u << proc->priority;
+    cpu->nr_ready++;
+}
+
+static void runq_remove(int32_t pid)
+{
+    process_t *proc = &g_processes[pid];
+    process_cpu_t *cpu = &g_process_cpus[proc->cpu];
+    process_runq_t *q = &cpu->runq[proc->priority];
+
+    if (proc->runq_prev != PROCESS_RUNQ_NIL) {
+        g_processes[proc->runq_prev].runq_next = proc->runq_next;
+    } else {
+        q->head = proc->runq_next;
+    }
+    if (proc->runq_next != PROCESS_RUNQ_NIL) {
+        g_processes[proc->runq_next].runq_prev = proc->runq_prev;
+    } else {
+        q->tail = proc->runq_prev;
+    }
+    proc->runq_prev = PROCESS_RUNQ_NIL;
+    proc->runq_next = PROCESS_RUNQ_NIL;
+    if (q->head == PROCESS_RUNQ_NIL) {
+        cpu->runq_bitmap &= ~(1u << proc->priority);
+    }
+    cpu->nr_ready--;
+}
+
+/* Every state change of a live slot goes through here, under proc->cpu's lock. */
+static void set_process_state(int32_t pid, uint8_t state)
+{
+    process_t *proc = &g_processes[pid];
+    if (proc->state == state) {
+        return;
+    }
+    if (proc->state == PROCESS_STATE_READY) {
+        runq_remove(pid);
+    }
+    proc->state = state;
+    if (state == PROCESS_STATE_READY) {
+        runq_push_tail(pid);
+    }
+}
+
+/* Locks the CPU whose queue owns proc; proc->cpu only changes under that lock. */
+static process_cpu_t *lock_process_cpu(process_t *proc)
+{
+    for (;;) {
+        process_cpu_t *cpu = &g_process_cpus[proc->cpu];
+        spinlock_lock(&cpu->lock);
+        if (cpu == &g_process_cpus[proc->cpu]) {
+            return cpu;
         }
-        return -1;
+        spinlock_unlock(&cpu->lock);
+    }
+}
+
+/* New work goes to the online CPU with the fewest READY processes. */
+static uint8_t pick_target_cpu(void)
+{
+    uint32_t best = this_cpu_id();
+    uint32_t best_load = g_process_cpus[best].nr_ready;
+    uint32_t count = online_cpu_count();
+    for (uint32_t c = 0; c < count; ++c) {
+        uint32_t load = g_process_cpus[c].nr_ready;
+        if (load < best_load) {
+            best = c;
+            best_load = load;
+        }
+    }
+    return (uint8_t)best;
+}
+
+/* An idle target is halted in process_idle_loop; the IPI wakes it to pick. */
+static void make_process_ready(int32_t pid)
+{
+    process_t *proc = &g_processes[pid];
+    proc->cpu = pick_target_cpu();
+    process_cpu_t *cpu = lock_process_cpu(proc);
+    set_process_state(pid, PROCESS_STATE_READY);
+    uint32_t target = proc->cpu;
+    int target_idle = (cpu->current_pid < 0);
+    spinlock_unlock(&cpu->lock);
+
+    if (target_idle && target != this_cpu_id()) {
+        smp_send_ipi(target, SMP_RESCHEDULE_VECTOR);
     }
+}
 
-    for (int32_t step = 1; step <= g_process_capacity; ++step) {
-        int32_t idx = (current_pid + step) % g_process_capacity;
-        if (g_processes[idx].state == PROCESS_STATE_READY) {
-            return idx;
+/*
+ * Cold end first: the tail of the best non-empty level is the process that
+ * has waited least, so it has the least cache state left on the victim.
+ */
+static int32_t runq_find_stealable(const process_cpu_t *victim)
+{
+    uint32_t levels = victim->runq_bitmap;
+    while (levels != 0) {
+        uint32_t level = (uint32_t)__builtin_ctz(levels);
+        levels &= levels - 1u;
+        for (int32_t pid = victim->runq[level].tail; pid != PROCESS_RUNQ_NIL;
+             pid = g_processes[pid].runq_prev) {
+            if (!__atomic_load_n(&g_processes[pid].on_cpu, __ATOMIC_ACQUIRE)) {
+                return pid;
+            }
         }
     }
-    if (g_processes[current_pid].state == PROCESS_STATE_RUNNING ||
-        g_processes[current_pid].state == PROCESS_STATE_READY) {
-        return current_pid;
+    return -1;
+}
+
+/*
+ * Called with the local queue empty and its lock held. Remote locks are only
+ * tried, never waited on, so two idle CPUs stealing from each other cannot
+ * deadlock.
+ */
+static int32_t steal_ready_process(process_cpu_t *cpu, uint32_t cpu_id)
+{
+    uint32_t count = online_cpu_count();
+    for (uint32_t step = 1; step < count; ++step) {
+        uint32_t victim_id = (cpu_id + step) % count;
+        process_cpu_t *victim = &g_process_cpus[victim_id];
+        if (victim->nr_ready == 0 || !spinlock_trylock(&victim->lock)) {
+            continue;
+        }
+
+        int32_t pid = runq_find_stealable(victim);
+        if (pid >= 0) {
+            runq_remove(pid);
+            g_processes[pid].cpu = (uint8_t)cpu_id;
+            runq_push_tail(pid);
+            victim->stolen++;
+            cpu->steals++;
+        }
+        spinlock_unlock(&victim->lock);
+        if (pid >= 0) {
+            return pid;
+        }
     }
     return -1;
 }
 
+/*
+ * Head of the highest-priority non-empty local queue, stealing from another
+ * CPU when the local queues are empty; the caller makes it RUNNING.
+ */
+static int32_t pick_next_ready(process_cpu_t *cpu)
+{
+    if (cpu->runq_bitmap == 0) {
+        return steal_ready_process(cpu, (uint32_t)(cpu - g_process_cpus));
+    }
+    uint32_t level = (uint32_t)__builtin_ctz(cpu->runq_bitmap);
+    return cpu->runq[level].head;
+}
+
+/*
+ * Makes next the CPU's current process. prev keeps on_cpu until
+ * process_finish_switch runs on next's stack.
+ */
+static void switch_current(process_cpu_t *cpu, int32_t prev_pid, int32_t next_pid)
+{
+    set_process_state(next_pid, PROCESS_STATE_RUNNING);
+    if (next_pid != prev_pid) {
+        g_processes[next_pid].on_cpu = 1;
+        cpu->prev_pid = prev_pid;
+        cpu->switches++;
+    }
+    cpu->current_pid = next_pid;
+}
+
+/*
+ * Leaves the exiting process's kernel stack for this CPU's idle loop, with
+ * cpu->lock held by the caller. prev keeps on_cpu until the idle loop runs
+ * process_finish_switch on the idle stack. With a single CPU online nothing
+ * could ever become ready again, so the system halts instead.
+ *
+ * The idle loop runs with the user GS base loaded, as any interrupt path
+ * does; from_syscall undoes syscall_entry's swapgs, which never gets to run
+ * its own on the way out.
+ */
+__attribute__((noreturn))
+static void enter_idle(process_cpu_t *cpu, int32_t prev_pid, int from_syscall)
+{
+    uint64_t stack_top = cpu->idle_stack_top;
+    if (online_cpu_count() <= 1u || stack_top == 0) {
+        spinlock_unlock(&cpu->lock);
+        serial_write_string("[OS] [PROC] No runnable process. Halting.\n");
+        halt_forever();
+        __builtin_unreachable();
+    }
+
+    cpu->prev_pid = prev_pid;
+    cpu->current_pid = -1;
+    spinlock_unlock(&cpu->lock);
+
+    paging_switch_cr3(paging_get_kernel_cr3());
+    if (from_syscall) {
+        __asm__ volatile ("swapgs" ::: "memory");
+    }
+    __asm__ volatile (
+        "mov %0, %%rsp\n\t"
+        "call process_idle_loop"
+        :
+        : "r"(stack_top)
+        : "memory");
+    __builtin_unreachable();
+}
+
 static void activate_process_context(process_t *proc)
 {
     paging_switch_cr3(proc->cr3);
@@ -234,6 +596,72 @@ static void activate_process_context(process_t *proc)
     gdt_set_kernel_rsp0(proc->kernel_stack_top);
 }
 
+static uint32_t timeslice_ticks(void)
+{
+    uint64_t ticks = ((uint64_t)OS_CONFIG_SCHED_TIMESLICE_MS * timer_hz()) / 1000ULL;
+    return (ticks == 0) ? 1u : (uint32_t)ticks;
+}
+
+static void begin_time_slice(process_cpu_t *cpu)
+{
+    cpu->slice_ticks_left = timeslice_ticks();
+    cpu->need_resched = 0;
+}
+
+/*
+ * Each process owns an FXSAVE image. A process preempted at an arbitrary
+ * instruction has live x87/SSE state, so every switch saves the outgoing
+ * image and loads the incoming one.
+ */
+static inline void fpu_save(void *area)
+{
+    __asm__ volatile ("fxsave64 (%0)" : : "r"(area) : "memory");
+}
+
+static inline void fpu_restore(const void *area)
+{
+    __asm__ volatile ("fxrstor64 (%0)" : : "r"(area) : "memory");
+}
+
+static int alloc_fpu_state(process_t *proc)
+{
+    proc->fpu_state_base = kmalloc(PROCESS_FPU_STATE_SIZE + PROCESS_FPU_STATE_ALIGN);
+    if (proc->fpu_state_base == NULL) {
+        return -1;
+    }
+    proc->fpu_state = (uint8_t *)(uintptr_t)align_up_u64((uint64_t)(uintptr_t)proc->fpu_state_base,
+                                                         PROCESS_FPU_STATE_ALIGN);
+    memset(proc->fpu_state, 0, PROCESS_FPU_STATE_SIZE);
+    *(uint16_t *)(void *)(proc->fpu_state + 0) = (uint16_t)PROCESS_FPU_DEFAULT_FCW;
+    *(uint32_t *)(void *)(proc->fpu_state + 24) = PROCESS_FPU_DEFAULT_MXCSR;
+    return 0;
+}
+
+/*
+ * live_area is the FXSAVE image the timer IRQ stub took on entry and restores
+ * on exit; NULL means the registers themselves are live (syscall path).
+ */
+static void switch_fpu_state(process_t *prev, process_t *next, void *live_area)
+{
+    if (prev == next) {
+        return;
+    }
+    if (prev != NULL && prev->fpu_state != NULL) {
+        if (live_area != NULL) {
+            memcpy(prev->fpu_state, live_area, PROCESS_FPU_STATE_SIZE);
+        } else {
+            fpu_save(prev->fpu_state);
+        }
+    }
+    if (next->fpu_state != NULL) {
+        if (live_area != NULL) {
+            memcpy(live_area, next->fpu_state, PROCESS_FPU_STATE_SIZE);
+        } else {
+            fpu_restore(next->fpu_state);
+        }
+    }
+}
+
 static int initialize_process_memory(process_t *proc, uint64_t entry)
 {
     if (proc == NULL) {
@@ -246,6 +674,10 @@ static int initialize_process_memory(process_t *proc, uint64_t entry)
     }
     proc->kernel_stack_top = ((uint64_t)(uintptr_t)(proc->kernel_stack_base + PROCESS_KERNEL_STACK_SIZE)) & ~0xFULL;
 
+    if (alloc_fpu_state(proc) < 0) {
+        return -1;
+    }
+
     proc->cr3 = paging_create_process_space();
     if (!proc->cr3) {
         return -1;
@@ -302,56 +734,182 @@ static int initialize_process_memory(process_t *proc, uint64_t entry)
         return -1;
     }
 
-    if (paging_set_user_access(proc->cr3,
+    if (paging_vma_insert(proc->cr3,
+                          proc->user_code_base,
+                          proc->user_code_limit - proc->user_code_base,
+                          PAGE_RW,
+                          PAGING_VMA_FIXED) < 0 ||
+        paging_set_user_access(proc->cr3,
                                proc->user_code_base,
                                proc->user_code_limit - proc->user_code_base,
                                1) < 0) {
         return -1;
     }
-    if (paging_set_user_access(proc->cr3,
-                               proc->user_heap_base,
-                               proc->user_heap_limit - proc->user_heap_base,
-                               1) < 0) {
+    /* Heap and stack are reserved only; pages are populated on first touch. */
+    if (paging_reserve_user_range(proc->cr3,
+                                  proc->user_heap_base,
+                                  proc->user_heap_limit - proc->user_heap_base,
+                                  PAGE_RW) < 0) {
         return -1;
     }
-    if (paging_set_user_access(proc->cr3,
-                               proc->user_stack_base,
-                               proc->user_stack_top - proc->user_stack_base,
-                               1) < 0) {
+    if (paging_reserve_user_range(proc->cr3,
+                                  proc->user_stack_base,
+                                  proc->user_stack_top - proc->user_stack_base,
+                                  PAGE_RW) < 0) {
+        return -1;
+    }
+    /* Deep stacks grow in 2 MiB steps; the top block keeps 4 KiB pages (see below). */
+    if (paging_vma_set_huge(proc->cr3,
+                            proc->user_stack_base,
+                            proc->user_stack_top - proc->user_stack_base) < 0) {
         return -1;
     }
 
-    if (paging_unmap_range(proc->cr3, proc->user_heap_guard_page, PROCESS_GUARD_PAGE_SIZE) < 0 ||
+    if (paging_vma_insert(proc->cr3, proc->user_heap_guard_page, PROCESS_GUARD_PAGE_SIZE,
+                          0, PAGING_VMA_GUARD) < 0 ||
+        paging_vma_insert(proc->cr3, proc->user_stack_guard_page, PROCESS_GUARD_PAGE_SIZE,
+                          0, PAGING_VMA_GUARD) < 0 ||
+        paging_unmap_range(proc->cr3, proc->user_heap_guard_page, PROCESS_GUARD_PAGE_SIZE) < 0 ||
         paging_unmap_range(proc->cr3, proc->user_stack_guard_page, PROCESS_GUARD_PAGE_SIZE) < 0) {
         serial_write_string("[OS] [PROC] Failed to set guard pages\n");
         return -1;
     }
 
+    /*
+     * The initial context frame sits at the top of the user stack. That page
+     * is populated now, and the frame is written through its physical
+     * address since the new space is not the active one.
+     */
     uint64_t user_stack_top = proc->user_stack_top;
-    uint64_t *frame = (uint64_t *)(uintptr_t)(user_stack_top - (PROCESS_CONTEXT_QWORDS * sizeof(uint64_t)));
+    uint64_t frame_addr = user_stack_top - (PROCESS_CONTEXT_QWORDS * sizeof(uint64_t));
+    uint64_t frame_page = frame_addr & PAGE_MASK;
+    void *stack_page = alloc_zeroed_page();
+    if (stack_page == NULL) {
+        return -1;
+    }
+    if (paging_map_user_page(proc->cr3, frame_page, (uint64_t)(uintptr_t)stack_page, PAGE_RW) < 0) {
+        free_page(stack_page);
+        return -1;
+    }
+
+    uint64_t *frame = (uint64_t *)((uintptr_t)stack_page + (uintptr_t)(frame_addr - frame_page));
     for (uint32_t i = 0; i < PROCESS_CONTEXT_QWORDS; ++i) {
         frame[i] = 0;
     }
 
     frame[SYSCALL_FRAME_RCX] = entry;
     frame[SYSCALL_FRAME_R11] = PROCESS_RFLAGS_DEFAULT;
+    frame[SYSCALL_FRAME_RIP] = entry;
+    frame[SYSCALL_FRAME_CS] = GDT_USER_CODE | 3;
+    frame[SYSCALL_FRAME_RFLAGS] = PROCESS_RFLAGS_DEFAULT;
+    frame[SYSCALL_FRAME_RSP] = user_stack_top;
+    frame[SYSCALL_FRAME_SS] = GDT_USER_DATA | 3;
 
-    proc->saved_rsp = (uint64_t)(uintptr_t)frame;
+    proc->saved_rsp = frame_addr;
     proc->saved_user_rsp = user_stack_top;
 
     return 0;
 }
 
-static int range_within(uint64_t addr, uint64_t len, uint64_t start, uint64_t end)
+/*
+ * Heap pages that were never touched are still unpopulated and fault in
+ * zeroed, so only pages that already have a frame (or a swap copy) need
+ * clearing when an allocation hands them out.
+ */
+static void zero_resident_user_range(uint64_t cr3, uint64_t addr, uint64_t len)
 {
-    if (len == 0) {
-        return 1;
+    uint64_t end = addr + len;
+    while (addr < end) {
+        uint64_t chunk_end = (addr & PAGE_MASK) + PAGE_SIZE;
+        if (chunk_end > end) {
+            chunk_end = end;
+        }
+        if (paging_is_user_range_mapped(cr3, addr, 1)) {
+            memset((void *)(uintptr_t)addr, 0, (size_t)(chunk_end - addr));
+        }
+        addr = chunk_end;
     }
-    if (addr > (0xFFFFFFFFFFFFFFFFULL - len)) {
-        return 0;
+}
+
+/* proc is a group leader; its heap serves every thread of the group. */
+static void *user_heap_alloc_locked(process_t *proc, uint32_t size, uint64_t align)
+{
+    if (size == 0) {
+        return NULL;
     }
-    uint64_t addr_end = addr + len;
-    return (addr >= start) && (addr_end <= end);
+    if (proc->user_heap_base == 0 ||
+        proc->user_heap_limit <= proc->user_heap_base ||
+        proc->user_heap_cursor < proc->user_heap_base ||
+        proc->user_heap_cursor > proc->user_heap_limit) {
+        return NULL;
+    }
+    uint64_t alloc_size = align_up_u64((uint64_t)size, 16ULL);
+
+    for (uint32_t i = 0; i < PROCESS_USER_ALLOC_MAX; ++i) {
+        user_alloc_t *slot = &proc->user_allocs[i];
+        if (!slot->used && slot->size != 0 && slot->size >= alloc_size &&
+            (slot->addr & (align - 1ULL)) == 0) {
+            slot->used = 1;
+            return (void *)(uintptr_t)slot->addr;
+        }
+    }
+
+    uint32_t new_slot = PROCESS_USER_ALLOC_MAX;
+    for (uint32_t i = 0; i < PROCESS_USER_ALLOC_MAX; ++i) {
+        if (proc->user_allocs[i].size == 0) {
+            new_slot = i;
+            break;
+        }
+    }
+    if (new_slot == PROCESS_USER_ALLOC_MAX) {
+        return NULL;
+    }
+
+    uint64_t addr = align_up_u64(proc->user_heap_cursor, align);
+    uint64_t next = addr + alloc_size;
+    if (addr < proc->user_heap_cursor || next <= addr || next > proc->user_heap_limit) {
+        return NULL;
+    }
+
+    proc->user_heap_cursor = next;
+    proc->user_allocs[new_slot].used = 1;
+    proc->user_allocs[new_slot].addr = addr;
+    proc->user_allocs[new_slot].size = (uint32_t)alloc_size;
+
+    zero_resident_user_range(proc->cr3, addr, alloc_size);
+
+    return (void *)(uintptr_t)addr;
+}
+
+static void *user_heap_alloc(process_t *leader, uint32_t size, uint64_t align)
+{
+    spinlock_lock(&leader->group_lock);
+    void *ptr = user_heap_alloc_locked(leader, size, align);
+    spinlock_unlock(&leader->group_lock);
+    return ptr;
+}
+
+static int user_heap_free(process_t *leader, uint64_t addr)
+{
+    int rc = -1;
+    spinlock_lock(&leader->group_lock);
+    for (uint32_t i = 0; i < PROCESS_USER_ALLOC_MAX; ++i) {
+        user_alloc_t *slot = &leader->user_allocs[i];
+        if (slot->used && slot->addr == addr) {
+            slot->used = 0;
+            rc = 0;
+            break;
+        }
+    }
+    spinlock_unlock(&leader->group_lock);
+    return rc;
+}
+
+/* Give a thread stack, guard page included, back to the group heap. */
+static void release_thread_stack(process_t *leader, uint64_t guard_page)
+{
+    (void)paging_vma_set_guard(leader->cr3, guard_page, PROCESS_GUARD_PAGE_SIZE, 0);
+    (void)user_heap_free(leader, guard_page);
 }
 
 void process_manager_init(void)
@@ -362,6 +920,7 @@ void process_manager_init(void)
     }
 
     release_process_table();
+    spinlock_init(&g_process_slot_lock);
 
     uint64_t table_size_u64 = (uint64_t)desired_capacity * (uint64_t)sizeof(process_t);
     if (table_size_u64 == 0 || table_size_u64 > 0xFFFFFFFFULL) {
@@ -379,8 +938,18 @@ void process_manager_init(void)
     for (int32_t i = 0; i < g_process_capacity; ++i) {
         reset_process_slot(&g_processes[i]);
     }
-    g_current_pid = -1;
-    spinlock_init(&g_process_table_lock);
+    process_cpus_reset();
+
+    for (uint32_t c = 0; c < OS_CONFIG_SMP_MAX_CPUS; ++c) {
+        process_cpu_t *cpu = &g_process_cpus[c];
+        if (cpu->idle_stack_base == NULL) {
+            cpu->idle_stack_base = kmalloc(PROCESS_KERNEL_STACK_SIZE);
+        }
+        if (cpu->idle_stack_base != NULL) {
+            cpu->idle_stack_top = ((uint64_t)(uintptr_t)cpu->idle_stack_base +
+                                   PROCESS_KERNEL_STACK_SIZE) & ~0xFULL;
+        }
+    }
 
     serial_write_string("[OS] [PROC] Process slot capacity=");
     serial_write_uint32((uint32_t)g_process_capacity);
@@ -399,8 +968,17 @@ int32_t process_register_boot_process(uint64_t entry, uint64_t user_stack_top)
 
     process_t *proc = &g_processes[pid];
 
-    proc->state = PROCESS_STATE_RUNNING;
-    g_current_pid = pid;
+    process_cpu_t *owner = lock_process_cpu(proc);
+    set_process_state(pid, PROCESS_STATE_RUNNING);
+    spinlock_unlock(&owner->lock);
+
+    process_cpu_t *cpu = this_cpu();
+    spinlock_lock(&cpu->lock);
+    proc->cpu = (uint8_t)this_cpu_id();
+    proc->on_cpu = 1;
+    cpu->current_pid = pid;
+    begin_time_slice(cpu);
+    spinlock_unlock(&cpu->lock);
 
     activate_process_context(proc);
 
@@ -421,19 +999,192 @@ int32_t process_create_user(uint64_t entry)
     }
 
     process_t *proc = &g_processes[pid];
-    reset_process_slot(proc);
-
     if (initialize_process_memory(proc, entry) < 0) {
         release_process_resources(proc);
         reset_process_slot(proc);
         return -1;
     }
 
-    proc->state = PROCESS_STATE_READY;
     proc->entry = entry;
+    make_process_ready(pid);
     return pid;
 }
 
+/*
+ * fork: the child gets a copy-on-write clone of the caller's address space
+ * and resumes from the same syscall with a return value of 0. Its initial
+ * context frame is a copy of the caller's, placed on the child's kernel
+ * stack. Open files and windows stay with the parent.
+ */
+int32_t process_fork_current(uint64_t saved_rsp, uint64_t user_rsp)
+{
+    int32_t parent_pid = current_pid();
+    if (!is_valid_pid(parent_pid) || saved_rsp == 0) {
+        return -1;
+    }
+
+    int32_t pid = find_free_slot();
+    if (pid < 0) {
+        serial_write_string("[OS] [PROC] No free slot for fork\n");
+        return -1;
+    }
+
+    process_t *parent = &g_processes[parent_pid];
+    process_t *leader = group_leader_of(parent_pid);
+    process_t *child = &g_processes[pid];
+
+    child->kernel_stack_base = kmalloc(PROCESS_KERNEL_STACK_SIZE);
+    if (child->kernel_stack_base == NULL) {
+        reset_process_slot(child);
+        return -1;
+    }
+    child->kernel_stack_top = ((uint64_t)(uintptr_t)(child->kernel_stack_base + PROCESS_KERNEL_STACK_SIZE)) & ~0xFULL;
+
+    if (alloc_fpu_state(child) < 0) {
+        release_process_resources(child);
+        reset_process_slot(child);
+        return -1;
+    }
+    fpu_save(child->fpu_state);
+
+    child->cr3 = paging_clone_process_space(parent->cr3);
+    if (child->cr3 == 0) {
+        release_process_resources(child);
+        reset_process_slot(child);
+        return -1;
+    }
+
+    /* A forking thread's heap and handlers live in its group leader. */
+    child->capability_mask = parent->capability_mask;
+    child->priority = parent->priority;
+    child->entry = leader->entry;
+    spinlock_lock(&leader->group_lock);
+    child->user_code_base = leader->user_code_base;
+    child->user_code_limit = leader->user_code_limit;
+    child->user_heap_base = leader->user_heap_base;
+    child->user_heap_cursor = leader->user_heap_cursor;
+    child->user_heap_limit = leader->user_heap_limit;
+    child->user_heap_guard_page = leader->user_heap_guard_page;
+    child->user_stack_base = leader->user_stack_base;
+    child->user_stack_top = leader->user_stack_top;
+    child->user_stack_guard_page = leader->user_stack_guard_page;
+    for (uint32_t i = 0; i < PROCESS_USER_ALLOC_MAX; ++i) {
+        child->user_allocs[i] = leader->user_allocs[i];
+    }
+    for (uint32_t i = 0; i < PROCESS_SIGNAL_MAX; ++i) {
+        child->signal_handlers[i] = leader->signal_handlers[i];
+    }
+    spinlock_unlock(&leader->group_lock);
+
+    uint64_t *frame = (uint64_t *)(uintptr_t)(child->kernel_stack_top - (PROCESS_CONTEXT_QWORDS * sizeof(uint64_t)));
+    memcpy(frame, (const void *)(uintptr_t)saved_rsp, PROCESS_CONTEXT_QWORDS * sizeof(uint64_t));
+    frame[SYSCALL_FRAME_RAX] = 0;
+    child->saved_rsp = (uint64_t)(uintptr_t)frame;
+    child->saved_user_rsp = user_rsp;
+    make_process_ready(pid);
+
+    serial_write_string("[OS] [PROC] fork pid=");
+    serial_write_uint32((uint32_t)parent_pid);
+    serial_write_string(" -> child=");
+    serial_write_uint32((uint32_t)pid);
+    serial_write_string("\n");
+    return pid;
+}
+
+/*
+ * Starts a thread of the caller's group at entry with rdi = arg0 and
+ * rsi = arg1. It runs on a fresh stack carved from the group's user heap,
+ * shares the caller's cr3, so creating it allocates no page tables and
+ * switching between threads of one group does not reload CR3.
+ */
+int32_t process_create_thread(uint64_t entry, uint64_t arg0, uint64_t arg1)
+{
+    int32_t parent_pid = current_pid();
+    if (!is_valid_pid(parent_pid) || !is_valid_user_entry(entry)) {
+        return -1;
+    }
+
+    process_t *parent = &g_processes[parent_pid];
+    int32_t group_pid = parent->group_pid;
+    process_t *leader = &g_processes[group_pid];
+
+    /* Lowest page of the block is a guard, as below the main stack. */
+    void *stack = user_heap_alloc(leader, PROCESS_THREAD_STACK_SIZE + PROCESS_GUARD_PAGE_SIZE, PAGE_SIZE);
+    if (stack == NULL) {
+        serial_write_string("[OS] [PROC] No user heap for thread stack\n");
+        return -1;
+    }
+    uint64_t guard_page = (uint64_t)(uintptr_t)stack;
+    uint64_t stack_base = guard_page + PROCESS_GUARD_PAGE_SIZE;
+    uint64_t stack_top = stack_base + PROCESS_THREAD_STACK_SIZE;
+    /* Best effort: a full VMA table only costs this thread its overflow trap. */
+    if (paging_vma_set_guard(parent->cr3, guard_page, PROCESS_GUARD_PAGE_SIZE, 1) < 0) {
+        serial_write_string("[OS] [PROC] No VMA room for thread stack guard page\n");
+    }
+
+    int32_t tid = find_free_slot();
+    if (tid < 0) {
+        serial_write_string("[OS] [PROC] No free slot for thread create\n");
+        release_thread_stack(leader, guard_page);
+        return -1;
+    }
+
+    process_t *thread = &g_processes[tid];
+    thread->is_thread = 1;
+    thread->group_pid = group_pid;
+    thread->group_live = 0;
+    thread->kernel_stack_base = kmalloc(PROCESS_KERNEL_STACK_SIZE);
+    if (thread->kernel_stack_base == NULL || alloc_fpu_state(thread) < 0) {
+        release_process_resources(thread);
+        reset_process_slot(thread);
+        release_thread_stack(leader, guard_page);
+        return -1;
+    }
+    thread->kernel_stack_top = ((uint64_t)(uintptr_t)(thread->kernel_stack_base + PROCESS_KERNEL_STACK_SIZE)) & ~0xFULL;
+
+    thread->cr3 = parent->cr3;
+    thread->capability_mask = parent->capability_mask;
+    thread->priority = parent->priority;
+    thread->entry = entry;
+    thread->user_stack_base = stack_base;
+    thread->user_stack_top = stack_top;
+    thread->user_stack_guard_page = guard_page;
+
+    /*
+     * The caller runs in the same address space, so the null return address
+     * is written directly. Returning from entry faults and ends the thread.
+     */
+    uint64_t user_rsp = stack_top - sizeof(uint64_t);
+    *(volatile uint64_t *)(uintptr_t)user_rsp = 0;
+
+    uint64_t *frame = (uint64_t *)(uintptr_t)(thread->kernel_stack_top - (PROCESS_CONTEXT_QWORDS * sizeof(uint64_t)));
+    for (uint32_t i = 0; i < PROCESS_CONTEXT_QWORDS; ++i) {
+        frame[i] = 0;
+    }
+    frame[SYSCALL_FRAME_RDI] = arg0;
+    frame[SYSCALL_FRAME_RSI] = arg1;
+    frame[SYSCALL_FRAME_RCX] = entry;
+    frame[SYSCALL_FRAME_R11] = PROCESS_RFLAGS_DEFAULT;
+    frame[SYSCALL_FRAME_RIP] = entry;
+    frame[SYSCALL_FRAME_CS] = GDT_USER_CODE | 3;
+    frame[SYSCALL_FRAME_RFLAGS] = PROCESS_RFLAGS_DEFAULT;
+    frame[SYSCALL_FRAME_RSP] = user_rsp;
+    frame[SYSCALL_FRAME_SS] = GDT_USER_DATA | 3;
+    thread->saved_rsp = (uint64_t)(uintptr_t)frame;
+    thread->saved_user_rsp = user_rsp;
+
+    __atomic_add_fetch(&leader->group_live, 1, __ATOMIC_ACQ_REL);
+    __atomic_add_fetch(&leader->group_threads, 1, __ATOMIC_ACQ_REL);
+    make_process_ready(tid);
+
+    serial_write_string("[OS] [PROC] thread group=");
+    serial_write_uint32((uint32_t)group_pid);
+    serial_write_string(" -> tid=");
+    serial_write_uint32((uint32_t)tid);
+    serial_write_string("\n");
+    return tid;
+}
+
 int32_t process_spawn_user_elf(const char *path)
 {
     if (!path || path[0] == '\0') {
@@ -463,21 +1214,43 @@ int32_t process_spawn_user_elf(const char *path)
     return pid;
 }
 
+/*
+ * Threads share files, windows and the address space with their group, so
+ * only the last member to exit closes the files and windows; the space
+ * goes with the leader slot once no thread can still be running on it.
+ */
 void process_exit_current(void)
 {
-    spinlock_lock(&g_process_table_lock);
-    if (!is_valid_pid(g_current_pid)) {
-        spinlock_unlock(&g_process_table_lock);
+    int32_t pid_to_exit = current_pid();
+    if (!is_valid_pid(pid_to_exit)) {
         return;
     }
 
-    int32_t pid_to_exit = g_current_pid;
-    spinlock_unlock(&g_process_table_lock);
+    process_t *proc = &g_processes[pid_to_exit];
+    int32_t group_pid = proc->group_pid;
+    process_t *leader = &g_processes[group_pid];
+    if (proc->is_thread) {
+        release_thread_stack(leader, proc->user_stack_guard_page);
+    }
+
+    if (__atomic_sub_fetch(&leader->group_live, 1, __ATOMIC_ACQ_REL) != 0) {
+        serial_write_string("[OS] [PROC] exit pid=");
+        serial_write_uint32((uint32_t)pid_to_exit);
+        serial_write_string(" group=");
+        serial_write_uint32((uint32_t)group_pid);
+        serial_write_string(" (group still running)\n");
+
+        process_cpu_t *cpu = this_cpu();
+        spinlock_lock(&cpu->lock);
+        set_process_state(pid_to_exit, PROCESS_STATE_DEAD);
+        spinlock_unlock(&cpu->lock);
+        return;
+    }
 
     uint32_t closed_fds = 0;
     uint32_t closed_dirs = 0;
-    syscall_file_close_all_for_pid(pid_to_exit, &closed_fds, &closed_dirs);
-    int32_t closed_windows = window_manager_destroy_window_for_process(pid_to_exit);
+    syscall_file_close_all_for_pid(group_pid, &closed_fds, &closed_dirs);
+    int32_t closed_windows = window_manager_destroy_window_for_process(group_pid);
 
     serial_write_string("[OS] [PROC] exit_cleanup pid=");
     serial_write_uint32((uint32_t)pid_to_exit);
@@ -489,41 +1262,47 @@ void process_exit_current(void)
     serial_write_uint32((closed_windows > 0) ? (uint32_t)closed_windows : 0);
     serial_write_string("\n");
 
-    spinlock_lock(&g_process_table_lock);
-    g_processes[pid_to_exit].state = PROCESS_STATE_DEAD;
-    spinlock_unlock(&g_process_table_lock);
+    process_cpu_t *cpu = this_cpu();
+    spinlock_lock(&cpu->lock);
+    set_process_state(pid_to_exit, PROCESS_STATE_DEAD);
+    spinlock_unlock(&cpu->lock);
 }
 
+/*
+ * The current process belongs to this CPU and cannot migrate while the
+ * kernel runs on its behalf, so the accessors below need no lock.
+ */
 int32_t process_get_current_pid(void)
 {
-    spinlock_lock(&g_process_table_lock);
-    int32_t pid = g_current_pid;
-    spinlock_unlock(&g_process_table_lock);
-    return pid;
+    return current_pid();
+}
+
+/* Owner id for files and windows: the group leader's pid. */
+int32_t process_get_current_group_pid(void)
+{
+    int32_t pid = current_pid();
+    if (!is_valid_pid(pid)) {
+        return -1;
+    }
+    return g_processes[pid].group_pid;
 }
 
 uint64_t process_get_current_user_rsp(void)
 {
-    spinlock_lock(&g_process_table_lock);
-    if (!is_valid_pid(g_current_pid)) {
-        spinlock_unlock(&g_process_table_lock);
+    int32_t pid = current_pid();
+    if (!is_valid_pid(pid)) {
         return 0;
     }
-    uint64_t rsp = g_processes[g_current_pid].saved_user_rsp;
-    spinlock_unlock(&g_process_table_lock);
-    return rsp;
+    return g_processes[pid].saved_user_rsp;
 }
 
 uint64_t process_get_current_cr3(void)
 {
-    spinlock_lock(&g_process_table_lock);
-    if (!is_valid_pid(g_current_pid)) {
-        spinlock_unlock(&g_process_table_lock);
+    int32_t pid = current_pid();
+    if (!is_valid_pid(pid)) {
         return paging_get_kernel_cr3();
     }
-    uint64_t cr3 = g_processes[g_current_pid].cr3;
-    spinlock_unlock(&g_process_table_lock);
-    return cr3;
+    return g_processes[pid].cr3;
 }
 
 uint64_t process_schedule_on_syscall(uint64_t current_saved_rsp,
@@ -535,26 +1314,28 @@ uint64_t process_schedule_on_syscall(uint64_t current_saved_rsp,
         *next_user_rsp_out = current_user_rsp;
     }
 
-    spinlock_lock(&g_process_table_lock);
+    process_cpu_t *cpu = this_cpu();
+    spinlock_lock(&cpu->lock);
 
-    if (!is_valid_pid(g_current_pid)) {
-        spinlock_unlock(&g_process_table_lock);
+    int32_t current_id = cpu->current_pid;
+    if (!is_valid_pid(current_id)) {
+        spinlock_unlock(&cpu->lock);
         serial_write_string("[OS] [PROC] Invalid current PID\n");
         return current_saved_rsp;
     }
 
-    process_t *current = &g_processes[g_current_pid];
+    process_t *current = &g_processes[current_id];
     if (current->state == PROCESS_STATE_RUNNING || current->state == PROCESS_STATE_READY) {
         current->saved_rsp = current_saved_rsp;
         current->saved_user_rsp = current_user_rsp;
-        current->state = PROCESS_STATE_READY;
+        set_process_state(current_id, PROCESS_STATE_READY);
     }
 
     if (!request_switch && current->state != PROCESS_STATE_DEAD) {
         uint64_t return_saved_rsp = current->saved_rsp;
         uint64_t return_user_rsp = current->saved_user_rsp;
-        current->state = PROCESS_STATE_RUNNING;
-        spinlock_unlock(&g_process_table_lock);
+        set_process_state(current_id, PROCESS_STATE_RUNNING);
+        spinlock_unlock(&cpu->lock);
 
         activate_process_context(current);
         if (next_user_rsp_out != NULL) {
@@ -563,21 +1344,20 @@ uint64_t process_schedule_on_syscall(uint64_t current_saved_rsp,
         return return_saved_rsp;
     }
 
-    int32_t next_pid = pick_next_ready(g_current_pid);
+    int32_t next_pid = pick_next_ready(cpu);
     if (next_pid < 0) {
-        spinlock_unlock(&g_process_table_lock);
-        serial_write_string("[OS] [PROC] No runnable process. Halting.\n");
-        halt_forever();
+        enter_idle(cpu, current_id, 1);
     }
 
-    g_current_pid = next_pid;
-    process_t *next = &g_processes[g_current_pid];
-    next->state = PROCESS_STATE_RUNNING;
+    switch_current(cpu, current_id, next_pid);
+    process_t *next = &g_processes[next_pid];
+    begin_time_slice(cpu);
 
     uint64_t next_saved_rsp = next->saved_rsp;
     uint64_t next_user_rsp = next->saved_user_rsp;
-    spinlock_unlock(&g_process_table_lock);
+    spinlock_unlock(&cpu->lock);
 
+    switch_fpu_state(current, next, NULL);
     activate_process_context(next);
 
     if (next_user_rsp_out != NULL) {
@@ -592,29 +1372,30 @@ uint64_t process_schedule_after_exit(uint64_t *next_user_rsp_out)
         *next_user_rsp_out = 0;
     }
 
-    spinlock_lock(&g_process_table_lock);
+    process_cpu_t *cpu = this_cpu();
+    spinlock_lock(&cpu->lock);
 
-    if (!is_valid_pid(g_current_pid)) {
-        spinlock_unlock(&g_process_table_lock);
+    int32_t current_id = cpu->current_pid;
+    if (!is_valid_pid(current_id)) {
+        spinlock_unlock(&cpu->lock);
         serial_write_string("[OS] [PROC] Invalid current PID on exit schedule\n");
         halt_forever();
     }
 
-    int32_t next_pid = pick_next_ready(g_current_pid);
+    int32_t next_pid = pick_next_ready(cpu);
     if (next_pid < 0) {
-        spinlock_unlock(&g_process_table_lock);
-        serial_write_string("[OS] [PROC] No runnable process after exit. Halting.\n");
-        halt_forever();
+        enter_idle(cpu, current_id, 0);
     }
 
-    g_current_pid = next_pid;
-    process_t *next = &g_processes[g_current_pid];
-    next->state = PROCESS_STATE_RUNNING;
+    switch_current(cpu, current_id, next_pid);
+    process_t *next = &g_processes[next_pid];
+    begin_time_slice(cpu);
 
     uint64_t next_saved_rsp = next->saved_rsp;
     uint64_t next_user_rsp = next->saved_user_rsp;
-    spinlock_unlock(&g_process_table_lock);
+    spinlock_unlock(&cpu->lock);
 
+    switch_fpu_state(NULL, next, NULL);
     activate_process_context(next);
 
     if (next_user_rsp_out != NULL) {
@@ -623,35 +1404,213 @@ uint64_t process_schedule_after_exit(uint64_t *next_user_rsp_out)
     return next_saved_rsp;
 }
 
-int process_user_buffer_is_valid(const void *ptr, uint64_t len)
+/*
+ * Runs on the next stack right after a context switch (syscall exit,
+ * isr_irq0, isr_reschedule, page_fault_resume_user and the idle loop call it
+ * once rsp has moved), so the previous process's kernel stack is no longer
+ * in use.
+ */
+void process_finish_switch(void)
 {
-    spinlock_lock(&g_process_table_lock);
-    if (!is_valid_pid(g_current_pid)) {
-        spinlock_unlock(&g_process_table_lock);
-        return 0;
+    process_cpu_t *cpu = this_cpu();
+    int32_t prev_pid = cpu->prev_pid;
+    if (prev_pid < 0) {
+        return;
     }
+    cpu->prev_pid = -1;
 
-    const process_t *proc = &g_processes[g_current_pid];
-    uint64_t addr = (uint64_t)(uintptr_t)ptr;
-
-    spinlock_unlock(&g_process_table_lock);
+    /* The slot may be recycled as soon as on_cpu drops, so release the group first. */
+    process_t *prev = &g_processes[prev_pid];
+    if (prev->is_thread && prev->state == PROCESS_STATE_DEAD) {
+        __atomic_fetch_sub(&g_processes[prev->group_pid].group_threads, 1, __ATOMIC_ACQ_REL);
+    }
+    __atomic_store_n(&prev->on_cpu, 0, __ATOMIC_RELEASE);
+}
 
-    if (len == 0) {
-        return 1;
+/*
+ * Timer IRQ hook. The PIT only interrupts the BSP, so the tick is charged to
+ * every online CPU's slice here. Another CPU whose slice ran out with work
+ * queued gets a reschedule IPI; idle CPUs get one while any queue holds a
+ * READY process they could steal.
+ */
+void process_scheduler_tick(void)
+{
+    uint32_t self = this_cpu_id();
+    uint32_t count = online_cpu_count();
+    uint32_t waiting = 0;
+    for (uint32_t c = 0; c < count; ++c) {
+        waiting += g_process_cpus[c].nr_ready;
+    }
+
+    for (uint32_t c = 0; c < count; ++c) {
+        process_cpu_t *cpu = &g_process_cpus[c];
+        if (cpu->current_pid < 0) {
+            if (c != self && waiting > 0) {
+                smp_send_ipi(c, SMP_RESCHEDULE_VECTOR);
+            }
+            continue;
+        }
+        uint32_t left = cpu->slice_ticks_left;
+        if (left > 1u) {
+            cpu->slice_ticks_left = left - 1u;
+            continue;
+        }
+        cpu->slice_ticks_left = 0;
+        cpu->need_resched = 1;
+        if (c != self && cpu->nr_ready > 0) {
+            smp_send_ipi(c, SMP_RESCHEDULE_VECTOR);
+        }
     }
+}
 
-    if (range_within(addr, len, proc->user_code_base, proc->user_code_limit)) {
-        return 1;
+/*
+ * Per-CPU idle loop, entered on the CPU's idle stack: by an AP once it is
+ * up, and by enter_idle when a CPU's process exits with nothing else ready.
+ * It runs whatever the local queues or a steal provide and otherwise halts
+ * until the next interrupt (a reschedule IPI, or the tick on the BSP).
+ */
+__attribute__((noreturn))
+void process_idle_loop(void)
+{
+    for (;;) {
+        __asm__ volatile ("cli" ::: "memory");
+        process_finish_switch();
+
+        process_cpu_t *cpu = this_cpu();
+        spinlock_lock(&cpu->lock);
+        int32_t next_pid = pick_next_ready(cpu);
+        if (next_pid < 0) {
+            spinlock_unlock(&cpu->lock);
+            __asm__ volatile ("sti; hlt" ::: "memory");
+            continue;
+        }
+
+        switch_current(cpu, -1, next_pid);
+        process_t *next = &g_processes[next_pid];
+        begin_time_slice(cpu);
+
+        uint64_t next_saved_rsp = next->saved_rsp;
+        uint64_t next_user_rsp = next->saved_user_rsp;
+        spinlock_unlock(&cpu->lock);
+
+        switch_fpu_state(NULL, next, NULL);
+        activate_process_context(next);
+        syscall_set_user_rsp(next_user_rsp);
+        process_resume_frame(next_saved_rsp);
     }
-    if (range_within(addr, len, proc->user_heap_base, proc->user_heap_limit)) {
-        return 1;
+}
+
+uint64_t process_idle_stack_top(uint32_t cpu_id)
+{
+    if (cpu_id >= OS_CONFIG_SMP_MAX_CPUS) {
+        return 0;
     }
-    if (range_within(addr, len, proc->user_stack_base, proc->user_stack_top)) {
-        return 1;
+    return g_process_cpus[cpu_id].idle_stack_top;
+}
+
+/*
+ * Called by isr_irq0 after the tick has been handled. saved_rsp is the
+ * interrupted context in SYSCALL_FRAME layout and fpu_area the FXSAVE image
+ * the stub restores on the way out. Only user-mode contexts are preempted:
+ * the kernel is not reentrant, and syscalls run with interrupts masked, so
+ * seeing a user CS also means no kernel lock is held on this CPU.
+ */
+uint64_t process_schedule_on_tick(uint64_t saved_rsp, void *fpu_area)
+{
+    const uint64_t *frame = (const uint64_t *)(uintptr_t)saved_rsp;
+    process_cpu_t *cpu = this_cpu();
+    if (!cpu->need_resched || (frame[SYSCALL_FRAME_CS] & 3ULL) != 3ULL) {
+        return saved_rsp;
+    }
+
+    spinlock_lock(&cpu->lock);
+    int32_t current_id = cpu->current_pid;
+    if (!is_valid_pid(current_id)) {
+        spinlock_unlock(&cpu->lock);
+        return saved_rsp;
+    }
+
+    /*
+     * Requeue the current process behind its peers first: it keeps the CPU
+     * only if nothing of equal or higher priority is ready.
+     */
+    process_t *current = &g_processes[current_id];
+    current->saved_rsp = saved_rsp;
+    current->saved_user_rsp = frame[SYSCALL_FRAME_RSP];
+    set_process_state(current_id, PROCESS_STATE_READY);
+    int32_t next_pid = pick_next_ready(cpu);
+    if (next_pid < 0 || next_pid == current_id) {
+        set_process_state(current_id, PROCESS_STATE_RUNNING);
+        begin_time_slice(cpu);
+        spinlock_unlock(&cpu->lock);
+        return saved_rsp;
+    }
+
+    switch_current(cpu, current_id, next_pid);
+    process_t *next = &g_processes[next_pid];
+    begin_time_slice(cpu);
+
+    uint64_t next_saved_rsp = next->saved_rsp;
+    uint64_t next_user_rsp = next->saved_user_rsp;
+    spinlock_unlock(&cpu->lock);
+
+    switch_fpu_state(current, next, fpu_area);
+    activate_process_context(next);
+    syscall_set_user_rsp(next_user_rsp);
+    return next_saved_rsp;
+}
+
+int process_get_sched_stats(uint32_t cpu_id, process_sched_stats_t *out)
+{
+    if (out == NULL || cpu_id >= online_cpu_count()) {
+        return -1;
     }
+
+    process_cpu_t *cpu = &g_process_cpus[cpu_id];
+    spinlock_lock(&cpu->lock);
+    out->current_pid = cpu->current_pid;
+    out->nr_ready = cpu->nr_ready;
+    out->switches = cpu->switches;
+    out->steals = cpu->steals;
+    out->stolen = cpu->stolen;
+    spinlock_unlock(&cpu->lock);
     return 0;
 }
 
+void process_print_sched_stats(void)
+{
+    uint32_t count = online_cpu_count();
+    for (uint32_t c = 0; c < count; ++c) {
+        process_sched_stats_t stats;
+        if (process_get_sched_stats(c, &stats) < 0) {
+            continue;
+        }
+        serial_write_string("[OS] [PROC] cpu=");
+        serial_write_uint32(c);
+        serial_write_string(" ready=");
+        serial_write_uint32(stats.nr_ready);
+        serial_write_string(" switches=");
+        serial_write_uint64(stats.switches);
+        serial_write_string(" steals=");
+        serial_write_uint64(stats.steals);
+        serial_write_string(" stolen=");
+        serial_write_uint64(stats.stolen);
+        serial_write_string("\n");
+    }
+}
+
+int process_user_buffer_is_valid(const void *ptr, uint64_t len)
+{
+    int32_t pid = current_pid();
+    if (!is_valid_pid(pid)) {
+        return 0;
+    }
+
+    uint64_t cr3 = g_processes[pid].cr3;
+
+    return paging_vma_range_ok(cr3, (uint64_t)(uintptr_t)ptr, len);
+}
+
 int process_user_cstring_length(const char *str, uint64_t max_len, uint64_t *len_out)
 {
     if (str == NULL || max_len == 0) {
@@ -674,55 +1633,10 @@ int process_user_cstring_length(const char *str, uint64_t max_len, uint64_t *len
 
 void *process_user_alloc(uint32_t size)
 {
-    if (!is_valid_pid(g_current_pid) || size == 0) {
-        return NULL;
-    }
-
-    process_t *proc = &g_processes[g_current_pid];
-    if (proc->user_heap_base == 0 ||
-        proc->user_heap_limit <= proc->user_heap_base ||
-        proc->user_heap_cursor < proc->user_heap_base ||
-        proc->user_heap_cursor > proc->user_heap_limit) {
-        return NULL;
-    }
-    uint64_t alloc_size = align_up_u64((uint64_t)size, 16ULL);
-
-    for (uint32_t i = 0; i < PROCESS_USER_ALLOC_MAX; ++i) {
-        user_alloc_t *slot = &proc->user_allocs[i];
-        if (!slot->used && slot->size != 0 && slot->size >= alloc_size) {
-            slot->used = 1;
-            return (void *)(uintptr_t)slot->addr;
-        }
-    }
-
-    uint32_t new_slot = PROCESS_USER_ALLOC_MAX;
-    for (uint32_t i = 0; i < PROCESS_USER_ALLOC_MAX; ++i) {
-        if (proc->user_allocs[i].size == 0) {
-            new_slot = i;
-            break;
-        }
-    }
-    if (new_slot == PROCESS_USER_ALLOC_MAX) {
-        return NULL;
-    }
-
-    uint64_t addr = align_up_u64(proc->user_heap_cursor, 16ULL);
-    uint64_t next = addr + alloc_size;
-    if (next <= addr || next > proc->user_heap_limit) {
+    if (!is_valid_pid(current_pid())) {
         return NULL;
     }
-
-    proc->user_heap_cursor = next;
-    proc->user_allocs[new_slot].used = 1;
-    proc->user_allocs[new_slot].addr = addr;
-    proc->user_allocs[new_slot].size = (uint32_t)alloc_size;
-
-    uint8_t *p = (uint8_t *)(uintptr_t)addr;
-    for (uint64_t i = 0; i < alloc_size; ++i) {
-        p[i] = 0;
-    }
-
-    return (void *)(uintptr_t)addr;
+    return user_heap_alloc(group_leader_of(current_pid()), size, 16ULL);
 }
 
 int process_user_free(void *ptr)
@@ -730,26 +1644,15 @@ int process_user_free(void *ptr)
     if (ptr == NULL) {
         return 0;
     }
-    if (!is_valid_pid(g_current_pid)) {
+    if (!is_valid_pid(current_pid())) {
         return -1;
     }
-
-    process_t *proc = &g_processes[g_current_pid];
-    uint64_t addr = (uint64_t)(uintptr_t)ptr;
-
-    for (uint32_t i = 0; i < PROCESS_USER_ALLOC_MAX; ++i) {
-        user_alloc_t *slot = &proc->user_allocs[i];
-        if (slot->used && slot->addr == addr) {
-            slot->used = 0;
-            return 0;
-        }
-    }
-    return -1;
+    return user_heap_free(group_leader_of(current_pid()), (uint64_t)(uintptr_t)ptr);
 }
 
 void *process_user_mmap(uint64_t length, uint64_t flags)
 {
-    if (!is_valid_pid(g_current_pid) || length == 0) {
+    if (!is_valid_pid(current_pid()) || length == 0) {
         return NULL;
     }
 
@@ -762,12 +1665,26 @@ void *process_user_mmap(uint64_t length, uint64_t flags)
         return NULL;
     }
 
-    return process_user_alloc((uint32_t)aligned_len);
+    if (aligned_len < PROCESS_HUGE_PAGE_SIZE) {
+        return process_user_alloc((uint32_t)aligned_len);
+    }
+
+    /*
+     * Large mappings (framebuffers, image buffers) start on a 2 MiB boundary
+     * so their whole blocks can be faulted in as single 2 MiB pages. If the
+     * VMA cannot be split they simply stay on 4 KiB pages.
+     */
+    void *ptr = user_heap_alloc(group_leader_of(current_pid()), (uint32_t)aligned_len,
+                                PROCESS_HUGE_PAGE_SIZE);
+    if (ptr != NULL) {
+        (void)paging_vma_set_huge(g_processes[current_pid()].cr3, (uint64_t)(uintptr_t)ptr, aligned_len);
+    }
+    return ptr;
 }
 
 uint64_t process_signal_set_handler(int32_t signum, uint64_t handler)
 {
-    if (!is_valid_pid(g_current_pid)) {
+    if (!is_valid_pid(current_pid())) {
         return (uint64_t)-1;
     }
     if (signum <= 0 || signum >= PROCESS_SIGNAL_MAX) {
@@ -779,9 +1696,11 @@ uint64_t process_signal_set_handler(int32_t signum, uint64_t handler)
         return (uint64_t)-1;
     }
 
-    process_t *proc = &g_processes[g_current_pid];
-    uint64_t previous = proc->signal_handlers[(uint32_t)signum];
-    proc->signal_handlers[(uint32_t)signum] = handler;
+    process_t *leader = group_leader_of(current_pid());
+    spinlock_lock(&leader->group_lock);
+    uint64_t previous = leader->signal_handlers[(uint32_t)signum];
+    leader->signal_handlers[(uint32_t)signum] = handler;
+    spinlock_unlock(&leader->group_lock);
     return previous;
 }
 
@@ -794,8 +1713,7 @@ int process_signal_deliver(int32_t pid, int32_t signum)
         return -1;
     }
 
-    process_t *proc = &g_processes[pid];
-    uint64_t handler = proc->signal_handlers[(uint32_t)signum];
+    uint64_t handler = group_leader_of(pid)->signal_handlers[(uint32_t)signum];
 
     if (handler == 0) {
         return 0;
@@ -812,14 +1730,13 @@ int process_signal_deliver(int32_t pid, int32_t signum)
 
 int process_is_guard_page_fault(uint64_t fault_addr)
 {
-    if (!is_valid_pid(g_current_pid)) {
+    if (!is_valid_pid(current_pid())) {
         return 0;
     }
 
-    const process_t *proc = &g_processes[g_current_pid];
-    uint64_t fault_page = fault_addr & PAGE_MASK;
-    return (fault_page == proc->user_heap_guard_page ||
-            fault_page == proc->user_stack_guard_page);
+    paging_vma_t vma;
+    return paging_vma_find(g_processes[current_pid()].cr3, fault_addr, &vma) == 0 &&
+           vma.backing == PAGING_VMA_GUARD;
 }
 
 process_capability_mask_t process_default_capabilities(void)
@@ -829,10 +1746,10 @@ process_capability_mask_t process_default_capabilities(void)
 
 process_capability_mask_t process_get_current_capabilities(void)
 {
-    if (!is_valid_pid(g_current_pid)) {
+    if (!is_valid_pid(current_pid())) {
         return 0;
     }
-    return g_processes[g_current_pid].capability_mask;
+    return g_processes[current_pid()].capability_mask;
 }
 
 int process_current_has_capability(process_capability_mask_t capability)
@@ -855,6 +1772,25 @@ int process_set_capabilities(int32_t pid, process_capability_mask_t capabilities
     return 0;
 }
 
+int process_set_priority(int32_t pid, uint8_t priority)
+{
+    if (!is_valid_pid(pid) || priority >= PROCESS_PRIORITY_LEVELS) {
+        return -1;
+    }
+
+    process_t *proc = &g_processes[pid];
+    process_cpu_t *cpu = lock_process_cpu(proc);
+    if (proc->state == PROCESS_STATE_READY) {
+        runq_remove(pid);
+        proc->priority = priority;
+        runq_push_tail(pid);
+    } else {
+        proc->priority = priority;
+    }
+    spinlock_unlock(&cpu->lock);
+    return 0;
+}
+
 int process_get_capabilities(int32_t pid, process_capability_mask_t *capabilities_out)
 {
     if (!is_valid_pid(pid) || capabilities_out == NULL) {
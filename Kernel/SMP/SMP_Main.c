@@ -1,13 +1,614 @@
 #include "SMP_Main.h"
 
+#include "../DefaultLibrary/DefaultLibrary.h"
+#include "../GDT/GDT_Main.h"
+#include "../IDT/IDT_Main.h"
+#include "../KernelConfig.h"
+#include "../Paging/Paging_Main.h"
+#include "../Paging/TLB_Shootdown.h"
+#include "../ProcessManager/ProcessManager.h"
 #include "../Serial.h"
+#include "../Sync/Spinlock.h"
+#include "../Syscall/Syscall_Main.h"
+#include "../Timer/Timer.h"
 
+#define IA32_APIC_BASE       0x1Bu
+#define APIC_BASE_X2APIC     (1ULL << 10)
+#define APIC_BASE_ENABLE     (1ULL << 11)
+#define APIC_BASE_ADDR_MASK  0x000FFFFFFFFFF000ULL
+
+#define LAPIC_REG_ID         0x020u
+#define LAPIC_REG_EOI        0x0B0u
+#define LAPIC_REG_SVR        0x0F0u
+#define LAPIC_REG_ICR_LOW    0x300u
+#define LAPIC_REG_ICR_HIGH   0x310u
+#define LAPIC_SVR_ENABLE     (1u << 8)
+#define LAPIC_ICR_INIT       (5u << 8)
+#define LAPIC_ICR_STARTUP    (6u << 8)
+#define LAPIC_ICR_PENDING    (1u << 12)
+#define LAPIC_ICR_ASSERT     (1u << 14)
+
+/* x2APIC exposes the same registers as MSRs at 0x800 + offset / 16. */
+#define X2APIC_MSR(reg)      (0x800u + ((reg) >> 4))
+#define X2APIC_MSR_ICR       0x830u
+
+#define ACPI_MADT_LAPIC          0u
+#define ACPI_MADT_X2APIC         9u
+#define ACPI_MADT_ENABLED        (1u << 0)
+#define ACPI_MADT_ONLINE_CAPABLE (1u << 1)
+
+#define EFI_BOOT_SERVICES_CODE   3u
+#define EFI_CONVENTIONAL_MEMORY  7u
+
+/* The SIPI vector is a page number, so the trampoline lives below 1 MiB. */
+#define SMP_TRAMPOLINE_MIN       0x1000ULL
+#define SMP_TRAMPOLINE_LIMIT     0x100000ULL
+#define SMP_EFER_LMA             (1ULL << 10)
+#define SMP_AP_START_TIMEOUT_MS  200u
+#define SMP_AP_CLAIMED           0xFFFFFFFFu
+
+typedef struct __attribute__((packed)) {
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} acpi_rsdp_t;
+
+typedef struct __attribute__((packed)) {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} acpi_sdt_header_t;
+
+typedef struct __attribute__((packed)) {
+    acpi_sdt_header_t header;
+    uint32_t lapic_address;
+    uint32_t flags;
+} acpi_madt_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t type;
+    uint8_t length;
+} acpi_madt_entry_t;
+
+typedef struct __attribute__((packed)) {
+    acpi_madt_entry_t entry;
+    uint8_t processor_id;
+    uint8_t apic_id;
+    uint32_t flags;
+} acpi_madt_lapic_t;
+
+typedef struct __attribute__((packed)) {
+    acpi_madt_entry_t entry;
+    uint16_t reserved;
+    uint32_t x2apic_id;
+    uint32_t flags;
+    uint32_t processor_uid;
+} acpi_madt_x2apic_t;
+
+/* Mirrors the data block at the end of SMP_Trampoline.asm. */
+typedef struct __attribute__((packed)) {
+    uint16_t gdt_limit;
+    uint32_t gdt_base;
+    uint16_t pad0;
+    uint32_t long_mode_ip;
+    uint16_t long_mode_cs;
+    uint16_t pad1;
+    uint32_t cr3_low;
+    uint32_t efer;
+    uint64_t cr4;
+    uint64_t cr0;
+    uint64_t kernel_cr3;
+    uint64_t stack_top;
+    uint64_t entry;
+    uint64_t cpu_index;
+} smp_trampoline_data_t;
+
+extern uint8_t smp_trampoline_start[];
+extern uint8_t smp_trampoline_data[];
+extern uint8_t smp_trampoline_end[];
+
+/*
+ * g_cpu_apic_ids[0..g_cpu_present) are the CPUs the MADT reported, BSP
+ * first; the first g_cpu_count of them are online. CPU ids are indices into
+ * this table.
+ */
 static uint32_t g_cpu_count = 1;
+static uint32_t g_cpu_present = 1;
+static uint32_t g_cpu_apic_ids[OS_CONFIG_SMP_MAX_CPUS];
+static uint64_t g_trampoline_phys = 0;
+static volatile uint32_t g_ap_online_ack = 0;
+/*
+ * Index of the AP being started until it or the BSP claims the start:
+ * the AP swaps in SMP_AP_CLAIMED on entry, the BSP swaps in 0 on timeout.
+ * An AP that loses parks before touching any per-CPU state.
+ */
+static volatile uint32_t g_ap_start_claim = 0;
+static volatile uint32_t *g_lapic_mmio = NULL;
+static uint8_t g_lapic_x2apic = 0;
+static uint8_t g_lapic_ready = 0;
+
+/*
+ * Big kernel lock. Syscalls and user page faults hold it from entry until
+ * they hand off to the scheduler, so subsystems written for one CPU
+ * (window manager, swap tracking, page-table population, ...) never see
+ * two CPUs at once. It nests for a fault taken while copying user memory
+ * inside a syscall. The scheduler, heap, page allocator and TLB shootdown
+ * have their own locks and run outside it.
+ */
+static spinlock_t g_kernel_lock;
+static volatile uint32_t g_kernel_lock_owner = SMP_CPU_INVALID;
+static uint32_t g_kernel_lock_depth = 0;
+
+static inline uint64_t smp_rdmsr(uint32_t msr)
+{
+    uint32_t lo;
+    uint32_t hi;
+    __asm__ volatile ("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void smp_wrmsr(uint32_t msr, uint64_t value)
+{
+    __asm__ volatile ("wrmsr" :: "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)) : "memory");
+}
+
+static inline uint64_t smp_irq_save_disable(void)
+{
+    uint64_t flags;
+    __asm__ volatile ("pushfq; popq %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static inline void smp_irq_restore(uint64_t flags)
+{
+    if (flags & (1ULL << 9)) {
+        __asm__ volatile ("sti" ::: "memory");
+    }
+}
+
+static uint32_t lapic_read(uint32_t reg)
+{
+    if (g_lapic_x2apic) {
+        return (uint32_t)smp_rdmsr(X2APIC_MSR(reg));
+    }
+    return g_lapic_mmio[reg / 4u];
+}
+
+static void lapic_write(uint32_t reg, uint32_t value)
+{
+    if (g_lapic_x2apic) {
+        smp_wrmsr(X2APIC_MSR(reg), value);
+        return;
+    }
+    g_lapic_mmio[reg / 4u] = value;
+}
+
+static uint32_t lapic_id(void)
+{
+    uint32_t id = lapic_read(LAPIC_REG_ID);
+    return g_lapic_x2apic ? id : (id >> 24);
+}
+
+static void lapic_send_icr(uint32_t apic_id, uint32_t icr_low)
+{
+    if (g_lapic_x2apic) {
+        smp_wrmsr(X2APIC_MSR_ICR, ((uint64_t)apic_id << 32) | icr_low);
+        return;
+    }
+
+    /* ICR high and low must not be split by an IPI sent from an interrupt. */
+    uint64_t irq_flags = smp_irq_save_disable();
+    while ((lapic_read(LAPIC_REG_ICR_LOW) & LAPIC_ICR_PENDING) != 0) {
+        __asm__ volatile ("pause");
+    }
+    lapic_write(LAPIC_REG_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_REG_ICR_LOW, icr_low);
+    smp_irq_restore(irq_flags);
+}
+
+/*
+ * The local APIC carries IPIs between CPUs. Firmware leaves it either in
+ * xAPIC mode (MMIO page) or x2APIC mode (MSRs); both are supported.
+ */
+static int lapic_init(void)
+{
+    uint32_t eax = 0, ebx = 0, ecx = 0, edx = 0;
+    __asm__ volatile ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1u), "c"(0u));
+    if ((edx & (1u << 9)) == 0) {
+        return -1;
+    }
+
+    uint64_t base = smp_rdmsr(IA32_APIC_BASE);
+    if ((base & APIC_BASE_ENABLE) == 0) {
+        base |= APIC_BASE_ENABLE;
+        smp_wrmsr(IA32_APIC_BASE, base);
+    }
+    if ((base & APIC_BASE_X2APIC) != 0) {
+        g_lapic_x2apic = 1;
+    } else {
+        g_lapic_mmio = (volatile uint32_t *)map_mmio_virt(base & APIC_BASE_ADDR_MASK);
+        if (g_lapic_mmio == NULL) {
+            return -1;
+        }
+    }
+
+    lapic_write(LAPIC_REG_SVR, LAPIC_SVR_ENABLE | SMP_SPURIOUS_VECTOR);
+    g_lapic_ready = 1;
+    return 0;
+}
+
+/* APs come up with the APIC in xAPIC mode; match the mode the BSP found. */
+static void lapic_init_ap(void)
+{
+    uint64_t base = smp_rdmsr(IA32_APIC_BASE);
+    uint64_t want = base | APIC_BASE_ENABLE | (g_lapic_x2apic ? APIC_BASE_X2APIC : 0);
+    if (want != base) {
+        smp_wrmsr(IA32_APIC_BASE, want);
+    }
+    lapic_write(LAPIC_REG_SVR, LAPIC_SVR_ENABLE | SMP_SPURIOUS_VECTOR);
+}
+
+static int acpi_checksum_ok(const void *table, uint32_t length)
+{
+    const uint8_t *bytes = (const uint8_t *)table;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; ++i) {
+        sum = (uint8_t)(sum + bytes[i]);
+    }
+    return sum == 0;
+}
+
+static int acpi_signature_is(const char *signature, const char *want, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; ++i) {
+        if (signature[i] != want[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* ACPI tables sit in firmware-reserved RAM, which the kernel identity maps. */
+static const acpi_madt_t *acpi_find_madt(uint64_t rsdp_phys)
+{
+    const acpi_rsdp_t *rsdp = (const acpi_rsdp_t *)(uintptr_t)rsdp_phys;
+    if (rsdp == NULL || !acpi_signature_is(rsdp->signature, "RSD PTR ", 8) ||
+        !acpi_checksum_ok(rsdp, 20)) {
+        return NULL;
+    }
+
+    int use_xsdt = (rsdp->revision >= 2 && rsdp->xsdt_address != 0);
+    uint64_t root_phys = use_xsdt ? rsdp->xsdt_address : rsdp->rsdt_address;
+    const acpi_sdt_header_t *root = (const acpi_sdt_header_t *)(uintptr_t)root_phys;
+    if (root == NULL || root->length < sizeof(*root) || !acpi_checksum_ok(root, root->length)) {
+        return NULL;
+    }
+
+    uint32_t entry_size = use_xsdt ? 8u : 4u;
+    uint32_t entries = (root->length - (uint32_t)sizeof(*root)) / entry_size;
+    const uint8_t *table = (const uint8_t *)(root + 1);
+    for (uint32_t i = 0; i < entries; ++i) {
+        uint64_t phys = 0;
+        memcpy(&phys, table + (uint64_t)i * entry_size, entry_size);
+        const acpi_sdt_header_t *sdt = (const acpi_sdt_header_t *)(uintptr_t)phys;
+        if (sdt != NULL && acpi_signature_is(sdt->signature, "APIC", 4) &&
+            sdt->length >= sizeof(acpi_madt_t) && acpi_checksum_ok(sdt, sdt->length)) {
+            return (const acpi_madt_t *)sdt;
+        }
+    }
+    return NULL;
+}
+
+static void smp_register_cpu(uint32_t apic_id, uint32_t flags)
+{
+    if ((flags & (ACPI_MADT_ENABLED | ACPI_MADT_ONLINE_CAPABLE)) == 0) {
+        return;
+    }
+    if (!g_lapic_x2apic && apic_id >= 0xFFu) {
+        return;
+    }
+    for (uint32_t i = 0; i < g_cpu_present; ++i) {
+        if (g_cpu_apic_ids[i] == apic_id) {
+            return;
+        }
+    }
+    if (g_cpu_present >= OS_CONFIG_SMP_MAX_CPUS) {
+        serial_write_string("[OS] [SMP] Ignoring APIC id=");
+        serial_write_uint32(apic_id);
+        serial_write_string(" beyond OS_CONFIG_SMP_MAX_CPUS\n");
+        return;
+    }
+    g_cpu_apic_ids[g_cpu_present++] = apic_id;
+}
+
+/* Collects the LAPIC ids of the enabled CPUs after the BSP's own entry. */
+static void smp_parse_madt(uint64_t rsdp_phys)
+{
+    const acpi_madt_t *madt = acpi_find_madt(rsdp_phys);
+    if (madt == NULL) {
+        serial_write_string("[OS] [SMP] No ACPI MADT, running on the BSP only\n");
+        return;
+    }
+
+    const uint8_t *cursor = (const uint8_t *)(madt + 1);
+    const uint8_t *end = (const uint8_t *)madt + madt->header.length;
+    while (cursor + sizeof(acpi_madt_entry_t) <= end) {
+        const acpi_madt_entry_t *entry = (const acpi_madt_entry_t *)cursor;
+        if (entry->length < sizeof(acpi_madt_entry_t) || cursor + entry->length > end) {
+            break;
+        }
+        if (entry->type == ACPI_MADT_LAPIC && entry->length >= sizeof(acpi_madt_lapic_t)) {
+            const acpi_madt_lapic_t *lapic = (const acpi_madt_lapic_t *)cursor;
+            smp_register_cpu(lapic->apic_id, lapic->flags);
+        } else if (entry->type == ACPI_MADT_X2APIC && entry->length >= sizeof(acpi_madt_x2apic_t)) {
+            const acpi_madt_x2apic_t *x2apic = (const acpi_madt_x2apic_t *)cursor;
+            smp_register_cpu(x2apic->x2apic_id, x2apic->flags);
+        }
+        cursor += entry->length;
+    }
+}
+
+/*
+ * Picks the highest free page below 1 MiB for the trampoline. Conventional
+ * and boot-services code pages are free after ExitBootServices, and the
+ * page allocator never hands out low memory, so the page stays ours.
+ */
+static uint64_t smp_find_trampoline_page(const BOOT_INFO *boot_info)
+{
+    uint64_t best = 0;
+    uint64_t desc_size = boot_info->MemoryMapDescriptorSize;
+    if (boot_info->MemoryMap == NULL || desc_size == 0) {
+        return 0;
+    }
 
-void smp_init(void)
+    uint64_t count = boot_info->MemoryMapSize / desc_size;
+    for (uint64_t i = 0; i < count; ++i) {
+        const EFI_MEMORY_DESCRIPTOR *desc = (const EFI_MEMORY_DESCRIPTOR *)(
+            (const uint8_t *)boot_info->MemoryMap + i * desc_size);
+        if (desc->Type != EFI_CONVENTIONAL_MEMORY && desc->Type != EFI_BOOT_SERVICES_CODE) {
+            continue;
+        }
+        uint64_t start = desc->PhysicalStart;
+        uint64_t end = start + desc->NumberOfPages * PAGE_SIZE;
+        if (start < SMP_TRAMPOLINE_MIN) {
+            start = SMP_TRAMPOLINE_MIN;
+        }
+        if (end > SMP_TRAMPOLINE_LIMIT) {
+            end = SMP_TRAMPOLINE_LIMIT;
+        }
+        if (end < start + PAGE_SIZE) {
+            continue;
+        }
+        uint64_t page = (end - PAGE_SIZE) & ~(PAGE_SIZE - 1ULL);
+        if (page >= start && page > best) {
+            best = page;
+        }
+    }
+    return best;
+}
+
+void smp_init(const BOOT_INFO *boot_info)
 {
     g_cpu_count = 1;
-    serial_write_string("[OS] [SMP] BSP online, AP startup pending\n");
+    g_cpu_present = 1;
+    g_cpu_apic_ids[0] = 0;
+    if (lapic_init() < 0) {
+        serial_write_string("[OS] [SMP] No local APIC, IPIs unavailable\n");
+        return;
+    }
+
+    g_cpu_apic_ids[0] = lapic_id();
+    serial_write_string("[OS] [SMP] BSP local APIC id=");
+    serial_write_uint32(g_cpu_apic_ids[0]);
+    serial_write_string(g_lapic_x2apic ? " (x2APIC)\n" : "\n");
+
+#if OS_CONFIG_SMP_ENABLED
+    if (boot_info != NULL && boot_info->AcpiRsdp != 0) {
+        smp_parse_madt(boot_info->AcpiRsdp);
+    } else {
+        serial_write_string("[OS] [SMP] No ACPI RSDP from the loader, running on the BSP only\n");
+    }
+    if (g_cpu_present > 1) {
+        g_trampoline_phys = smp_find_trampoline_page(boot_info);
+    }
+#else
+    (void)boot_info;
+#endif
+
+    serial_write_string("[OS] [SMP] CPUs present=");
+    serial_write_uint32(g_cpu_present);
+    serial_write_string("\n");
+}
+
+/* Busy-waits at least `ms` milliseconds on the PIT tick; interrupts must be on. */
+static void smp_delay_ms(uint32_t ms)
+{
+    uint32_t hz = timer_hz();
+    uint64_t ticks = (hz == 0) ? 1ULL : (((uint64_t)ms * hz + 999ULL) / 1000ULL);
+    uint64_t target = timer_ticks() + ticks + 1ULL;
+    while (timer_ticks() < target) {
+        __asm__ volatile ("pause");
+    }
+}
+
+/* Roughly `us` microseconds; each port 0x80 write takes about one. */
+static void smp_delay_us(uint32_t us)
+{
+    for (uint32_t i = 0; i < us; ++i) {
+        __asm__ volatile ("outb %%al, $0x80" : : "a"(0) : "memory");
+    }
+}
+
+/*
+ * First C code on an AP, on its idle stack with the kernel page tables. It
+ * sets up the per-CPU descriptor tables, APIC and syscall MSRs, tells the
+ * BSP it is up and becomes that CPU's scheduler.
+ */
+__attribute__((noreturn))
+static void smp_ap_main(uint64_t cpu_index)
+{
+    /* Only this CPU's own APIC is touched before the start is claimed. */
+    lapic_init_ap();
+
+    uint32_t expected = (uint32_t)cpu_index;
+    if (smp_get_current_cpu_id() != (uint32_t)cpu_index ||
+        !__atomic_compare_exchange_n(&g_ap_start_claim, &expected, SMP_AP_CLAIMED, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        /* Answered after the BSP gave up on it: stay out of the kernel. */
+        for (;;) {
+            __asm__ volatile ("cli; hlt");
+        }
+    }
+
+    init_gdt();
+    idt_load_current_cpu();
+    syscall_init();
+    tlb_shootdown_set_active_cr3(paging_get_kernel_cr3());
+
+    __atomic_store_n(&g_ap_online_ack, (uint32_t)cpu_index, __ATOMIC_RELEASE);
+    process_idle_loop();
+}
+
+static int smp_start_ap(uint32_t cpu_index, const smp_trampoline_data_t *template_data)
+{
+    uint64_t stack_top = process_idle_stack_top(cpu_index);
+    if (stack_top == 0) {
+        return -1;
+    }
+
+    smp_trampoline_data_t *data = (smp_trampoline_data_t *)(uintptr_t)(
+        g_trampoline_phys + (uint64_t)(smp_trampoline_data - smp_trampoline_start));
+    *data = *template_data;
+    data->stack_top = stack_top;
+    data->cpu_index = cpu_index;
+
+    __atomic_store_n(&g_ap_online_ack, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&g_ap_start_claim, cpu_index, __ATOMIC_RELEASE);
+    uint32_t apic_id = g_cpu_apic_ids[cpu_index];
+    uint32_t vector = (uint32_t)(g_trampoline_phys >> 12);
+
+    lapic_send_icr(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT);
+    smp_delay_ms(10);
+    for (uint32_t attempt = 0; attempt < 2; ++attempt) {
+        lapic_send_icr(apic_id, LAPIC_ICR_STARTUP | LAPIC_ICR_ASSERT | vector);
+        smp_delay_us(200);
+        if (__atomic_load_n(&g_ap_online_ack, __ATOMIC_ACQUIRE) == cpu_index) {
+            return 0;
+        }
+    }
+
+    uint64_t deadline = timer_ticks() + 1ULL +
+        ((uint64_t)SMP_AP_START_TIMEOUT_MS * timer_hz() + 999ULL) / 1000ULL;
+    while (timer_ticks() < deadline) {
+        if (__atomic_load_n(&g_ap_online_ack, __ATOMIC_ACQUIRE) == cpu_index) {
+            return 0;
+        }
+        __asm__ volatile ("pause");
+    }
+
+    /*
+     * An AP that already claimed the start is running kernel code as this
+     * index and only needs more time; one that has not is sent back to
+     * wait-for-SIPI so it cannot come up later on stale state.
+     */
+    uint32_t expected = cpu_index;
+    if (!__atomic_compare_exchange_n(&g_ap_start_claim, &expected, 0, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        deadline = timer_ticks() + 1ULL +
+            ((uint64_t)SMP_AP_START_TIMEOUT_MS * timer_hz() + 999ULL) / 1000ULL;
+        while (timer_ticks() < deadline) {
+            if (__atomic_load_n(&g_ap_online_ack, __ATOMIC_ACQUIRE) == cpu_index) {
+                return 0;
+            }
+            __asm__ volatile ("pause");
+        }
+    }
+    lapic_send_icr(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT);
+    return -1;
+}
+
+/*
+ * INIT-SIPI-SIPI every AP the MADT reported, one at a time. Runs on the BSP
+ * with the kernel page tables active and interrupts on (the delays count
+ * timer ticks), after the process manager has set up the idle stacks.
+ */
+void smp_start_aps(void)
+{
+#if OS_CONFIG_SMP_ENABLED
+    if (g_cpu_present <= 1 || !g_lapic_ready) {
+        return;
+    }
+    if (g_trampoline_phys == 0) {
+        serial_write_string("[OS] [SMP] No free page below 1 MiB for the AP trampoline\n");
+        g_cpu_present = 1;
+        return;
+    }
+
+    uint64_t kernel_cr3 = paging_get_kernel_cr3();
+    if (kernel_cr3 >= 0x100000000ULL) {
+        serial_write_string("[OS] [SMP] Kernel PML4 above 4 GiB, APs cannot load it in real mode\n");
+        g_cpu_present = 1;
+        return;
+    }
+
+    uint64_t size = (uint64_t)(smp_trampoline_end - smp_trampoline_start);
+    memcpy((void *)(uintptr_t)g_trampoline_phys, smp_trampoline_start, (size_t)size);
+
+    smp_trampoline_data_t template_data =
+        *(const smp_trampoline_data_t *)(const void *)smp_trampoline_data;
+    uint64_t cr0 = 0;
+    uint64_t cr4 = 0;
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(cr0));
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(cr4));
+    template_data.gdt_base += (uint32_t)g_trampoline_phys;
+    template_data.long_mode_ip += (uint32_t)g_trampoline_phys;
+    template_data.cr3_low = (uint32_t)kernel_cr3;
+    template_data.efer = (uint32_t)(smp_rdmsr(0xC0000080u) & ~SMP_EFER_LMA);
+    template_data.cr4 = cr4;
+    template_data.cr0 = cr0;
+    template_data.kernel_cr3 = kernel_cr3;
+    template_data.entry = (uint64_t)(uintptr_t)smp_ap_main;
+
+    uint32_t present = g_cpu_present;
+    for (uint32_t cpu = 1; cpu < present; ++cpu) {
+        if (smp_start_ap(cpu, &template_data) < 0) {
+            serial_write_string("[OS] [SMP] AP apic id=");
+            serial_write_uint32(g_cpu_apic_ids[cpu]);
+            serial_write_string(" did not start\n");
+            /* Keep the lookup table to the CPUs that run kernel code. */
+            g_cpu_present = cpu;
+            break;
+        }
+        __atomic_store_n(&g_cpu_count, cpu + 1u, __ATOMIC_RELEASE);
+        serial_write_string("[OS] [SMP] AP ");
+        serial_write_uint32(cpu);
+        serial_write_string(" online (apic id=");
+        serial_write_uint32(g_cpu_apic_ids[cpu]);
+        serial_write_string(")\n");
+    }
+
+    serial_write_string("[OS] [SMP] CPUs online=");
+    serial_write_uint32(g_cpu_count);
+    serial_write_string("\n");
+#endif
+}
+
+/* Reschedule IPI: isr_reschedule runs the scheduler after the EOI. */
+void smp_reschedule_ipi(void)
+{
+    smp_lapic_eoi();
 }
 
 uint32_t smp_get_cpu_count(void)
@@ -15,7 +616,70 @@ uint32_t smp_get_cpu_count(void)
     return g_cpu_count;
 }
 
+/*
+ * Looks across every present CPU: an AP needs its id before it is online.
+ * A CPU outside the table gets SMP_CPU_INVALID, never another CPU's slot.
+ */
 uint32_t smp_get_current_cpu_id(void)
 {
+    if (g_cpu_present <= 1 || !g_lapic_ready) {
+        return 0;
+    }
+    uint32_t id = lapic_id();
+    for (uint32_t i = 0; i < g_cpu_present; ++i) {
+        if (g_cpu_apic_ids[i] == id) {
+            return i;
+        }
+    }
+    return SMP_CPU_INVALID;
+}
+
+int smp_lapic_ready(void)
+{
+    return g_lapic_ready;
+}
+
+/* Fixed-delivery IPI to one CPU, addressed by its index. */
+int smp_send_ipi(uint32_t cpu_id, uint8_t vector)
+{
+    if (!g_lapic_ready || cpu_id >= g_cpu_count) {
+        return -1;
+    }
+
+    lapic_send_icr(g_cpu_apic_ids[cpu_id], LAPIC_ICR_ASSERT | vector);
     return 0;
 }
+
+void smp_lapic_eoi(void)
+{
+    if (g_lapic_ready) {
+        lapic_write(LAPIC_REG_EOI, 0);
+    }
+}
+
+/* Interrupts must be off, as they are on syscall and fault entry. */
+void smp_kernel_lock(void)
+{
+    uint32_t cpu = smp_get_current_cpu_id();
+    if (__atomic_load_n(&g_kernel_lock_owner, __ATOMIC_RELAXED) == cpu) {
+        g_kernel_lock_depth++;
+        return;
+    }
+
+    while (!spinlock_trylock(&g_kernel_lock)) {
+        /* The holder may be waiting for this CPU to flush a shootdown. */
+        tlb_shootdown_poll();
+        __asm__ volatile ("pause");
+    }
+    __atomic_store_n(&g_kernel_lock_owner, cpu, __ATOMIC_RELAXED);
+    g_kernel_lock_depth = 1;
+}
+
+void smp_kernel_unlock(void)
+{
+    if (g_kernel_lock_depth == 0 || --g_kernel_lock_depth != 0) {
+        return;
+    }
+    __atomic_store_n(&g_kernel_lock_owner, SMP_CPU_INVALID, __ATOMIC_RELAXED);
+    spinlock_unlock(&g_kernel_lock);
+}
@@ -2,6 +2,23 @@
 
 #include <stdint.h>
 
-void smp_init(void);
+#include "../Kernel_Main.h"
+
+/* Local APIC vectors; kept above the remapped PIC range (32..47). */
+#define SMP_TLB_SHOOTDOWN_VECTOR 0xF0u
+#define SMP_RESCHEDULE_VECTOR    0xF1u
+#define SMP_SPURIOUS_VECTOR      0xFFu
+
+/* smp_get_current_cpu_id on a CPU that is not in the lookup table. */
+#define SMP_CPU_INVALID 0xFFFFFFFFu
+
+void smp_init(const BOOT_INFO *boot_info);
+void smp_start_aps(void);
+void smp_reschedule_ipi(void);
 uint32_t smp_get_cpu_count(void);
 uint32_t smp_get_current_cpu_id(void);
+int smp_lapic_ready(void);
+int smp_send_ipi(uint32_t cpu_id, uint8_t vector);
+void smp_lapic_eoi(void);
+void smp_kernel_lock(void);
+void smp_kernel_unlock(void);
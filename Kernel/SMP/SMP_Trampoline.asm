@@ -0,0 +1,100 @@
+BITS 16
+
+global smp_trampoline_start
+global smp_trampoline_data
+global smp_trampoline_end
+
+; Selectors of the temporary GDT below, not of the kernel GDT.
+%define TRAMP_CODE64 0x08
+%define TRAMP_DATA   0x10
+
+%define CR0_PE       0x00000001
+%define CR0_PG       0x80000000
+%define CR4_PAE      0x00000020
+%define MSR_EFER     0xC0000080
+
+SECTION .text
+
+; Copied to a free page below 1 MiB by smp_start_aps. The startup IPI
+; starts an AP here in real mode with CS = page >> 4 and IP = 0, so the
+; 16-bit part addresses everything relative to the copy through DS = CS and
+; the 64-bit part is RIP-relative. smp_trampoline_data is patched per AP.
+smp_trampoline_start:
+    cli
+    cld
+    mov ax, cs
+    mov ds, ax
+
+    o32 lgdt [tramp_gdtr - smp_trampoline_start]
+
+    ; Long mode straight from real mode: PAE, the kernel PML4, EFER.LME,
+    ; then PE and PG together. CR4 bits such as PCIDE are only legal once
+    ; long mode is active, so the BSP's full CR4 is loaded afterwards.
+    mov eax, CR4_PAE
+    mov cr4, eax
+    mov eax, [tramp_cr3_low - smp_trampoline_start]
+    mov cr3, eax
+    mov ecx, MSR_EFER
+    mov eax, [tramp_efer - smp_trampoline_start]
+    xor edx, edx
+    wrmsr
+    mov eax, cr0
+    or eax, CR0_PE | CR0_PG
+    mov cr0, eax
+
+    o32 jmp far [tramp_far - smp_trampoline_start]
+
+BITS 64
+tramp_long_mode:
+    mov ax, TRAMP_DATA
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+
+    mov rax, [rel tramp_cr4]
+    mov cr4, rax
+    mov rax, [rel tramp_cr0]
+    mov cr0, rax
+    mov rax, [rel tramp_kernel_cr3]
+    mov cr3, rax
+
+    mov rsp, [rel tramp_stack]
+    mov rdi, [rel tramp_cpu]
+    mov rax, [rel tramp_entry]
+    call rax                ; smp_ap_main does not return
+
+.hang:
+    cli
+    hlt
+    jmp .hang
+
+align 8
+tramp_gdt:
+    dq 0
+    dq 0x00AF9A000000FFFF   ; 64-bit kernel code
+    dq 0x00CF92000000FFFF   ; kernel data
+tramp_gdt_end:
+
+; Layout must match smp_trampoline_data_t in SMP_Main.c. The two address
+; fields hold offsets from smp_trampoline_start; the BSP adds the page base.
+align 8
+smp_trampoline_data:
+tramp_gdtr:
+    dw tramp_gdt_end - tramp_gdt - 1
+    dd tramp_gdt - smp_trampoline_start
+    dw 0
+tramp_far:
+    dd tramp_long_mode - smp_trampoline_start
+    dw TRAMP_CODE64
+    dw 0
+tramp_cr3_low:      dd 0
+tramp_efer:         dd 0
+tramp_cr4:          dq 0
+tramp_cr0:          dq 0
+tramp_kernel_cr3:   dq 0
+tramp_stack:        dq 0
+tramp_entry:        dq 0
+tramp_cpu:          dq 0
+smp_trampoline_end:
+
+section .note.GNU-stack noalloc noexec nowrite progbits
@@ -32,6 +32,17 @@ static inline void spinlock_lock(spinlock_t *lock)
     }
 }
 
+static inline int spinlock_trylock(spinlock_t *lock)
+{
+    if (lock == NULL) {
+        return 0;
+    }
+    if (__atomic_load_n(&lock->value, __ATOMIC_RELAXED) != 0u) {
+        return 0;
+    }
+    return __atomic_exchange_n(&lock->value, 1u, __ATOMIC_ACQUIRE) == 0u;
+}
+
 static inline void spinlock_unlock(spinlock_t *lock)
 {
     if (lock == NULL) {
@@ -39,3 +50,70 @@ static inline void spinlock_unlock(spinlock_t *lock)
     }
     __atomic_store_n(&lock->value, 0u, __ATOMIC_RELEASE);
 }
+
+/*
+ * Optional hold/contention accounting. The counters are only written while the
+ * lock is held, so they need no atomics of their own.
+ */
+typedef struct {
+    uint64_t acquisitions;
+    uint64_t contended;
+    uint64_t wait_cycles;
+    uint64_t hold_cycles;
+    uint64_t max_hold_cycles;
+    uint64_t acquired_tsc;
+} spinlock_stats_t;
+
+static inline uint64_t spinlock_read_tsc(void)
+{
+    uint32_t lo;
+    uint32_t hi;
+    __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void spinlock_lock_stats(spinlock_t *lock, spinlock_stats_t *stats)
+{
+    if (lock == NULL) {
+        return;
+    }
+    if (stats == NULL) {
+        spinlock_lock(lock);
+        return;
+    }
+
+    uint64_t wait_start = 0;
+    uint32_t contended = 0;
+    while (__atomic_exchange_n(&lock->value, 1u, __ATOMIC_ACQUIRE) != 0u) {
+        if (!contended) {
+            contended = 1;
+            wait_start = spinlock_read_tsc();
+        }
+        while (__atomic_load_n(&lock->value, __ATOMIC_RELAXED) != 0u) {
+            __asm__ volatile ("pause");
+        }
+    }
+
+    uint64_t now = spinlock_read_tsc();
+    stats->acquisitions++;
+    if (contended) {
+        stats->contended++;
+        stats->wait_cycles += now - wait_start;
+    }
+    stats->acquired_tsc = now;
+}
+
+static inline void spinlock_unlock_stats(spinlock_t *lock, spinlock_stats_t *stats)
+{
+    if (lock == NULL) {
+        return;
+    }
+    if (stats != NULL) {
+        uint64_t held = spinlock_read_tsc() - stats->acquired_tsc;
+        stats->hold_cycles += held;
+        if (held > stats->max_hold_cycles) {
+            stats->max_hold_cycles = held;
+        }
+    }
+    spinlock_unlock(lock);
+}
@@ -1,8 +1,10 @@
 #include "Syscall_Main.h"
 #include "Syscall_File.h"
 #include "../Common/Status.h"
+#include "../DefaultLibrary/DefaultLibrary.h"
 #include "../Drivers/PS2/PS2_Input.h"
 #include "../ProcessManager/ProcessManager.h"
+#include "../SMP/SMP_Main.h"
 #include "../Serial.h"
 #include "../WindowManager/WindowManager.h"
 
@@ -134,6 +136,7 @@ static process_capability_mask_t syscall_required_capability(uint64_t syscall_nu
 
         case SYSCALL_PROCESS_CREATE:
         case SYSCALL_PROCESS_SPAWN_ELF:
+        case SYSCALL_PROCESS_FORK:
         case SYSCALL_THREAD_CREATE:
             return PROCESS_CAP_PROCESS;
 
@@ -186,7 +189,9 @@ uint64_t syscall_dispatch(uint64_t saved_rsp,
                           uint64_t arg4)
 {
     int request_switch = 0;
-    int32_t current_pid = process_get_current_pid();
+    smp_kernel_lock();
+    /* Windows belong to the thread group, so every thread draws to the same one. */
+    int32_t owner_pid = process_get_current_group_pid();
     
     if (num == SYSCALL_INPUT_READ_KEYBOARD || num == SYSCALL_INPUT_READ_MOUSE) {
         ps2_input_poll();
@@ -250,6 +255,12 @@ uint64_t syscall_dispatch(uint64_t saved_rsp,
             break;
         }
 
+        case SYSCALL_PROCESS_FORK: {
+            int32_t pid = process_fork_current(saved_rsp, syscall_get_user_rsp());
+            set_syscall_i32(saved_rsp, pid);
+            break;
+        }
+
         case SYSCALL_PROCESS_YIELD:
             set_syscall_result(saved_rsp, 0);
             request_switch = 1;
@@ -262,7 +273,7 @@ uint64_t syscall_dispatch(uint64_t saved_rsp,
             break;
 
         case SYSCALL_THREAD_CREATE: {
-            int32_t tid = process_create_user(arg1);
+            int32_t tid = process_create_thread(arg1, arg2, arg3);
             set_syscall_i32(saved_rsp, tid);
             if (tid >= 0) {
                 request_switch = 1;
@@ -273,24 +284,24 @@ uint64_t syscall_dispatch(uint64_t saved_rsp,
         case SYSCALL_WM_CREATE_WINDOW: {
             uint32_t width = (uint32_t)arg1;
             uint32_t height = (uint32_t)arg2;
-            if (current_pid < 0 || width == 0 || height == 0 ||
+            if (owner_pid < 0 || width == 0 || height == 0 ||
                 width > SYSCALL_MAX_WINDOW_SIZE || height > SYSCALL_MAX_WINDOW_SIZE) {
                 syscall_fail(saved_rsp, num, OS_STATUS_INVALID_ARG, "invalid_window_size_or_pid");
                 break;
             }
 
-            int32_t id = window_manager_create_window_for_process(current_pid, width, height);
+            int32_t id = window_manager_create_window_for_process(owner_pid, width, height);
             set_syscall_i32(saved_rsp, id);
             break;
         }
 
         case SYSCALL_DRAW_PIXEL: {
-            if (current_pid < 0) {
+            if (owner_pid < 0) {
                 syscall_fail(saved_rsp, num, OS_STATUS_ACCESS_DENIED, "invalid_pid");
                 break;
             }
 
-            int32_t rc = window_manager_draw_pixel_for_process(current_pid,
+            int32_t rc = window_manager_draw_pixel_for_process(owner_pid,
                                                                (uint32_t)arg1,
                                                                (uint32_t)arg2,
                                                                (uint32_t)arg3);
@@ -299,7 +310,7 @@ uint64_t syscall_dispatch(uint64_t saved_rsp,
         }
 
         case SYSCALL_DRAW_FILL_RECT: {
-            if (current_pid < 0) {
+            if (owner_pid < 0) {
                 syscall_fail(saved_rsp, num, OS_STATUS_ACCESS_DENIED, "invalid_pid");
                 break;
             }
@@ -311,7 +322,7 @@ uint64_t syscall_dispatch(uint64_t saved_rsp,
                 break;
             }
 
-            int32_t rc = window_manager_fill_rect_for_process(current_pid,
+            int32_t rc = window_manager_fill_rect_for_process(owner_pid,
                                                               (uint32_t)arg1,
                                                               (uint32_t)arg2,
                                                               w,
@@ -322,12 +333,12 @@ uint64_t syscall_dispatch(uint64_t saved_rsp,
         }
 
         case SYSCALL_DRAW_PRESENT: {
-            if (current_pid < 0) {
+            if (owner_pid < 0) {
                 syscall_fail(saved_rsp, num, OS_STATUS_ACCESS_DENIED, "invalid_pid");
                 break;
             }
 
-            int32_t rc = window_manager_present_for_process(current_pid);
+            int32_t rc = window_manager_present_for_process(owner_pid);
             set_syscall_i32(saved_rsp, rc);
             break;
         }
@@ -497,11 +508,7 @@ uint64_t syscall_dispatch(uint64_t saved_rsp,
                 break;
             }
 
-            uint8_t *d = (uint8_t *)dst;
-            const uint8_t *s = (const uint8_t *)src;
-            for (uint64_t i = 0; i < n; ++i) {
-                d[i] = s[i];
-            }
+            memcpy(dst, src, (size_t)n);
 
             set_syscall_result(saved_rsp, (uint64_t)(uintptr_t)dst);
             break;
@@ -519,13 +526,7 @@ uint64_t syscall_dispatch(uint64_t saved_rsp,
                 break;
             }
 
-            int result = 0;
-            for (uint64_t i = 0; i < n; ++i) {
-                if (s1[i] != s2[i]) {
-                    result = (int)s1[i] - (int)s2[i];
-                    break;
-                }
-            }
+            int result = memcmp(s1, s2, (size_t)n);
 
             set_syscall_result(saved_rsp, (uint64_t)(int64_t)result);
             break;
@@ -541,9 +542,7 @@ uint64_t syscall_dispatch(uint64_t saved_rsp,
                 break;
             }
 
-            for (uint64_t i = 0; i < n; ++i) {
-                dst[i] = value;
-            }
+            memset(dst, value, (size_t)n);
 
             set_syscall_result(saved_rsp, arg1);
             break;
@@ -579,6 +578,7 @@ uint64_t syscall_dispatch(uint64_t saved_rsp,
     }
 
 schedule:
+    smp_kernel_unlock();
     {
         uint64_t current_user_rsp = syscall_get_user_rsp();
         uint64_t next_user_rsp = current_user_rsp;
@@ -2,6 +2,10 @@ BITS 64
 section .text
 global syscall_entry
 extern syscall_dispatch
+extern process_finish_switch
+
+USER_CS equ 0x2B            ; GDT_USER_CODE | 3
+USER_SS equ 0x23            ; GDT_USER_DATA | 3
 
 syscall_entry:
     swapgs
@@ -11,11 +15,16 @@ syscall_entry:
     mov rsp, [gs:8]
     
     and rsp, ~0xF
-    sub rsp, 8
 
     ; Saved frame layout (rsp = index 0):
     ; 0:rax 1:rdx 2:rsi 3:rdi 4:r8 5:r9 6:r10 7:r12
     ; 8:r13 9:r14 10:r15 11:rbx 12:rbp 13:rcx 14:r11
+    ; 15:rip 16:cs 17:rflags 18:rsp 19:ss (same shape as an iretq frame)
+    push qword USER_SS
+    push qword [gs:0]
+    push r11
+    push qword USER_CS
+    push rcx
     push r11
     push rcx
     push rbp
@@ -42,6 +51,7 @@ syscall_entry:
     call syscall_dispatch
     
     mov rsp, rax
+    call process_finish_switch
     
     pop rax
     pop rdx
@@ -59,9 +69,21 @@ syscall_entry:
     pop rcx
     pop r11
 
-    mov rsp, [gs:0]
-    
+    ; A context saved by the timer IRQ cannot be resumed with sysret, which
+    ; reloads rip/rflags from rcx/r11. Frames that came from syscall_entry
+    ; have matching values and take the fast path.
+    cmp rcx, [rsp]
+    jne .iret_return
+    cmp r11, [rsp + 16]
+    jne .iret_return
+
+    mov rsp, [rsp + 24]
+
     swapgs
     o64 sysret
 
+.iret_return:
+    swapgs
+    iretq
+
 section .note.GNU-stack noalloc noexec nowrite progbits
@@ -146,7 +146,7 @@ static int file_cache_refill(kernel_file_t *file, uint32_t offset)
 
 static int fd_is_owned_by_current_process(int32_t fd)
 {
-    int32_t current_pid = process_get_current_pid();
+    int32_t current_pid = process_get_current_group_pid();
     if (current_pid < 0) {
         return 0;
     }
@@ -155,7 +155,7 @@ static int fd_is_owned_by_current_process(int32_t fd)
 
 static int dir_is_owned_by_current_process(int32_t dir_handle)
 {
-    int32_t current_pid = process_get_current_pid();
+    int32_t current_pid = process_get_current_group_pid();
     if (current_pid < 0) {
         return 0;
     }
@@ -171,7 +171,7 @@ void syscall_file_init(void)
 int32_t syscall_file_open(const char *path, uint64_t flags)
 {
     FAT32_FILE file;
-    int32_t current_pid = process_get_current_pid();
+    int32_t current_pid = process_get_current_group_pid();
 
     if (path == NULL || path[0] == '\0' || current_pid < 0) {
         return file_fail_i32(__func__, OS_STATUS_INVALID_ARG, "invalid_path_or_pid");
@@ -207,7 +207,7 @@ int32_t syscall_file_open(const char *path, uint64_t flags)
 
 int32_t syscall_file_creat(const char *path)
 {
-    if (path == NULL || path[0] == '\0' || process_get_current_pid() < 0) {
+    if (path == NULL || path[0] == '\0' || process_get_current_group_pid() < 0) {
         return file_fail_i32(__func__, OS_STATUS_INVALID_ARG, "invalid_path_or_pid");
     }
     if (!fat32_creat(path)) {
@@ -361,7 +361,7 @@ int32_t syscall_file_close(int32_t fd)
 
 int32_t syscall_file_mkdir(const char *path)
 {
-    if (path == NULL || path[0] == '\0' || process_get_current_pid() < 0) {
+    if (path == NULL || path[0] == '\0' || process_get_current_group_pid() < 0) {
         return file_fail_i32(__func__, OS_STATUS_INVALID_ARG, "invalid_path_or_pid");
     }
 
@@ -370,7 +370,7 @@ int32_t syscall_file_mkdir(const char *path)
 
 int32_t syscall_file_opendir(const char *path)
 {
-    if (path == NULL || path[0] == '\0' || process_get_current_pid() < 0) {
+    if (path == NULL || path[0] == '\0' || process_get_current_group_pid() < 0) {
         return file_fail_i32(__func__, OS_STATUS_INVALID_ARG, "invalid_path_or_pid");
     }
 
@@ -379,7 +379,7 @@ int32_t syscall_file_opendir(const char *path)
         return file_fail_i32(__func__, OS_STATUS_NOT_FOUND, "dir_not_found");
     }
 
-    int32_t current_pid = process_get_current_pid();
+    int32_t current_pid = process_get_current_group_pid();
     for (int32_t i = 0; i < FILE_MAX_DIR_HANDLE; ++i) {
         if (g_dirs[i].used == 0) {
             g_dirs[i].used = 1;
@@ -431,7 +431,7 @@ int32_t syscall_file_closedir(int32_t dir_handle)
 
 int32_t syscall_file_unlink(const char *path)
 {
-    if (path == NULL || path[0] == '\0' || process_get_current_pid() < 0) {
+    if (path == NULL || path[0] == '\0' || process_get_current_group_pid() < 0) {
         return file_fail_i32(__func__, OS_STATUS_INVALID_ARG, "invalid_path_or_pid");
     }
     return fat32_unlink(path) ? 0 : file_fail_i32(__func__, OS_STATUS_IO_ERROR, "fat32_unlink_failed");
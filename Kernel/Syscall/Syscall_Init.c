@@ -4,7 +4,7 @@
 #include <stdint.h>
 
 #define SYSCALL_KERNEL_STACK_SIZE 4096
-#define SYSCALL_MAX_CPUS 4
+#define SYSCALL_MAX_CPUS OS_CONFIG_SMP_MAX_CPUS
 
 static inline void wrmsr(uint32_t msr, uint64_t value) {
     uint32_t low = value & 0xFFFFFFFF;
@@ -35,6 +35,7 @@
 #define SYSCALL_FILE_CREAT        42
 #define SYSCALL_USER_MMAP         43
 #define SYSCALL_PROCESS_SIGNAL    44
+#define SYSCALL_PROCESS_FORK      45
 
 #define SYSCALL_FRAME_RAX  0
 #define SYSCALL_FRAME_RDX  1
@@ -51,7 +52,17 @@
 #define SYSCALL_FRAME_RBP  12
 #define SYSCALL_FRAME_RCX  13
 #define SYSCALL_FRAME_R11  14
-#define SYSCALL_FRAME_QWORDS 15
+/*
+ * The top five slots have the layout of a hardware interrupt frame, so a
+ * context saved by syscall_entry and one saved by a user-mode IRQ can be
+ * resumed by either exit path.
+ */
+#define SYSCALL_FRAME_RIP    15
+#define SYSCALL_FRAME_CS     16
+#define SYSCALL_FRAME_RFLAGS 17
+#define SYSCALL_FRAME_RSP    18
+#define SYSCALL_FRAME_SS     19
+#define SYSCALL_FRAME_QWORDS 20
 
 void     syscall_init(void);
 uint64_t syscall_get_user_rsp(void);
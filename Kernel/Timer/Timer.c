@@ -4,6 +4,9 @@
 
 #include "../IDT/IDT_Main.h"
 #include "../IO/IO_Main.h"
+#include "../KernelConfig.h"
+#include "../Memory/Memory_Main.h"
+#include "../ProcessManager/ProcessManager.h"
 #include "../Serial.h"
 
 #define PIT_CHANNEL0_DATA 0x40
@@ -42,6 +45,8 @@ static void timer_irq_handler(void) {
     if (cb) {
         cb(g_tick_count);
     }
+    memory_zero_pool_tick();
+    process_scheduler_tick();
 }
 
 void timer_init(uint32_t hz) {
@@ -3,6 +3,12 @@
 #include <stdint.h>
 
 typedef void (*signal_handler_t)(int32_t signum);
+typedef void (*thread_entry_t)(void *arg);
 
 signal_handler_t signal(int32_t signum, signal_handler_t handler);
 void process_yield(void);
+int32_t process_fork(void);
+
+/* Threads share the caller's memory, open files and window. */
+int32_t thread_create(thread_entry_t entry, void *arg);
+__attribute__((noreturn)) void thread_exit(void);
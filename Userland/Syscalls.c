@@ -35,6 +35,7 @@
 #define SYSCALL_FILE_CREAT        42ULL
 #define SYSCALL_USER_MMAP         43ULL
 #define SYSCALL_PROCESS_SIGNAL    44ULL
+#define SYSCALL_PROCESS_FORK      45ULL
 
 #define OS_STATUS_INVALID_ARG   (-22LL)
 #define OS_STATUS_NOT_FOUND     (-2LL)
@@ -413,6 +414,36 @@ void process_yield(void)
     (void)syscall0(SYSCALL_PROCESS_YIELD);
 }
 
+int32_t process_fork(void)
+{
+    return os_errno_from_i32_status((int32_t)syscall0(SYSCALL_PROCESS_FORK));
+}
+
+void thread_exit(void)
+{
+    (void)syscall0(SYSCALL_PROCESS_EXIT);
+    for (;;) {
+    }
+}
+
+/* The kernel starts every thread here (rdi = entry, rsi = arg), so returning from entry exits the thread. */
+static void thread_start(thread_entry_t entry, void *arg)
+{
+    entry(arg);
+    thread_exit();
+}
+
+int32_t thread_create(thread_entry_t entry, void *arg)
+{
+    if (entry == NULL) {
+        return os_errno_from_i32_status((int32_t)OS_STATUS_INVALID_ARG);
+    }
+    return os_errno_from_i32_status((int32_t)syscall3(SYSCALL_THREAD_CREATE,
+                                                      (uint64_t)(uintptr_t)thread_start,
+                                                      (uint64_t)(uintptr_t)entry,
+                                                      (uint64_t)(uintptr_t)arg));
+}
+
 int32_t input_read_keyboard(input_keyboard_event_t *event_out)
 {
     return os_errno_from_i32_status((int32_t)syscall1(SYSCALL_INPUT_READ_KEYBOARD, (uint64_t)event_out));